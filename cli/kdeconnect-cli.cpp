@@ -157,11 +157,16 @@ int main(int argc, char** argv)
                 urls.append(url);
             }
 
+            //Several files go as one batch, so they don't all start transferring at once
+            QStringList urlStrings;
             for (const QUrl& url : urls) {
-                QDBusMessage msg = QDBusMessage::createMethodCall(QStringLiteral("org.kde.kdeconnect"), "/modules/kdeconnect/devices/"+device+"/share", QStringLiteral("org.kde.kdeconnect.device.share"), QStringLiteral("shareUrl"));
-                msg.setArguments(QVariantList() << url.toString());
-                blockOnReply(QDBusConnection::sessionBus().asyncCall(msg));
-                QTextStream(stdout) << i18n("Shared %1", url.toString()) << endl;
+                urlStrings.append(url.toString());
+            }
+            QDBusMessage msg = QDBusMessage::createMethodCall(QStringLiteral("org.kde.kdeconnect"), "/modules/kdeconnect/devices/"+device+"/share", QStringLiteral("org.kde.kdeconnect.device.share"), QStringLiteral("shareUrls"));
+            msg.setArguments(QVariantList() << urlStrings);
+            blockOnReply(QDBusConnection::sessionBus().asyncCall(msg));
+            for (const QString& url : qAsConst(urlStrings)) {
+                QTextStream(stdout) << i18n("Shared %1", url) << endl;
             }
         } else if(parser.isSet(QStringLiteral("pair"))) {
             DeviceDbusInterface dev(device);
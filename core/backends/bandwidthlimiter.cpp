@@ -0,0 +1,176 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bandwidthlimiter.h"
+
+#include <QSet>
+
+#include <cmath>
+#include <limits>
+
+#include "kdeconnectconfig.h"
+
+Q_GLOBAL_STATIC_WITH_ARGS(BandwidthLimiter, s_instance, (KdeConnectConfig::instance()->payloadRateLimit()))
+
+TokenBucket::TokenBucket(qint64 rate)
+    : m_rate(rate)
+    , m_tokens(burst())
+    , m_lastRefill(-1)
+{
+}
+
+void TokenBucket::setRate(qint64 rate, qint64 now)
+{
+    refill(now);
+    m_rate = qMax<qint64>(0, rate);
+    m_tokens = qMin<double>(m_tokens, burst());
+}
+
+qint64 TokenBucket::available(qint64 now)
+{
+    if (m_rate == 0) {
+        return std::numeric_limits<qint64>::max();
+    }
+    refill(now);
+    return qint64(m_tokens);
+}
+
+void TokenBucket::consume(qint64 bytes, qint64 now)
+{
+    if (m_rate == 0) {
+        return;
+    }
+    refill(now);
+    m_tokens -= bytes;
+}
+
+int TokenBucket::msecsUntil(qint64 bytes, qint64 now)
+{
+    if (m_rate == 0) {
+        return 0;
+    }
+    refill(now);
+    const double missing = bytes - m_tokens;
+    return missing > 0 ? int(std::ceil(missing * 1000 / m_rate)) : 0;
+}
+
+void TokenBucket::refill(qint64 now)
+{
+    if (m_lastRefill >= 0 && now > m_lastRefill) {
+        m_tokens = qMin<double>(burst(), m_tokens + double(now - m_lastRefill) * m_rate / 1000);
+    }
+    m_lastRefill = qMax(m_lastRefill, now);
+}
+
+BandwidthLimiter* BandwidthLimiter::instance()
+{
+    return s_instance();
+}
+
+BandwidthLimiter::BandwidthLimiter(qint64 rate)
+    : m_global(rate)
+{
+    m_clock.start();
+}
+
+void BandwidthLimiter::setRate(qint64 rate)
+{
+    m_global.setRate(rate, m_clock.elapsed());
+}
+
+void BandwidthLimiter::setDeviceRate(const QString& deviceId, qint64 rate)
+{
+    m_devices[deviceId].bucket.setRate(rate, m_clock.elapsed());
+}
+
+qint64 BandwidthLimiter::deviceRate(const QString& deviceId) const
+{
+    const auto it = m_devices.constFind(deviceId);
+    return it == m_devices.constEnd() ? 0 : it->bucket.rate();
+}
+
+qint64 BandwidthLimiter::allowance(const QString& deviceId, qint64 maxSize)
+{
+    const qint64 now = m_clock.elapsed();
+    DeviceState& state = m_devices[deviceId];
+    if (now < state.interactiveUntil) {
+        return 0;
+    }
+
+    const qint64 allowed = qMin(maxSize, qMin(m_global.available(now), state.bucket.available(now)));
+    return allowed >= qMin(maxSize, MinAllowance) ? allowed : 0;
+}
+
+void BandwidthLimiter::consume(const QString& deviceId, qint64 bytes)
+{
+    const qint64 now = m_clock.elapsed();
+    DeviceState& state = m_devices[deviceId];
+    m_global.consume(bytes, now);
+    state.bucket.consume(bytes, now);
+    updateRate(state, now);
+    state.windowBytes += bytes;
+}
+
+int BandwidthLimiter::msecsToWait(const QString& deviceId)
+{
+    const qint64 now = m_clock.elapsed();
+    DeviceState& state = m_devices[deviceId];
+    const int wait = qMax(m_global.msecsUntil(MinAllowance, now), state.bucket.msecsUntil(MinAllowance, now));
+    return qMax(1, qMax(wait, int(state.interactiveUntil - now)));
+}
+
+bool BandwidthLimiter::isInteractive(const QString& packetType)
+{
+    static const QSet<QString> interactiveTypes = {
+        QStringLiteral("kdeconnect.mousepad.request"),
+        QStringLiteral("kdeconnect.mousepad.echo"),
+        QStringLiteral("kdeconnect.mousepad.keyboardstate"),
+        QStringLiteral("kdeconnect.mpris"),
+        QStringLiteral("kdeconnect.mpris.request"),
+        QStringLiteral("kdeconnect.systemvolume"),
+        QStringLiteral("kdeconnect.systemvolume.request"),
+    };
+    return interactiveTypes.contains(packetType);
+}
+
+void BandwidthLimiter::interactiveTraffic(const QString& deviceId)
+{
+    m_devices[deviceId].interactiveUntil = m_clock.elapsed() + InteractiveHold;
+}
+
+qint64 BandwidthLimiter::currentRate(const QString& deviceId)
+{
+    const auto it = m_devices.find(deviceId);
+    if (it == m_devices.end()) {
+        return 0;
+    }
+    updateRate(*it, m_clock.elapsed());
+    return it->lastRate;
+}
+
+void BandwidthLimiter::updateRate(DeviceState& state, qint64 now)
+{
+    const qint64 elapsed = now - state.windowStart;
+    if (elapsed >= RateWindow) {
+        state.lastRate = state.windowBytes * 1000 / elapsed;
+        state.windowStart = now;
+        state.windowBytes = 0;
+    }
+}
@@ -0,0 +1,115 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BANDWIDTHLIMITER_H
+#define BANDWIDTHLIMITER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QString>
+
+#include "kdeconnectcore_export.h"
+
+/*
+ * Lets through a number of bytes per second, with bursts of up to a quarter of
+ * a second worth of them. Times are in ms, from any clock that only goes forward.
+ */
+class KDECONNECTCORE_EXPORT TokenBucket
+{
+public:
+    static const qint64 MinBurst = 16 * 1024;
+
+    explicit TokenBucket(qint64 rate = 0);
+
+    //Bytes per second, 0 for unlimited
+    void setRate(qint64 rate, qint64 now);
+    qint64 rate() const { return m_rate; }
+
+    qint64 available(qint64 now);
+    void consume(qint64 bytes, qint64 now);
+    //How long until @p bytes are available
+    int msecsUntil(qint64 bytes, qint64 now);
+
+private:
+    qint64 burst() const { return qMax(m_rate / 4, MinBurst); }
+    void refill(qint64 now);
+
+    qint64 m_rate;
+    double m_tokens;
+    qint64 m_lastRefill;
+};
+
+/*
+ * Shapes what payloads send, across all devices and for every device on its own.
+ *
+ * Writers ask for an allowance before every chunk and report what they sent.
+ * Input, media and volume control packets are interactive: payloads to the same
+ * device hold off for InteractiveHold after one was sent or received, so neither
+ * the packet nor its answer queue up behind a file transfer on a saturated link. Other packets, like SMS or contact
+ * dumps, are counted as if they were payload.
+ */
+class KDECONNECTCORE_EXPORT BandwidthLimiter
+{
+public:
+    static const int InteractiveHold = 50;
+    //Allowances smaller than this aren't worth a write, unless less was asked for
+    static const qint64 MinAllowance = 4 * 1024;
+    //The current rate is measured over this many ms
+    static const int RateWindow = 1000;
+
+    //Null once it was destroyed at exit
+    static BandwidthLimiter* instance();
+
+    explicit BandwidthLimiter(qint64 rate = 0);
+
+    //Bytes per second for all payloads together, 0 for unlimited
+    void setRate(qint64 rate);
+    qint64 rate() const { return m_global.rate(); }
+    void setDeviceRate(const QString& deviceId, qint64 rate);
+    qint64 deviceRate(const QString& deviceId) const;
+
+    //How much a payload to the device may send now, at most @p maxSize. If 0, ask again after msecsToWait()
+    qint64 allowance(const QString& deviceId, qint64 maxSize);
+    void consume(const QString& deviceId, qint64 bytes);
+    int msecsToWait(const QString& deviceId);
+
+    static bool isInteractive(const QString& packetType);
+    void interactiveTraffic(const QString& deviceId);
+
+    //Bytes per second payloads to the device were sent at recently
+    qint64 currentRate(const QString& deviceId);
+
+private:
+    struct DeviceState {
+        TokenBucket bucket;
+        qint64 interactiveUntil = 0;
+        qint64 windowStart = 0;
+        qint64 windowBytes = 0;
+        qint64 lastRate = 0;
+    };
+
+    void updateRate(DeviceState& state, qint64 now);
+
+    QElapsedTimer m_clock;
+    TokenBucket m_global;
+    QHash<QString, DeviceState> m_devices;
+};
+
+#endif
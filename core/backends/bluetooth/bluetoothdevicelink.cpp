@@ -55,7 +55,8 @@ bool BluetoothDeviceLink::sendPacket(NetworkPacket& np)
         np.setPayloadTransferInfo(uploadJob->transferInfo());
         uploadJob->start();
     }
-    int written = mSocketReader->write(np.serialize());
+    np.serialize(&m_sendBuffer);
+    int written = mSocketReader->write(m_sendBuffer);
     return (written != -1);
 }
 
@@ -63,7 +63,7 @@ void BluetoothUploadJob::newConnection()
         disconnect(mServer, &QBluetoothServer::newConnection, this, &BluetoothUploadJob::newConnection);
         mServiceInfo.unregisterService();
 
-        if (!mData->open(QIODevice::ReadOnly)) {
+        if (!mData->isOpen() && !mData->open(QIODevice::ReadOnly)) {
             qCWarning(KDECONNECT_CORE) << "error when opening the input to upload";
             m_socket->close();
             deleteLater();
@@ -21,6 +21,8 @@
 
 #include "devicelinereader.h"
 
+#include "core_debug.h"
+
 DeviceLineReader::DeviceLineReader(QIODevice* device, QObject* parent)
     : QObject(parent)
     , m_device(device)
@@ -31,25 +33,26 @@ DeviceLineReader::DeviceLineReader(QIODevice* device, QObject* parent)
             this, SIGNAL(disconnected()));
 }
 
-void DeviceLineReader::dataReceived()
+QByteArray DeviceLineReader::readLine()
 {
-    while(m_device->canReadLine()) {
-        const QByteArray line = m_device->readLine();
-        if (line.length() > 1) {
-            m_packets.enqueue(line);//we don't want single \n
-        }
+    PacketFramer::Frame frame;
+    if (!m_framer.nextFrame(&frame)) {
+        return QByteArray();
     }
+    return QByteArray(frame.data.constData(), frame.data.size());
+}
 
-    //If we still have things to read from the device, call dataReceived again
-    //We do this manually because we do not trust readyRead to be emitted again
-    //So we call this method again just in case.
-    if (m_device->bytesAvailable() > 0) {
-        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
+void DeviceLineReader::dataReceived()
+{
+    //Everything buffered is read at once, so there is no need to reschedule ourselves
+    if (!m_framer.readFrom(m_device)) {
+        qCWarning(KDECONNECT_CORE) << "DeviceLineReader: closing the device after a framing error";
+        m_device->close();
         return;
     }
 
     //If we have any packets, tell it to the world.
-    if (!m_packets.isEmpty()) {
+    if (m_framer.hasFrame()) {
         Q_EMIT readyRead();
     }
 }
@@ -23,13 +23,14 @@
 
 #include <QObject>
 #include <QString>
-#include <QQueue>
 #include <QIODevice>
 
+#include "packetframer.h"
+
 /*
  * Encapsulates a QIODevice and implements the same methods of its API that are
  * used by LanDeviceLink and BluetoothDeviceLink, but readyRead is emitted only
- * when a newline is found.
+ * when a newline is found. See PacketFramer.
  */
 class DeviceLineReader
     : public QObject
@@ -39,9 +40,9 @@ class DeviceLineReader
 public:
     DeviceLineReader(QIODevice* device, QObject* parent = 0);
 
-    QByteArray readLine() { return m_packets.dequeue(); }
+    QByteArray readLine();
     qint64 write(const QByteArray& data) { return m_device->write(data); }
-    qint64 bytesAvailable() const { return m_packets.size(); }
+    qint64 bytesAvailable() const { return m_framer.hasFrame() ? 1 : 0; }
 
 Q_SIGNALS:
     void readyRead();
@@ -51,9 +52,8 @@ private Q_SLOTS:
     void dataReceived();
 
 private:
-    QByteArray m_lastChunk;
     QIODevice* m_device;
-    QQueue<QByteArray> m_packets;
+    PacketFramer m_framer;
 
 };
 
@@ -23,6 +23,7 @@
 
 #include <QObject>
 #include <QIODevice> //Fix build on older QCA
+#include <QVector>
 #include <QtCrypto>
 
 #include "core/networkpacket.h"
@@ -60,16 +61,26 @@ public:
     //The daemon will periodically destroy unpaired links if this returns false
     virtual bool linkShouldBeKeptAlive() { return false; }
 
+    //Counters about the traffic of the current connection, for diagnostics
+    virtual QVariantMap statistics() const { return QVariantMap(); }
+
 Q_SIGNALS:
     void pairingRequest(PairingHandler* handler);
     void pairingRequestExpired(PairingHandler* handler);
     void pairStatusChanged(DeviceLink::PairStatus status);
     void pairingError(const QString& error);
     void receivedPacket(const NetworkPacket& np);
+    //Several packets that arrived together, in the order they were received
+    void receivedPackets(const QVector<NetworkPacket>& packets);
+    //Elements of a streamed array, decoded before the rest of the packet arrived
+    void receivedPacketElements(const NetworkPacket& header, const QVariantList& elements);
 
 protected:
     QCA::PrivateKey m_privateKey;
 
+    //Reused by sendPacket so that serializing doesn't allocate a new buffer for every packet
+    QByteArray m_sendBuffer;
+
 private:
     const QString m_deviceId;
     LinkProvider* m_linkProvider;
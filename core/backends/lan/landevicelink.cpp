@@ -18,6 +18,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <QElapsedTimer>
+
 #include <KLocalizedString>
 
 #include "landevicelink.h"
@@ -27,16 +29,37 @@
 #include "uploadjob.h"
 #include "socketlinereader.h"
 #include "lanlinkprovider.h"
+#include "lazypayloadsocket.h"
+#include "../bandwidthlimiter.h"
+#include "../stripedpayload.h"
 
 LanDeviceLink::LanDeviceLink(const QString& deviceId, LinkProvider* parent, QSslSocket* socket, ConnectionStarted connectionSource)
     : DeviceLink(deviceId, parent)
     , m_socketLineReader(nullptr)
+    , m_packetEncoding(NetworkPacket::JsonEncoding)
+    , m_payloadStripes(1)
 {
     reset(socket, connectionSource);
 }
 
+LanDeviceLink::~LanDeviceLink()
+{
+    logStatistics();
+
+    //The peer only learns about payloads through this link, the ones it didn't come for yet won't be fetched
+    const QSet<UploadJob*> uploads = m_uploads;
+    for (UploadJob* job : uploads) {
+        if (job->isWaiting()) {
+            job->kill();
+        }
+    }
+}
+
 void LanDeviceLink::reset(QSslSocket* socket, ConnectionStarted connectionSource)
 {
+    //Payloads in flight on the old socket are lost
+    m_multiplexer.reset();
+
     if (m_socketLineReader) {
         disconnect(m_socketLineReader->m_socket, &QAbstractSocket::disconnected, this, &QObject::deleteLater);
         delete m_socketLineReader;
@@ -46,6 +69,7 @@ void LanDeviceLink::reset(QSslSocket* socket, ConnectionStarted connectionSource
 
     connect(socket, &QAbstractSocket::disconnected, this, &QObject::deleteLater);
     connect(m_socketLineReader, &SocketLineReader::readyRead, this, &LanDeviceLink::dataReceived);
+    connect(m_socketLineReader, &SocketLineReader::partialFrameReceived, this, &LanDeviceLink::partialFrameReceived);
 
     //We take ownership of the socket.
     //When the link provider destroys us,
@@ -54,6 +78,13 @@ void LanDeviceLink::reset(QSslSocket* socket, ConnectionStarted connectionSource
     socket->setParent(m_socketLineReader);
 
     m_connectionSource = connectionSource;
+    m_packetEncoding = NetworkPacket::JsonEncoding;
+
+    //The peer starts with fresh compression streams on a new socket too
+    logStatistics();
+    m_compressor.reset();
+    m_receiveStatistics = ReceiveStatistics();
+    m_streamDecoder.reset();
 
     QString certString = KdeConnectConfig::instance()->getDeviceProperty(deviceId(), QStringLiteral("certificate"));
     DeviceLink::setPairStatus(certString.isEmpty()? PairStatus::NotPaired : PairStatus::Paired);
@@ -76,6 +107,57 @@ QHostAddress LanDeviceLink::hostAddress() const
     return addr;
 }
 
+void LanDeviceLink::setPacketEncoding(NetworkPacket::Encoding encoding, bool compression, bool payloadStreams)
+{
+    m_packetEncoding = encoding;
+    m_socketLineReader->setFraming(encoding == NetworkPacket::CborEncoding ? PacketFramer::LengthPrefixedFraming : PacketFramer::LineFraming);
+    m_compressor.reset((compression && encoding == NetworkPacket::CborEncoding) ? new PacketCompressor : nullptr);
+    m_multiplexer.reset((payloadStreams && encoding == NetworkPacket::CborEncoding) ? new PayloadMultiplexer(m_socketLineReader->m_socket) : nullptr);
+    if (m_multiplexer) {
+        m_multiplexer->setDeviceId(deviceId());
+    }
+}
+
+void LanDeviceLink::logStatistics() const
+{
+    if (m_receiveStatistics.batches > 0) {
+        qCDebug(KDECONNECT_CORE) << "Received" << m_receiveStatistics.packets << "packets from" << deviceId()
+                                 << "in" << m_receiveStatistics.batches << "batches, largest" << m_receiveStatistics.largestBatch;
+    }
+
+    if (!m_compressor) {
+        return;
+    }
+
+    const PacketCompressor::Statistics& sent = m_compressor->sentStatistics();
+    const PacketCompressor::Statistics& received = m_compressor->receivedStatistics();
+    qCDebug(KDECONNECT_CORE) << "Compression for" << deviceId()
+                             << "sent:" << sent.packets << "packets," << sent.uncompressedBytes << "->" << sent.compressedBytes << "bytes,"
+                             << "ratio" << sent.ratio() << "in" << sent.compressionNsecs / 1000000.0 << "ms"
+                             << "received:" << received.packets << "packets," << received.compressedBytes << "->" << received.uncompressedBytes << "bytes,"
+                             << "ratio" << received.ratio() << "in" << received.decompressionNsecs / 1000000.0 << "ms";
+}
+
+QVariantMap LanDeviceLink::statistics() const
+{
+    QVariantMap statistics;
+    statistics[QStringLiteral("receivedBatches")] = m_receiveStatistics.batches;
+    statistics[QStringLiteral("receivedPackets")] = m_receiveStatistics.packets;
+    statistics[QStringLiteral("largestBatch")] = m_receiveStatistics.largestBatch;
+    statistics[QStringLiteral("packetsPerBatch")] = m_receiveStatistics.packetsPerBatch();
+    if (m_compressor) {
+        const PacketCompressor::Statistics& sent = m_compressor->sentStatistics();
+        const PacketCompressor::Statistics& received = m_compressor->receivedStatistics();
+        statistics[QStringLiteral("compressedPacketsSent")] = sent.packets;
+        statistics[QStringLiteral("compressionRatioSent")] = sent.ratio();
+        statistics[QStringLiteral("compressionMsecs")] = sent.compressionNsecs / 1000000.0;
+        statistics[QStringLiteral("compressedPacketsReceived")] = received.packets;
+        statistics[QStringLiteral("compressionRatioReceived")] = received.ratio();
+        statistics[QStringLiteral("decompressionMsecs")] = received.decompressionNsecs / 1000000.0;
+    }
+    return statistics;
+}
+
 QString LanDeviceLink::name()
 {
     return QStringLiteral("LanLink"); // Should be same in both android and kde version
@@ -84,10 +166,43 @@ QString LanDeviceLink::name()
 bool LanDeviceLink::sendPacket(NetworkPacket& np)
 {
     if (np.hasPayload()) {
-        np.setPayloadTransferInfo(sendPayload(np)->transferInfo());
+        if (m_multiplexer) {
+            //The payload follows the packet on this same socket
+            np.setPayloadTransferInfo({{QStringLiteral("streamId"), m_multiplexer->send(np.payload(), np.payloadSize())}});
+        } else {
+            UploadJob* job = sendPayload(np);
+            if (!job) {
+                qCWarning(KDECONNECT_CORE) << "Not sending" << np.type() << "to" << deviceId() << ", its payload can't be offered";
+                return false;
+            }
+            np.setPayloadTransferInfo(job->transferInfo());
+        }
+    }
+
+    int written;
+    if (m_packetEncoding == NetworkPacket::CborEncoding) {
+        np.serializeCbor(&m_sendBuffer);
+        if (m_compressor && m_sendBuffer.size() >= PacketCompressor::MinimumSize
+                && m_compressor->compress(m_sendBuffer, &m_compressionBuffer)) {
+            written = m_socketLineReader->writeFrame(PacketFramer::CompressedPacketFrame, m_compressionBuffer);
+        } else {
+            written = m_socketLineReader->writeFrame(PacketFramer::PacketFrame, m_sendBuffer);
+        }
+    } else {
+        np.serialize(&m_sendBuffer);
+        written = m_socketLineReader->write(m_sendBuffer);
     }
 
-    int written = m_socketLineReader->write(np.serialize());
+    BandwidthLimiter* limiter = BandwidthLimiter::instance();
+    if (limiter && !np.hasPayload()) {
+        if (BandwidthLimiter::isInteractive(np.type())) {
+            //Interactive traffic goes first, payloads to this device wait a moment
+            limiter->interactiveTraffic(deviceId());
+        } else if (written > 0) {
+            //Big dumps share the link with the payloads, and their rate
+            limiter->consume(deviceId(), written);
+        }
+    }
 
     //Actually we can't detect if a packet is received or not. We keep TCP
     //"ESTABLISHED" connections that look legit (return true when we use them),
@@ -98,21 +213,94 @@ bool LanDeviceLink::sendPacket(NetworkPacket& np)
 UploadJob* LanDeviceLink::sendPayload(const NetworkPacket& np)
 {
     UploadJob* job = new UploadJob(np.payload(), deviceId());
+    //Only files can be read at several places at once. The peer's count is within MaxStripes already
+    const int stripes = qBound(1, KdeConnectConfig::instance()->payloadStripes(), m_payloadStripes);
+    if (stripes > 1 && np.payloadSize() >= UploadJob::StripeThreshold && qobject_cast<QFile*>(np.payload().data())) {
+        job->setStripes(stripes);
+    }
     job->start();
+    if (job->error()) {
+        return nullptr;
+    }
+
+    m_uploads.insert(job);
+    connect(job, &QObject::destroyed, this, [this, job]() {
+        m_uploads.remove(job);
+    });
     return job;
 }
 
-void LanDeviceLink::dataReceived()
+int LanDeviceLink::waitingUploads() const
 {
-    if (m_socketLineReader->bytesAvailable() == 0) return;
+    int waiting = 0;
+    for (const UploadJob* job : m_uploads) {
+        waiting += job->isWaiting();
+    }
+    return waiting;
+}
 
-    const QByteArray serializedPacket = m_socketLineReader->readLine();
-    NetworkPacket packet(QString::null);
-    NetworkPacket::unserialize(serializedPacket, &packet);
+bool LanDeviceLink::readPacket(NetworkPacket* packet, QVector<NetworkPacket>* batch)
+{
+    //The frame points into the reader's buffer, it must be decoded before calling the reader again
+    quint8 frameType;
+    QByteArray frame = m_socketLineReader->readFrame(&frameType);
+
+    if (m_streamDecoder.isStreaming()) {
+        //The end of a line that partialFrameReceived() already started decoding
+        QVariantList elements;
+        m_streamDecoder.decode(frame, &elements);
+        deliverBatch(batch);
+        deliverElements(elements);
+        const bool success = m_streamDecoder.takePacket(packet);
+        if (!success) {
+            qCWarning(KDECONNECT_CORE) << "LanDeviceLink: discarding the rest of a streamed packet of type" << m_streamDecoder.header().type();
+        }
+        m_streamDecoder.reset();
+        return success;
+    }
+    m_streamDecoder.reset();
+
+    if (m_multiplexer && PayloadMultiplexer::isPayloadFrame(frameType)) {
+        if (!m_multiplexer->handleFrame(frameType, frame)) {
+            qCWarning(KDECONNECT_CORE) << "LanDeviceLink: dropping connection to" << deviceId() << "after a payload stream error";
+            m_socketLineReader->m_socket->abort();
+        }
+        return false;
+    }
 
-    //qCDebug(KDECONNECT_CORE) << "LanDeviceLink dataReceived" << serializedPacket;
+    if (frameType == PacketFramer::CompressedPacketFrame) {
+        //Once a frame is lost the inflate stream can't be resynchronized
+        if (!m_compressor || !m_compressor->decompress(frame, &m_compressionBuffer, PacketFramer::DefaultMaxFrameSize)) {
+            qCWarning(KDECONNECT_CORE) << "LanDeviceLink: dropping connection to" << deviceId() << "after a compressed frame could not be inflated";
+            m_socketLineReader->m_socket->abort();
+            return false;
+        }
+        frame = m_compressionBuffer;
+        frameType = PacketFramer::PacketFrame;
+    }
+
+    const bool success = (frameType == PacketFramer::PacketFrame)
+        && (m_packetEncoding == NetworkPacket::CborEncoding ? NetworkPacket::unserializeCbor(frame, packet)
+                                                            : NetworkPacket::unserialize(frame, packet));
+    if (!success) {
+        qCWarning(KDECONNECT_CORE) << "LanDeviceLink: discarding frame of type" << frameType << "and size" << frame.size();
+    }
+    return success;
+}
+
+void LanDeviceLink::handlePacket(NetworkPacket& packet, QVector<NetworkPacket>* batch)
+{
+    //qCDebug(KDECONNECT_CORE) << "LanDeviceLink dataReceived" << packet;
+
+    BandwidthLimiter* limiter = BandwidthLimiter::instance();
+    if (limiter && BandwidthLimiter::isInteractive(packet.type())) {
+        //Whatever we answer should not wait for our payloads either
+        limiter->interactiveTraffic(deviceId());
+    }
 
     if (packet.type() == PACKET_TYPE_PAIR) {
+        //Deliver what came before first, to keep the order
+        deliverBatch(batch);
         //TODO: Handle pair/unpair requests and forward them (to the pairing handler?)
         qobject_cast<LanLinkProvider*>(provider())->incomingPairPacket(this, packet);
         return;
@@ -122,26 +310,115 @@ void LanDeviceLink::dataReceived()
         //qCDebug(KDECONNECT_CORE) << "HasPayloadTransferInfo";
         const QVariantMap transferInfo = packet.payloadTransferInfo();
 
-        QSharedPointer<QSslSocket> socket(new QSslSocket);
+        if (m_multiplexer && transferInfo.contains(QStringLiteral("streamId"))) {
+            packet.setPayload(m_multiplexer->receive(transferInfo[QStringLiteral("streamId")].toUInt()), packet.payloadSize());
+            batch->append(std::move(packet));
+            return;
+        }
+
+        const quint16 port = transferInfo[QStringLiteral("port")].toInt();
+        const int stripes = transferInfo.value(QStringLiteral("stripes"), 1).toInt();
+        if (stripes > 1 && stripes <= StripedPayload::MaxStripes) {
+            QSharedPointer<StripedPayload> payload(new StripedPayload(packet.payloadSize()));
+            for (int i = 0; i < stripes; ++i) {
+                payload->addStripe(connectPayloadSocket(port));
+            }
+            packet.setPayload(payload, packet.payloadSize());
+        } else {
+            //Nothing is connected until somebody reads it, plugins may well not
+            packet.setPayload(QSharedPointer<LazyPayloadSocket>(new LazyPayloadSocket(m_socketLineReader->peerAddress(), port, deviceId())), packet.payloadSize());
+        }
+    }
+
+    batch->append(std::move(packet));
+}
+
+QSslSocket* LanDeviceLink::connectPayloadSocket(quint16 port)
+{
+    return LazyPayloadSocket::connectSocket(m_socketLineReader->peerAddress(), port, deviceId());
+}
+
+void LanDeviceLink::dataReceived()
+{
+    if (m_socketLineReader->bytesAvailable() == 0) return;
 
-        LanLinkProvider::configureSslSocket(socket.data(), deviceId(), true);
+    //Everything that is already framed is delivered at once, instead of one packet per event loop turn,
+    //but never for longer than the time budget so the GUI is not starved by a burst of packets
+    QElapsedTimer timer;
+    timer.start();
 
-        // emit readChannelFinished when the socket gets disconnected. This seems to be a bug in upstream QSslSocket.
-        // Needs investigation and upstreaming of the fix. QTBUG-62257
-        connect(socket.data(), &QAbstractSocket::disconnected, socket.data(), &QAbstractSocket::readChannelFinished);
+    QVector<NetworkPacket> batch;
+    while (m_socketLineReader->bytesAvailable() > 0) {
+        if (timer.elapsed() >= BatchTimeBudget) {
+            QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
+            break;
+        }
 
-        const QString address = m_socketLineReader->peerAddress().toString();
-        const quint16 port = transferInfo[QStringLiteral("port")].toInt();
-        socket->connectToHostEncrypted(address, port, QIODevice::ReadWrite);
-        packet.setPayload(socket, packet.payloadSize());
+        NetworkPacket packet(QString::null);
+        if (readPacket(&packet, &batch)) {
+            handlePacket(packet, &batch);
+        } else if (!m_socketLineReader->m_socket->isOpen()) {
+            break; //Dropped after a protocol error, what is still buffered can't be trusted
+        }
     }
 
-    Q_EMIT receivedPacket(packet);
+    deliverBatch(&batch);
 
-    if (m_socketLineReader->bytesAvailable() > 0) {
-        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
+    //The next line may already be big enough to start streaming it
+    if (m_socketLineReader->bytesAvailable() == 0 && m_socketLineReader->pendingBytes() > 0) {
+        partialFrameReceived();
     }
+}
+
+void LanDeviceLink::partialFrameReceived()
+{
+    //Only json lines can be decoded while they arrive, and only big ones are worth it
+    if (m_packetEncoding != NetworkPacket::JsonEncoding || m_streamDecoder.isDeclined()
+            || (!m_streamDecoder.isStreaming() && m_socketLineReader->pendingBytes() < StreamingThreshold)) {
+        return;
+    }
+
+    QVariantList elements;
+    const int consumed = m_streamDecoder.decode(m_socketLineReader->pendingData(), &elements);
+    if (m_streamDecoder.isStreaming() && m_streamDecoder.hasError()) {
+        //Drop the rest of the malformed line as it arrives, the next line starts clean
+        m_socketLineReader->discardPending(m_socketLineReader->pendingBytes());
+    } else {
+        m_socketLineReader->discardPending(consumed);
+    }
+    deliverElements(elements);
+
+    NetworkPacket packet(QString::null);
+    if (m_streamDecoder.takePacket(&packet)) {
+        QVector<NetworkPacket> batch;
+        handlePacket(packet, &batch);
+        deliverBatch(&batch);
+    }
+}
 
+void LanDeviceLink::deliverElements(const QVariantList& elements)
+{
+    if (!elements.isEmpty()) {
+        Q_EMIT receivedPacketElements(m_streamDecoder.header(), elements);
+    }
+}
+
+void LanDeviceLink::deliverBatch(QVector<NetworkPacket>* batch)
+{
+    if (batch->isEmpty()) {
+        return;
+    }
+
+    m_receiveStatistics.batches++;
+    m_receiveStatistics.packets += batch->size();
+    m_receiveStatistics.largestBatch = qMax(m_receiveStatistics.largestBatch, batch->size());
+
+    if (batch->size() == 1) {
+        Q_EMIT receivedPacket(batch->first());
+    } else {
+        Q_EMIT receivedPackets(*batch);
+    }
+    batch->clear();
 }
 
 void LanDeviceLink::userRequestsPair()
@@ -171,6 +448,8 @@ void LanDeviceLink::setPairStatus(PairStatus status)
         Q_ASSERT(!m_socketLineReader->peerCertificate().isNull());
         KdeConnectConfig::instance()->setDeviceProperty(deviceId(), QStringLiteral("certificate"), m_socketLineReader->peerCertificate().toPem());
     }
+    //Trusted sockets verify the certificate stored for the device, which this changes
+    LanLinkProvider::invalidateSslConfiguration(deviceId());
 }
 
 bool LanDeviceLink::linkShouldBeKeptAlive() {
@@ -25,9 +25,13 @@
 #include <QString>
 #include <QSslSocket>
 #include <QSslCertificate>
+#include <QScopedPointer>
+#include <QSet>
 
 #include <kdeconnectcore_export.h>
 #include "backends/devicelink.h"
+#include "../packetcompressor.h"
+#include "../payloadmultiplexer.h"
 #include "uploadjob.h"
 
 class SocketLineReader;
@@ -41,11 +45,16 @@ public:
     enum ConnectionStarted : bool { Locally, Remotely };
 
     LanDeviceLink(const QString& deviceId, LinkProvider* parent, QSslSocket* socket, ConnectionStarted connectionSource);
+    ~LanDeviceLink() override;
     void reset(QSslSocket* socket, ConnectionStarted connectionSource);
 
     QString name() override;
     bool sendPacket(NetworkPacket& np) override;
+    //Null if the payload can't be offered, because no port is free
     UploadJob* sendPayload(const NetworkPacket& np);
+    //Payloads of this link still being sent, and how many of them nobody connected to yet
+    int uploads() const { return m_uploads.size(); }
+    int waitingUploads() const;
 
     void userRequestsPair() override;
     void userRequestsUnpair() override;
@@ -54,15 +63,56 @@ public:
 
     bool linkShouldBeKeptAlive() override;
 
+    QVariantMap statistics() const override;
+
     QHostAddress hostAddress() const;
 
+    //Selects the wire format agreed on with the peer, must be called after every reset()
+    //Compression and payload streams are only available with length prefixed (CBOR) frames
+    void setPacketEncoding(NetworkPacket::Encoding encoding, bool compression = false, bool payloadStreams = false);
+    NetworkPacket::Encoding packetEncoding() const { return m_packetEncoding; }
+    const PayloadMultiplexer* multiplexer() const { return m_multiplexer.data(); } //Null if payloads use their own sockets
+    //How many connections the peer accepts for a single payload, see StripedPayload
+    void setPayloadStripes(int stripes) { m_payloadStripes = stripes; }
+    int payloadStripes() const { return m_payloadStripes; }
+
+    struct ReceiveStatistics {
+        quint64 batches = 0;
+        quint64 packets = 0;
+        int largestBatch = 0;
+
+        double packetsPerBatch() const { return batches ? double(packets) / batches : 0.0; }
+    };
+    const ReceiveStatistics& receiveStatistics() const { return m_receiveStatistics; }
+
+    //How long dataReceived() may deliver packets before yielding to the event loop, in ms
+    static const int BatchTimeBudget = 10;
+    //Incomplete lines of at least this size are decoded while they arrive, if their type streams
+    static const int StreamingThreshold = 64 * 1024;
+
 private Q_SLOTS:
     void dataReceived();
+    void partialFrameReceived();
 
 private:
+    bool readPacket(NetworkPacket* packet, QVector<NetworkPacket>* batch);
+    void handlePacket(NetworkPacket& packet, QVector<NetworkPacket>* batch);
+    void deliverBatch(QVector<NetworkPacket>* batch);
+    void deliverElements(const QVariantList& elements);
+    void logStatistics() const;
+    QSslSocket* connectPayloadSocket(quint16 port);
+
     SocketLineReader* m_socketLineReader;
     ConnectionStarted m_connectionSource;
     QHostAddress m_hostAddress;
+    NetworkPacket::Encoding m_packetEncoding;
+    QScopedPointer<PacketCompressor> m_compressor;
+    QScopedPointer<PayloadMultiplexer> m_multiplexer;
+    QByteArray m_compressionBuffer;
+    ReceiveStatistics m_receiveStatistics;
+    NetworkPacketStreamDecoder m_streamDecoder;
+    int m_payloadStripes;
+    QSet<UploadJob*> m_uploads;
 };
 
 #endif
@@ -34,11 +34,14 @@
 #include <QUdpSocket>
 #include <QNetworkSession>
 #include <QNetworkConfigurationManager>
+#include <QFile>
 #include <QSslCipher>
 #include <QSslConfiguration>
+#include <QSslKey>
 
 #include "daemon.h"
 #include "landevicelink.h"
+#include "../stripedpayload.h"
 #include "lanpairinghandler.h"
 #include "kdeconnectconfig.h"
 
@@ -419,31 +422,75 @@ void LanLinkProvider::deviceLinkDestroyed(QObject* destroyedDeviceLink)
 
 }
 
-void LanLinkProvider::configureSslSocket(QSslSocket* socket, const QString& deviceId, bool isDeviceTrusted)
+namespace {
+struct SslConfigurations {
+    QSslConfiguration untrusted; //Null until first needed, the trusted ones start from it
+    QHash<QString, QSslConfiguration> trusted;
+};
+}
+
+//Every control and payload socket needs one, built once instead of loading the key and parsing the certificates every time
+Q_GLOBAL_STATIC(SslConfigurations, s_sslConfigurations)
+
+QSslConfiguration LanLinkProvider::sslConfiguration(const QString& deviceId, bool isDeviceTrusted)
 {
-    // Setting supported ciphers manually, to match those on Android (FIXME: Test if this can be left unconfigured and still works for Android 4)
-    QList<QSslCipher> socketCiphers;
-    socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES256-GCM-SHA384")));
-    socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES128-GCM-SHA256")));
-    socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-RSA-AES128-SHA")));
-
-    // Configure for ssl
-    QSslConfiguration sslConfig;
-    sslConfig.setCiphers(socketCiphers);
-    sslConfig.setProtocol(QSsl::TlsV1_0);
-
-    socket->setSslConfiguration(sslConfig);
-    socket->setLocalCertificate(KdeConnectConfig::instance()->certificate());
-    socket->setPrivateKey(KdeConnectConfig::instance()->privateKeyPath());
-    socket->setPeerVerifyName(deviceId);
+    SslConfigurations* configurations = s_sslConfigurations();
+    if (configurations->untrusted.isNull()) {
+        // Setting supported ciphers manually, to match those on Android (FIXME: Test if this can be left unconfigured and still works for Android 4)
+        QList<QSslCipher> socketCiphers;
+        socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES256-GCM-SHA384")));
+        socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-ECDSA-AES128-GCM-SHA256")));
+        socketCiphers.append(QSslCipher(QStringLiteral("ECDHE-RSA-AES128-SHA")));
+
+        // Configure for ssl
+        QSslConfiguration sslConfig;
+        sslConfig.setCiphers(socketCiphers);
+        sslConfig.setProtocol(QSsl::TlsV1_0);
+        sslConfig.setLocalCertificate(KdeConnectConfig::instance()->certificate());
+
+        QFile keyFile(KdeConnectConfig::instance()->privateKeyPath());
+        if (keyFile.open(QIODevice::ReadOnly)) {
+            sslConfig.setPrivateKey(QSslKey(&keyFile, QSsl::Rsa));
+        } else {
+            qCWarning(KDECONNECT_CORE) << "Could not read the private key" << keyFile.fileName();
+        }
+        sslConfig.setPeerVerifyMode(QSslSocket::QueryPeer);
+        configurations->untrusted = sslConfig;
+    }
 
-    if (isDeviceTrusted) {
+    if (!isDeviceTrusted) {
+        return configurations->untrusted;
+    }
+
+    auto it = configurations->trusted.find(deviceId);
+    if (it == configurations->trusted.end()) {
+        QSslConfiguration sslConfig = configurations->untrusted;
         QString certString = KdeConnectConfig::instance()->getDeviceProperty(deviceId, QStringLiteral("certificate"), QString());
-        socket->addCaCertificate(QSslCertificate(certString.toLatin1()));
-        socket->setPeerVerifyMode(QSslSocket::VerifyPeer);
+        sslConfig.setCaCertificates(sslConfig.caCertificates() << QSslCertificate(certString.toLatin1()));
+        sslConfig.setPeerVerifyMode(QSslSocket::VerifyPeer);
+        it = configurations->trusted.insert(deviceId, sslConfig);
+    }
+    return *it;
+}
+
+void LanLinkProvider::invalidateSslConfiguration(const QString& deviceId)
+{
+    SslConfigurations* configurations = s_sslConfigurations();
+    if (!configurations) {
+        return;
+    }
+    if (deviceId.isEmpty()) {
+        configurations->untrusted = QSslConfiguration();
+        configurations->trusted.clear();
     } else {
-        socket->setPeerVerifyMode(QSslSocket::QueryPeer);
+        configurations->trusted.remove(deviceId);
     }
+}
+
+void LanLinkProvider::configureSslSocket(QSslSocket* socket, const QString& deviceId, bool isDeviceTrusted)
+{
+    socket->setSslConfiguration(sslConfiguration(deviceId, isDeviceTrusted));
+    socket->setPeerVerifyName(deviceId);
 
     //Usually SSL errors are only bad for trusted devices. Uncomment this section to log errors in any case, for debugging.
     //QObject::connect(socket, static_cast<void (QSslSocket::*)(const QList<QSslError>&)>(&QSslSocket::sslErrors), [](const QList<QSslError>& errors)
@@ -459,6 +506,8 @@ void LanLinkProvider::configureSocket(QSslSocket* socket) {
     socket->setProxy(QNetworkProxy::NoProxy);
 
     socket->setSocketOption(QAbstractSocket::KeepAliveOption, QVariant(1));
+    //Packets are small and often interactive, don't hold them back to coalesce them
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, QVariant(1));
 
     #ifdef TCP_KEEPIDLE
         // time to start sending keepalive packets (seconds)
@@ -503,6 +552,10 @@ void LanLinkProvider::addLink(const QString& deviceId, QSslSocket* socket, Netwo
             m_pairingHandlers[deviceId]->setDeviceLink(deviceLink);
         }
     }
+    //Both ends see each other's identity, so they pick the same encoding without another round trip
+    deviceLink->setPacketEncoding(NetworkPacket::negotiateEncoding(*receivedPacket), PacketCompressor::isSupportedBy(*receivedPacket),
+                                  PayloadMultiplexer::isSupportedBy(*receivedPacket));
+    deviceLink->setPayloadStripes(StripedPayload::stripesSupportedBy(*receivedPacket));
     Q_EMIT onConnectionReceived(*receivedPacket, deviceLink);
 }
 
@@ -526,6 +579,7 @@ void LanLinkProvider::userRequestsPair(const QString& deviceId)
 
 void LanLinkProvider::userRequestsUnpair(const QString& deviceId)
 {
+    invalidateSslConfiguration(deviceId);
     LanPairingHandler* ph = createPairingHandler(m_links.value(deviceId));
     ph->unpair();
 }
@@ -51,6 +51,11 @@ public:
     void incomingPairPacket(DeviceLink* device, const NetworkPacket& np);
 
     static void configureSslSocket(QSslSocket* socket, const QString& deviceId, bool isDeviceTrusted);
+    //Cached per device, must be invalidated when the certificate stored for it changes,
+    //or entirely (with no id) if our own certificate or key ever changes at runtime.
+    //KdeConnectConfig only creates those on startup, before anything is cached
+    static QSslConfiguration sslConfiguration(const QString& deviceId, bool isDeviceTrusted);
+    static void invalidateSslConfiguration(const QString& deviceId = QString());
     static void configureSocket(QSslSocket* socket);
 
     const static quint16 UDP_PORT = 1716;
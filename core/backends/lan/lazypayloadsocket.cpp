@@ -0,0 +1,144 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lazypayloadsocket.h"
+#include "lanlinkprovider.h"
+
+#include <QMetaMethod>
+#include <QTcpSocket>
+#include <QTimer>
+
+//A sender that doesn't even accept the connection isn't waited for longer than this
+static const int DeclineTimeout = 10000;
+
+LazyPayloadSocket::LazyPayloadSocket(const QHostAddress& address, quint16 port, const QString& deviceId, QObject* parent)
+    : QIODevice(parent)
+    , m_address(address)
+    , m_port(port)
+    , m_deviceId(deviceId)
+    , m_socket(nullptr)
+    , m_declined(false)
+{
+    //Open from the start, like the socket it stands for, so readers don't try to open it
+    QIODevice::open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+LazyPayloadSocket::~LazyPayloadSocket()
+{
+    if (!m_socket) {
+        decline();
+    }
+}
+
+QSslSocket* LazyPayloadSocket::connectSocket(const QHostAddress& address, quint16 port, const QString& deviceId)
+{
+    QSslSocket* socket = new QSslSocket;
+    //Whatever the reader doesn't take right away waits in the sender's socket, not in our memory
+    socket->setReadBufferSize(ReadBufferSize);
+
+    LanLinkProvider::configureSslSocket(socket, deviceId, true);
+
+    // emit readChannelFinished when the socket gets disconnected. This seems to be a bug in upstream QSslSocket.
+    // Needs investigation and upstreaming of the fix. QTBUG-62257
+    connect(socket, &QAbstractSocket::disconnected, socket, &QAbstractSocket::readChannelFinished);
+
+    socket->connectToHostEncrypted(address.toString(), port, QIODevice::ReadWrite);
+    return socket;
+}
+
+void LazyPayloadSocket::ensureConnected()
+{
+    if (m_socket || m_declined) {
+        return;
+    }
+
+    m_socket = connectSocket(m_address, m_port, m_deviceId);
+    m_socket->setParent(this);
+    connect(m_socket, &QIODevice::readyRead, this, &QIODevice::readyRead);
+    connect(m_socket, &QIODevice::readChannelFinished, this, &QIODevice::readChannelFinished);
+}
+
+void LazyPayloadSocket::decline()
+{
+    if (m_declined) {
+        return;
+    }
+    m_declined = true;
+
+    //Outlives us: connecting and hanging up is what tells the sender to stop listening
+    QTcpSocket* socket = new QTcpSocket;
+    connect(socket, &QAbstractSocket::connected, socket, &QAbstractSocket::disconnectFromHost);
+    connect(socket, &QAbstractSocket::disconnected, socket, &QObject::deleteLater);
+    connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), socket, SLOT(deleteLater()));
+    QTimer::singleShot(DeclineTimeout, socket, &QObject::deleteLater);
+    socket->connectToHost(m_address, m_port);
+}
+
+bool LazyPayloadSocket::open(OpenMode mode)
+{
+    Q_UNUSED(mode);
+    ensureConnected();
+    return m_socket != nullptr;
+}
+
+void LazyPayloadSocket::close()
+{
+    QIODevice::close();
+    if (m_socket) {
+        m_socket->close();
+    } else {
+        decline();
+    }
+}
+
+qint64 LazyPayloadSocket::bytesAvailable() const
+{
+    return QIODevice::bytesAvailable() + (m_socket ? m_socket->bytesAvailable() : 0);
+}
+
+bool LazyPayloadSocket::waitForReadyRead(int msecs)
+{
+    ensureConnected();
+    return m_socket && m_socket->waitForReadyRead(msecs);
+}
+
+qint64 LazyPayloadSocket::readData(char* data, qint64 maxSize)
+{
+    ensureConnected();
+    if (!m_socket) {
+        return -1;
+    }
+    return m_socket->read(data, maxSize);
+}
+
+qint64 LazyPayloadSocket::writeData(const char* data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+void LazyPayloadSocket::connectNotify(const QMetaMethod& signal)
+{
+    //Whoever waits for data is going to read it
+    if (signal == QMetaMethod::fromSignal(&QIODevice::readyRead)) {
+        ensureConnected();
+    }
+}
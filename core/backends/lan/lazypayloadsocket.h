@@ -0,0 +1,75 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LAZYPAYLOADSOCKET_H
+#define LAZYPAYLOADSOCKET_H
+
+#include <QHostAddress>
+#include <QIODevice>
+#include <QSslSocket>
+
+#include <kdeconnectcore_export.h>
+
+/*
+ * The payload of a received packet, which only connects to the port the sender
+ * listens on once somebody reads from it or waits for it to be readyRead.
+ *
+ * If it is destroyed without that ever happening, it connects and hangs up right
+ * away, without a TLS handshake, so the UploadJob on the other side is finished
+ * instead of listening until the link goes away.
+ */
+class KDECONNECTCORE_EXPORT LazyPayloadSocket
+    : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    LazyPayloadSocket(const QHostAddress& address, quint16 port, const QString& deviceId, QObject* parent = nullptr);
+    ~LazyPayloadSocket() override;
+
+    ///Every payload connection buffers at most ReadBufferSize bytes the reader didn't take yet
+    static QSslSocket* connectSocket(const QHostAddress& address, quint16 port, const QString& deviceId);
+    static const qint64 ReadBufferSize = 4 * 1024 * 1024;
+
+    bool isConnecting() const { return m_socket != nullptr; }
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override;
+    bool waitForReadyRead(int msecs) override;
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+    void connectNotify(const QMetaMethod& signal) override;
+
+private:
+    void ensureConnected();
+    void decline();
+
+    const QHostAddress m_address;
+    const quint16 m_port;
+    const QString m_deviceId;
+    QSslSocket* m_socket;
+    bool m_declined;
+};
+
+#endif
@@ -0,0 +1,59 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "payloadportpool.h"
+
+#include <QTcpServer>
+
+Q_GLOBAL_STATIC(PayloadPortPool, s_instance)
+
+PayloadPortPool* PayloadPortPool::instance()
+{
+    return s_instance();
+}
+
+PayloadPortPool::PayloadPortPool()
+    : m_inUse(0)
+{
+    for (quint16 port = MinPort; port <= MaxPort; ++port) {
+        m_free.enqueue(port);
+    }
+}
+
+quint16 PayloadPortPool::listen(QTcpServer* server)
+{
+    //Each free port is tried at most once
+    for (int tries = m_free.size(); tries > 0; --tries) {
+        const quint16 port = m_free.dequeue();
+        if (server->listen(QHostAddress::Any, port)) {
+            ++m_inUse;
+            return port;
+        }
+        m_free.enqueue(port);
+    }
+    return 0;
+}
+
+void PayloadPortPool::release(quint16 port)
+{
+    Q_ASSERT(port >= MinPort && port <= MaxPort);
+    --m_inUse;
+    m_free.enqueue(port);
+}
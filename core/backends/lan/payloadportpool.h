@@ -0,0 +1,59 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAYLOADPORTPOOL_H
+#define PAYLOADPORTPOOL_H
+
+#include <QQueue>
+
+#include <kdeconnectcore_export.h>
+
+class QTcpServer;
+
+/*
+ * The ports payloads are offered on, shared by all links. Free ones wait in a
+ * queue and go back to it once their listener closes, so a listener gets the
+ * next one instead of trying to bind the whole range from its start. A port some
+ * other program holds is moved to the back of the queue and tried again later.
+ */
+class KDECONNECTCORE_EXPORT PayloadPortPool
+{
+public:
+    static const quint16 MinPort = 1739;
+    static const quint16 MaxPort = 1764;
+
+    //Null once it was destroyed at exit
+    static PayloadPortPool* instance();
+
+    PayloadPortPool();
+
+    //Makes server listen on a free port of the range, which is returned, or returns 0
+    quint16 listen(QTcpServer* server);
+    void release(quint16 port);
+
+    int inUse() const { return m_inUse; }
+    int available() const { return m_free.size(); }
+
+private:
+    QQueue<quint16> m_free;
+    int m_inUse;
+};
+
+#endif
@@ -21,6 +21,8 @@
 
 #include "socketlinereader.h"
 
+#include "core_debug.h"
+
 SocketLineReader::SocketLineReader(QSslSocket* socket, QObject* parent)
     : QObject(parent)
     , m_socket(socket)
@@ -29,25 +31,50 @@ SocketLineReader::SocketLineReader(QSslSocket* socket, QObject* parent)
             this, &SocketLineReader::dataReceived);
 }
 
-void SocketLineReader::dataReceived()
+QByteArray SocketLineReader::readLine()
+{
+    PacketFramer::Frame frame;
+    if (!m_framer.nextFrame(&frame)) {
+        return QByteArray();
+    }
+    return QByteArray(frame.data.constData(), frame.data.size());
+}
+
+QByteArray SocketLineReader::readFrame(quint8* type)
+{
+    PacketFramer::Frame frame;
+    if (!m_framer.nextFrame(&frame)) {
+        *type = 0;
+        return QByteArray();
+    }
+    *type = frame.type;
+    return frame.data;
+}
+
+qint64 SocketLineReader::writeFrame(quint8 type, const QByteArray& data)
 {
-    while (m_socket->canReadLine()) {
-        const QByteArray line = m_socket->readLine();
-        if (line.length() > 1) { //we don't want a single \n
-            m_packets.enqueue(line);
-        }
+    char header[PacketFramer::HeaderSize];
+    PacketFramer::writeHeader(header, type, quint32(data.size()));
+
+    if (m_socket->write(header, PacketFramer::HeaderSize) != PacketFramer::HeaderSize) {
+        return -1;
     }
+    return m_socket->write(data.constData(), data.size());
+}
 
-    //If we still have things to read from the socket, call dataReceived again
-    //We do this manually because we do not trust readyRead to be emitted again
-    //So we call this method again just in case.
-    if (m_socket->bytesAvailable() > 0) {
-        QMetaObject::invokeMethod(this, "dataReceived", Qt::QueuedConnection);
+void SocketLineReader::dataReceived()
+{
+    //Everything buffered is read at once, so there is no need to reschedule ourselves
+    if (!m_framer.readFrom(m_socket)) {
+        qCWarning(KDECONNECT_CORE) << "SocketLineReader: dropping connection to" << m_socket->peerAddress() << "after a framing error";
+        m_socket->abort();
         return;
     }
 
     //If we have any packets, tell it to the world.
-    if (!m_packets.isEmpty()) {
+    if (m_framer.hasFrame()) {
         Q_EMIT readyRead();
+    } else if (m_framer.bufferedBytes() > 0) {
+        Q_EMIT partialFrameReceived();
     }
 }
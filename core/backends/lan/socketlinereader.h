@@ -22,15 +22,17 @@
 #define SOCKETLINEREADER_H
 
 #include <QObject>
-#include <QQueue>
 #include <QSslSocket>
 #include <QHostAddress>
 
 #include <kdeconnectcore_export.h>
+#include "../packetframer.h"
 
 /*
  * Encapsulates a QTcpSocket and implements the same methods of its API that are
- * used by LanDeviceLink, but readyRead is emitted only when a newline is found.
+ * used by LanDeviceLink, but readyRead is emitted only when a complete frame
+ * (a newline terminated line, or a length prefixed frame once both ends agreed
+ * on a binary packet encoding) has arrived. See PacketFramer.
  */
 class KDECONNECTCORE_EXPORT SocketLineReader
     : public QObject
@@ -40,23 +42,35 @@ class KDECONNECTCORE_EXPORT SocketLineReader
 public:
     explicit SocketLineReader(QSslSocket* socket, QObject* parent = nullptr);
 
-    QByteArray readLine() { return m_packets.dequeue(); }
+    void setFraming(PacketFramer::Framing framing) { m_framer.setFraming(framing); }
+    PacketFramer::Framing framing() const { return m_framer.framing(); }
+    void setMaxFrameSize(int maxFrameSize) { m_framer.setMaxFrameSize(maxFrameSize); }
+
+    QByteArray readLine();
+    //The returned bytes are a view into the reader's buffer, valid until the next call to the reader
+    QByteArray readFrame(quint8* type);
     qint64 write(const QByteArray& data) { return m_socket->write(data); }
+    qint64 writeFrame(quint8 type, const QByteArray& data);
     QHostAddress peerAddress() const { return m_socket->peerAddress(); }
     QSslCertificate peerCertificate() const { return m_socket->peerCertificate(); }
-    qint64 bytesAvailable() const { return m_packets.size(); }
+    qint64 bytesAvailable() const { return m_framer.hasFrame() ? 1 : 0; }
+
+    //The line that is still arriving, see PacketFramer::pendingData()
+    QByteArray pendingData() const { return m_framer.pendingData(); }
+    int pendingBytes() const { return m_framer.bufferedBytes(); }
+    void discardPending(int size) { m_framer.discard(size); }
 
     QSslSocket* m_socket;
-    
+
 Q_SIGNALS:
     void readyRead();
+    void partialFrameReceived(); //Data arrived, but no frame is complete yet
 
 private Q_SLOTS:
     void dataReceived();
 
 private:
-    QByteArray m_lastChunk;
-    QQueue<QByteArray> m_packets;
+    PacketFramer m_framer;
 
 };
 
@@ -20,9 +20,23 @@
 
 #include "uploadjob.h"
 
+#include <QFile>
+
 #include <KLocalizedString>
 
+#include <limits>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "lanlinkprovider.h"
+#include "payloadportpool.h"
+#include "../bandwidthlimiter.h"
+#include "../stripedpayload.h"
+#include "hashingfile.h"
 #include "kdeconnectconfig.h"
 #include "core_debug.h"
 
@@ -33,31 +47,108 @@ UploadJob::UploadJob(const QSharedPointer<QIODevice>& source, const QString& dev
     , m_socket(nullptr)
     , m_port(0)
     , m_deviceId(deviceId) // We will use this info if link is on ssl, to send encrypted payload
+    , m_buffer(DefaultChunkSize, Qt::Uninitialized)
+    , m_uploaded(0)
+    , m_inputFd(-1)
+    , m_cacheReleased(0)
+    , m_stripeCount(1)
+    , m_stripesDone(0)
 {
-    connect(m_input.data(), &QIODevice::readyRead, this, &UploadJob::startUploading);
+    connect(m_input.data(), &QIODevice::readyRead, this, &UploadJob::writeSome);
+    connect(m_input.data(), &QIODevice::readChannelFinished, this, &UploadJob::writeSome);
     connect(m_input.data(), &QIODevice::aboutToClose, this, &UploadJob::aboutToClose);
+
+    m_acceptTimer.setSingleShot(true);
+    m_acceptTimer.setInterval(AcceptTimeout);
+    connect(&m_acceptTimer, &QTimer::timeout, this, &UploadJob::acceptTimedOut);
+
+    m_throttleTimer.setSingleShot(true);
+    connect(&m_throttleTimer, &QTimer::timeout, this, &UploadJob::resumeWriting);
+}
+
+UploadJob::~UploadJob()
+{
+    closeServer();
+}
+
+void UploadJob::setChunkSize(int chunkSize)
+{
+    m_buffer.resize(qMax(chunkSize, 4096));
+}
+
+void UploadJob::setStripes(int stripes)
+{
+    Q_ASSERT(qobject_cast<QFile*>(m_input.data()));
+    m_stripeCount = qBound(1, stripes, StripedPayload::MaxStripes);
 }
 
 void UploadJob::start()
 {
-    m_port = MIN_PORT;
-    while (!m_server->listen(QHostAddress::Any, m_port)) {
-        m_port++;
-        if (m_port > MAX_PORT) { //No ports available?
-            qCWarning(KDECONNECT_CORE) << "Error opening a port in range" << MIN_PORT << "-" << MAX_PORT;
-            m_port = 0;
-            setError(1);
-            setErrorText(i18n("Couldn't find an available port"));
-            emitResult();
-            return;
-        }
+    m_port = PayloadPortPool::instance()->listen(m_server);
+    if (!m_port) { //No ports available?
+        qCWarning(KDECONNECT_CORE) << "Error opening a port in range" << PayloadPortPool::MinPort << "-" << PayloadPortPool::MaxPort
+                                   << "," << PayloadPortPool::instance()->inUse() << "of them are listening for payloads";
+        setError(1);
+        setErrorText(i18n("Couldn't find an available port"));
+        emitResult();
+        return;
     }
     connect(m_server, &QTcpServer::newConnection, this, &UploadJob::newConnection);
+    m_acceptTimer.start();
+}
+
+bool UploadJob::isWaiting() const
+{
+    return m_server->isListening() && !m_socket && m_stripes.isEmpty();
+}
+
+void UploadJob::closeServer()
+{
+    m_acceptTimer.stop();
+    if (m_server->isListening()) {
+        m_server->close();
+        if (PayloadPortPool* pool = PayloadPortPool::instance()) {
+            pool->release(m_port);
+        }
+    }
+}
+
+void UploadJob::acceptTimedOut()
+{
+    qCWarning(KDECONNECT_CORE) << "Nobody came for the payload on port" << m_port << "in" << m_acceptTimer.interval() << "ms";
+    closeServer();
+    for (const Stripe& stripe : qAsConst(m_stripes)) {
+        stripe.socket->disconnect(this);
+        stripe.socket->abort();
+    }
+    setError(3);
+    setErrorText(i18n("The other device didn't fetch the file"));
+    emitResult();
+}
+
+bool UploadJob::doKill()
+{
+    closeServer();
+    if (m_socket) {
+        m_socket->disconnect(this);
+        m_socket->abort();
+    }
+    for (const Stripe& stripe : qAsConst(m_stripes)) {
+        stripe.socket->disconnect(this);
+        stripe.socket->abort();
+    }
+    return true;
 }
 
 void UploadJob::newConnection()
 {
-    if (!m_input->open(QIODevice::ReadOnly)) {
+    if (m_stripeCount > 1) {
+        acceptStripes();
+        return;
+    }
+
+    //An input that is already open is sent from its current position, e.g. to resume a transfer
+    if (!m_input->isOpen() && !m_input->open(QIODevice::ReadOnly)) {
         qCWarning(KDECONNECT_CORE) << "error when opening the input to upload";
         return; //TODO: Handle error, clean up...
     }
@@ -66,6 +157,8 @@ void UploadJob::newConnection()
     disconnect(m_server, &QTcpServer::newConnection, this, &UploadJob::newConnection);
 
     m_socket = m_server->nextPendingConnection();
+    //Only one connection is expected, the port can go to the next payload
+    closeServer();
     m_socket->setParent(this);
     connect(m_socket, &QSslSocket::disconnected, this, &UploadJob::cleanup);
     connect(m_socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(socketFailed(QAbstractSocket::SocketError)));
@@ -80,26 +173,173 @@ void UploadJob::newConnection()
 
 void UploadJob::startUploading()
 {
-    while ( m_input->bytesAvailable() > 0 )
-    {
-        qint64 bytes = qMin(m_input->bytesAvailable(), (qint64)4096);
-        int w = m_socket->write(m_input->read(bytes));
-        if (w<0) {
-            qCWarning(KDECONNECT_CORE) << "error when writing data to upload" << bytes << m_input->bytesAvailable();
-            break;
+    if (!m_input->isSequential()) {
+        setTotalAmount(Bytes, m_input->size() - m_input->pos());
+    }
+    adviseInput();
+
+    //From now on the socket asks for more data whenever it has written some
+    connect(m_socket, &QIODevice::bytesWritten, this, &UploadJob::writeSome);
+    writeSome();
+}
+
+void UploadJob::writeSome()
+{
+    if (!m_socket || !m_socket->isEncrypted() || !m_input->isOpen()) {
+        return;
+    }
+
+    //Only refill once the socket is running low, instead of queueing the whole input in memory
+    while (m_socket->bytesToWrite() < m_buffer.size()) {
+        const qint64 allowed = allowance(m_buffer.size());
+        if (allowed == 0) {
+            return; //Resumed by the throttle timer
+        }
+        const qint64 size = m_input->read(m_buffer.data(), allowed);
+        if (size < 0 || (size == 0 && m_input->atEnd())) {
+            //Closing the input disconnects the socket once everything queued has been written
+            releaseCache(true);
+            m_input->close();
+            return;
+        }
+        if (size == 0) {
+            return; //Waits for readyRead
+        }
+
+        if (m_socket->write(m_buffer.constData(), size) != size) {
+            qCWarning(KDECONNECT_CORE) << "error when writing data to upload" << m_socket->errorString();
+            m_input->close();
+            return;
+        }
+        consumed(size);
+        releaseCache(false);
+    }
+}
+
+qint64 UploadJob::allowance(qint64 maxSize)
+{
+    BandwidthLimiter* limiter = BandwidthLimiter::instance();
+    const qint64 allowed = limiter ? limiter->allowance(m_deviceId, maxSize) : maxSize;
+    if (allowed == 0 && !m_throttleTimer.isActive()) {
+        m_throttleTimer.start(limiter->msecsToWait(m_deviceId));
+    }
+    return allowed;
+}
+
+void UploadJob::consumed(qint64 size)
+{
+    if (BandwidthLimiter* limiter = BandwidthLimiter::instance()) {
+        limiter->consume(m_deviceId, size);
+    }
+    m_uploaded += size;
+    setProcessedAmount(Bytes, m_uploaded);
+}
+
+void UploadJob::resumeWriting()
+{
+    writeSome();
+    for (int i = 0; i < m_stripes.size(); ++i) {
+        writeStripe(i);
+    }
+}
+
+void UploadJob::adviseInput()
+{
+#if defined(Q_OS_LINUX) && defined(POSIX_FADV_SEQUENTIAL)
+    QFile* file = qobject_cast<QFile*>(m_input.data());
+    if (!file || file->handle() < 0) {
+        return;
+    }
+
+    //Read once from front to back: let the kernel read ahead as far as it likes
+    posix_fadvise(file->handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (file->size() > CacheReleaseThreshold) {
+        m_residentPages = residentPages(file->handle(), file->size());
+        if (!m_residentPages.isEmpty()) {
+            m_inputFd = file->handle();
+            m_cacheReleased = file->pos() - file->pos() % sysconf(_SC_PAGESIZE);
         }
-        else
-        {
-            while ( m_socket->flush() );
+    }
+#endif
+}
+
+#if defined(Q_OS_LINUX) && defined(POSIX_FADV_DONTNEED)
+QBitArray UploadJob::residentPages(int fd, qint64 size)
+{
+    //The mapping is only there to ask mincore about it, nothing is read through it
+    const qint64 pageSize = sysconf(_SC_PAGESIZE);
+    const qint64 pages = (size + pageSize - 1) / pageSize;
+    if (pages > std::numeric_limits<int>::max() || qint64(size_t(size)) != size) {
+        return QBitArray();
+    }
+    void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return QBitArray();
+    }
+    QVector<unsigned char> residency(pages);
+    const bool ok = mincore(map, size, residency.data()) == 0;
+    munmap(map, size);
+    if (!ok) {
+        return QBitArray();
+    }
+
+    QBitArray resident(pages);
+    for (int page = 0; page < pages; ++page) {
+        if (residency[page] & 1) {
+            resident.setBit(page);
         }
     }
-    m_input->close();
+    return resident;
+}
+#endif
+
+void UploadJob::releaseCache(bool all)
+{
+#if defined(Q_OS_LINUX) && defined(POSIX_FADV_DONTNEED)
+    //A multi-GB upload would otherwise push everything else out of the page cache.
+    //Pages that were cached before we started belong to somebody else and are kept.
+    if (m_inputFd < 0) {
+        return;
+    }
+    const qint64 position = m_input->pos();
+    if (!all && position - m_cacheReleased < 8 * 1024 * 1024) {
+        return;
+    }
+    const qint64 pageSize = sysconf(_SC_PAGESIZE);
+    //Whole pages only, the one being read goes with the next range
+    const int end = all ? m_residentPages.size() : qMin<qint64>(position / pageSize, m_residentPages.size());
+    for (int first = m_cacheReleased / pageSize; first < end;) {
+        if (m_residentPages.testBit(first)) {
+            ++first;
+            continue;
+        }
+        int last = first + 1;
+        while (last < end && !m_residentPages.testBit(last)) {
+            ++last;
+        }
+        posix_fadvise(m_inputFd, first * pageSize, (last - first) * pageSize, POSIX_FADV_DONTNEED);
+        first = last;
+    }
+    m_cacheReleased = end * pageSize;
+    if (all) {
+        m_inputFd = -1;
+        m_residentPages.clear();
+    }
+#else
+    Q_UNUSED(all);
+#endif
 }
 
 void UploadJob::aboutToClose()
 {
 //     qDebug() << "closing...";
-    m_socket->disconnectFromHost();
+    if (m_socket) {
+        m_socket->disconnectFromHost();
+    } else if (m_stripes.isEmpty()) {
+        //Closed before the peer came for it, e.g. because it turned out to have it already
+        closeServer();
+        emitResult();
+    }
 }
 
 void UploadJob::cleanup()
@@ -109,15 +349,130 @@ void UploadJob::cleanup()
     emitResult();
 }
 
+void UploadJob::acceptStripes()
+{
+    //Stripes are handed out in the order connections come in, their header tells the receiver which is which
+    while (m_server->hasPendingConnections() && m_stripes.size() < m_stripeCount) {
+        QSslSocket* socket = m_server->nextPendingConnection();
+        socket->setParent(this);
+        const int index = m_stripes.size();
+        m_stripes.append({ socket, nullptr, 0, false });
+
+        connect(socket, &QSslSocket::disconnected, this, [this, index]() { stripeDisconnected(index); });
+        connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(socketFailed(QAbstractSocket::SocketError)));
+        connect(socket, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(sslErrors(QList<QSslError>)));
+        connect(socket, &QSslSocket::encrypted, this, [this, index]() { startStripe(index); });
+        LanLinkProvider::configureSslSocket(socket, m_deviceId, true);
+        socket->startServerEncryption();
+    }
+
+    if (m_stripes.size() == m_stripeCount) {
+        disconnect(m_server, &QTcpServer::newConnection, this, &UploadJob::newConnection);
+        closeServer();
+    }
+}
+
+void UploadJob::startStripe(int index)
+{
+    //Every stripe reads the file through its own handle, from wherever the input is positioned
+    QFile* input = static_cast<QFile*>(m_input.data());
+    const qint64 base = input->isOpen() ? input->pos() : 0;
+    const qint64 total = input->size() - base;
+    const qint64 stripeSize = (total + m_stripeCount - 1) / m_stripeCount;
+    const qint64 offset = qMin(total, index * stripeSize);
+    const qint64 length = qMin(stripeSize, total - offset);
+
+    Stripe& stripe = m_stripes[index];
+    stripe.file = new QFile(input->fileName(), this);
+    if (!stripe.file->open(QIODevice::ReadOnly) || !stripe.file->seek(base + offset)) {
+        qCWarning(KDECONNECT_CORE) << "error when opening the input to upload" << stripe.file->errorString();
+        stripe.socket->abort();
+        return;
+    }
+#if defined(Q_OS_LINUX) && defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(stripe.file->handle(), base + offset, length, POSIX_FADV_SEQUENTIAL);
+#endif
+    stripe.remaining = length;
+    if (index == 0) {
+        setTotalAmount(Bytes, total);
+        //The input itself is never read, whoever waits for its digest gets it from a separate pass
+        const QSharedPointer<HashingFile> hashing = qSharedPointerObjectCast<HashingFile>(m_input);
+        if (hashing) {
+            HashingFile::hashInBackground(hashing);
+        }
+    }
+
+    char header[StripedPayload::HeaderSize];
+    StripedPayload::writeHeader(header, offset, length);
+    stripe.socket->write(header, sizeof(header));
+    connect(stripe.socket, &QIODevice::bytesWritten, this, [this, index]() { writeStripe(index); });
+    writeStripe(index);
+}
+
+void UploadJob::writeStripe(int index)
+{
+    Stripe& stripe = m_stripes[index];
+    if (!stripe.file || !stripe.file->isOpen()) {
+        return;
+    }
+
+    while (stripe.remaining > 0 && stripe.socket->bytesToWrite() < m_buffer.size()) {
+        const qint64 allowed = allowance(qMin<qint64>(m_buffer.size(), stripe.remaining));
+        if (allowed == 0) {
+            return; //Resumed by the throttle timer
+        }
+        const qint64 size = stripe.file->read(m_buffer.data(), allowed);
+        if (size <= 0 || stripe.socket->write(m_buffer.constData(), size) != size) {
+            qCWarning(KDECONNECT_CORE) << "error when uploading stripe" << index << stripe.file->errorString() << stripe.socket->errorString();
+            stripe.socket->abort();
+            return;
+        }
+        stripe.remaining -= size;
+        consumed(size);
+    }
+
+    if (stripe.remaining == 0) {
+        //Disconnects once everything queued has been written
+        stripe.file->close();
+        stripe.socket->disconnectFromHost();
+    }
+}
+
+void UploadJob::stripeDisconnected(int index)
+{
+    Stripe& stripe = m_stripes[index];
+    if (stripe.done) {
+        return;
+    }
+    stripe.done = true;
+    if ((!stripe.file || stripe.remaining > 0) && !error()) {
+        setError(2);
+        setErrorText(i18n("Connection lost while sending"));
+    }
+
+    if (++m_stripesDone == m_stripeCount) {
+        m_input->close();
+        emitResult();
+    }
+}
+
 QVariantMap UploadJob::transferInfo()
 {
     Q_ASSERT(m_port != 0);
+    if (m_stripeCount > 1) {
+        return {{"port", m_port}, {"stripes", m_stripeCount}};
+    }
     return {{"port", m_port}};
 }
 
 void UploadJob::socketFailed(QAbstractSocket::SocketError error)
 {
     qWarning() << "error uploading" << error;
+    if (m_stripeCount > 1) {
+        //Stripes finish the job once all of them are disconnected
+        qobject_cast<QSslSocket*>(sender())->abort();
+        return;
+    }
     setError(2);
     emitResult();
     m_socket->close();
@@ -126,6 +481,11 @@ void UploadJob::socketFailed(QAbstractSocket::SocketError error)
 void UploadJob::sslErrors(const QList<QSslError>& errors)
 {
     qWarning() << "ssl errors" << errors;
+    if (m_stripeCount > 1) {
+        setError(1);
+        qobject_cast<QSslSocket*>(sender())->abort();
+        return;
+    }
     setError(1);
     emitResult();
     m_socket->close();
@@ -23,10 +23,14 @@
 
 #include <KJob>
 
+#include <QBitArray>
+#include <QFile>
 #include <QIODevice>
 #include <QVariantMap>
 #include <QSharedPointer>
 #include <QSslSocket>
+#include <QTimer>
+#include <QVector>
 #include "server.h"
 
 class KDECONNECTCORE_EXPORT UploadJob
@@ -35,24 +39,78 @@ class KDECONNECTCORE_EXPORT UploadJob
     Q_OBJECT
 public:
     explicit UploadJob(const QSharedPointer<QIODevice>& source, const QString& deviceId);
+    ~UploadJob() override;
 
     void start() override;
 
     QVariantMap transferInfo();
 
+    //How much is read from the input at once. The input is only read again when less
+    //than this is left queued in the socket, so memory use stays at about two chunks.
+    void setChunkSize(int chunkSize);
+    int chunkSize() const { return m_buffer.size(); }
+
+    //Splits the input into this many ranges, each sent over its own connection,
+    //see StripedPayload. Only for inputs that are files, which can be read at several places at once
+    void setStripes(int stripes);
+    int stripes() const { return m_stripeCount; }
+
+    //Gives up if the peer didn't connect (every stripe of it) after this long, which frees the port
+    void setAcceptTimeout(int msecs) { m_acceptTimer.setInterval(msecs); }
+    //Still listening, and nobody connected yet
+    bool isWaiting() const;
+
+    static const int DefaultChunkSize = 256 * 1024;
+    //Payloads smaller than this are not worth more than one connection
+    static const qint64 StripeThreshold = 64 * 1024 * 1024;
+    //Files bigger than this are dropped from the page cache as they are sent
+    static const qint64 CacheReleaseThreshold = 64 * 1024 * 1024;
+    static const int AcceptTimeout = 60000;
+
+protected:
+    bool doKill() override;
+
 private:
     const QSharedPointer<QIODevice> m_input;
     Server * const m_server;
     QSslSocket* m_socket;
     quint16 m_port;
     const QString m_deviceId;
+    QByteArray m_buffer;
+    qint64 m_uploaded;
+    int m_inputFd; //-1 unless the input is a local file we can give the kernel hints about
+    qint64 m_cacheReleased;
+    QBitArray m_residentPages; //Pages of the input that were cached before the upload started
+
+    struct Stripe {
+        QSslSocket* socket;
+        QFile* file;
+        qint64 remaining;
+        bool done;
+    };
+    int m_stripeCount;
+    QVector<Stripe> m_stripes;
+    int m_stripesDone;
+    QTimer m_acceptTimer;
+    QTimer m_throttleTimer; //Running while the BandwidthLimiter holds writes back
 
-    const static quint16 MIN_PORT = 1739;
-    const static quint16 MAX_PORT = 1764;
+    void closeServer();
+    qint64 allowance(qint64 maxSize);
+    void consumed(qint64 size);
+    void adviseInput();
+    void releaseCache(bool all);
+    static QBitArray residentPages(int fd, qint64 size);
+    void acceptStripes();
+    void startStripe(int index);
+    void writeStripe(int index);
+    void stripeDisconnected(int index);
 
 private Q_SLOTS:
     void startUploading();
+    void writeSome();
+    void resumeWriting();
     void newConnection();
+    void acceptTimedOut();
     void aboutToClose();
     void cleanup();
 
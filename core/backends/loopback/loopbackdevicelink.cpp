@@ -36,7 +36,8 @@ QString LoopbackDeviceLink::name()
 bool LoopbackDeviceLink::sendPacket(NetworkPacket& input)
 {
     NetworkPacket output(QString::null);
-    NetworkPacket::unserialize(input.serialize(), &output);
+    input.serialize(&m_sendBuffer);
+    NetworkPacket::unserialize(m_sendBuffer, &output);
 
     //LoopbackDeviceLink does not need deviceTransferInfo
     if (input.hasPayload()) {
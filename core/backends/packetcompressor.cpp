@@ -0,0 +1,164 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "packetcompressor.h"
+
+#include <QElapsedTimer>
+
+#include <zlib.h>
+
+#include "core_debug.h"
+#include "networkpacket.h"
+
+//Every Z_SYNC_FLUSH ends with this empty stored block, so we don't send it
+static const char s_syncFlushTail[] = { '\x00', '\x00', '\xff', '\xff' };
+
+PacketCompressor::PacketCompressor()
+    : m_deflate(new z_stream)
+    , m_inflate(new z_stream)
+    , m_failed(false)
+{
+    m_deflate->zalloc = Z_NULL;
+    m_deflate->zfree = Z_NULL;
+    m_deflate->opaque = Z_NULL;
+    m_inflate->zalloc = Z_NULL;
+    m_inflate->zfree = Z_NULL;
+    m_inflate->opaque = Z_NULL;
+    m_inflate->next_in = Z_NULL;
+    m_inflate->avail_in = 0;
+
+    //Negative window bits give a raw deflate stream, without zlib headers
+    if (deflateInit2(m_deflate, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK
+        || inflateInit2(m_inflate, -15) != Z_OK) {
+        qCWarning(KDECONNECT_CORE) << "PacketCompressor: could not initialize zlib";
+        m_failed = true;
+    }
+}
+
+PacketCompressor::~PacketCompressor()
+{
+    deflateEnd(m_deflate);
+    inflateEnd(m_inflate);
+    delete m_deflate;
+    delete m_inflate;
+}
+
+QStringList PacketCompressor::supportedMethods()
+{
+    return { QStringLiteral("deflate") };
+}
+
+bool PacketCompressor::isSupportedBy(const NetworkPacket& identityPacket)
+{
+    return identityPacket.get<QStringList>(QStringLiteral("packetCompression")).contains(QStringLiteral("deflate"));
+}
+
+bool PacketCompressor::compress(const QByteArray& input, QByteArray* output)
+{
+    if (m_failed) {
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    output->reserve(qMax(output->capacity(), int(deflateBound(m_deflate, uLong(input.size())))));
+    output->resize(0);
+
+    m_deflate->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.constData()));
+    m_deflate->avail_in = uInt(input.size());
+    do {
+        const int used = output->size();
+        output->resize(qMax(output->capacity(), used + 1024));
+        m_deflate->next_out = reinterpret_cast<Bytef*>(output->data() + used);
+        m_deflate->avail_out = uInt(output->size() - used);
+
+        const int ret = deflate(m_deflate, Z_SYNC_FLUSH);
+        output->resize(output->size() - int(m_deflate->avail_out));
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            //The stream state is now unknown to the peer, never use it again
+            qCWarning(KDECONNECT_CORE) << "PacketCompressor: deflate failed" << ret;
+            m_failed = true;
+            return false;
+        }
+    } while (m_deflate->avail_out == 0);
+
+    Q_ASSERT(output->endsWith(QByteArray::fromRawData(s_syncFlushTail, sizeof(s_syncFlushTail))));
+    output->chop(sizeof(s_syncFlushTail));
+
+    m_sent.packets++;
+    m_sent.uncompressedBytes += input.size();
+    m_sent.compressedBytes += output->size();
+    m_sent.compressionNsecs += timer.nsecsElapsed();
+    return true;
+}
+
+bool PacketCompressor::decompress(const QByteArray& input, QByteArray* output, int maxSize)
+{
+    if (m_failed) {
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    output->resize(0);
+    if (!inflateChunk(input.constData(), input.size(), output, maxSize)
+        || !inflateChunk(s_syncFlushTail, sizeof(s_syncFlushTail), output, maxSize)) {
+        qCWarning(KDECONNECT_CORE) << "PacketCompressor: could not inflate a frame of" << input.size() << "bytes";
+        m_failed = true;
+        return false;
+    }
+
+    m_received.packets++;
+    m_received.uncompressedBytes += output->size();
+    m_received.compressedBytes += input.size();
+    m_received.decompressionNsecs += timer.nsecsElapsed();
+    return true;
+}
+
+bool PacketCompressor::inflateChunk(const char* data, int size, QByteArray* output, int maxSize)
+{
+    m_inflate->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    m_inflate->avail_in = uInt(size);
+
+    forever {
+        const int used = output->size();
+        const int grow = qMin(maxSize - used, qMax(4096, used));
+        if (grow <= 0) {
+            return false; //Inflates to more than a frame may hold
+        }
+        output->resize(used + grow);
+        m_inflate->next_out = reinterpret_cast<Bytef*>(output->data() + used);
+        m_inflate->avail_out = uInt(grow);
+
+        const int ret = inflate(m_inflate, Z_SYNC_FLUSH);
+        output->resize(output->size() - int(m_inflate->avail_out));
+        if (ret == Z_BUF_ERROR) {
+            return m_inflate->avail_in == 0; //No progress possible, because everything was consumed
+        }
+        if (ret != Z_OK) {
+            return false;
+        }
+        if (m_inflate->avail_in == 0 && m_inflate->avail_out != 0) {
+            return true;
+        }
+    }
+}
@@ -0,0 +1,81 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKETCOMPRESSOR_H
+#define PACKETCOMPRESSOR_H
+
+#include <QByteArray>
+#include <QStringList>
+
+#include <kdeconnectcore_export.h>
+
+class NetworkPacket;
+struct z_stream_s;
+
+/*
+ * Raw deflate streams for the packets of one link, one for each direction.
+ * The streams are flushed but never finished after each packet, so later
+ * packets can refer back to the text of earlier ones: a contact sync or an
+ * sms dump compresses as a whole instead of packet by packet.
+ *
+ * Both ends must compress and decompress every frame in the same order, so a
+ * compressor has to be recreated whenever the underlying socket changes.
+ */
+class KDECONNECTCORE_EXPORT PacketCompressor
+{
+public:
+    struct Statistics {
+        quint64 packets = 0;
+        quint64 uncompressedBytes = 0;
+        quint64 compressedBytes = 0;
+        qint64 compressionNsecs = 0;
+        qint64 decompressionNsecs = 0;
+
+        double ratio() const { return compressedBytes ? double(uncompressedBytes) / compressedBytes : 1.0; }
+    };
+
+    //Smaller packets (pings, mousepad events...) are not worth the latency
+    static const int MinimumSize = 256;
+
+    PacketCompressor();
+    ~PacketCompressor();
+
+    static QStringList supportedMethods(); //Advertised as "packetCompression" in the identity packet
+    static bool isSupportedBy(const NetworkPacket& identityPacket);
+
+    bool compress(const QByteArray& input, QByteArray* output);
+    bool decompress(const QByteArray& input, QByteArray* output, int maxSize);
+
+    const Statistics& sentStatistics() const { return m_sent; }
+    const Statistics& receivedStatistics() const { return m_received; }
+
+private:
+    Q_DISABLE_COPY(PacketCompressor)
+
+    bool inflateChunk(const char* data, int size, QByteArray* output, int maxSize);
+
+    z_stream_s* m_deflate;
+    z_stream_s* m_inflate;
+    bool m_failed;
+    Statistics m_sent;
+    Statistics m_received;
+};
+
+#endif
@@ -0,0 +1,213 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "packetframer.h"
+
+#include <QIODevice>
+#include <QtEndian>
+
+#include <cstring>
+
+#include "core_debug.h"
+
+PacketFramer::PacketFramer(int maxFrameSize)
+    : m_framing(LineFraming)
+    , m_maxFrameSize(maxFrameSize)
+    , m_begin(0)
+    , m_end(0)
+    , m_scanned(0)
+    , m_frameEnd(-1)
+    , m_error(false)
+{
+}
+
+void PacketFramer::setFraming(Framing framing)
+{
+    m_framing = framing;
+    m_scanned = 0;
+    m_frameEnd = -1;
+}
+
+void PacketFramer::writeHeader(char* header, quint8 type, quint32 size)
+{
+    header[0] = char(type);
+    qToBigEndian<quint32>(size, header + 1);
+}
+
+char* PacketFramer::reserve(int size)
+{
+    if (m_buffer.size() - m_end >= size) {
+        return m_buffer.data() + m_end;
+    }
+
+    //Move the unread bytes to the front before growing, so the buffer only grows
+    //when a single frame (or a burst of them) really needs the space
+    if (m_begin > 0) {
+        std::memmove(m_buffer.data(), m_buffer.constData() + m_begin, size_t(m_end - m_begin));
+        m_end -= m_begin;
+        m_begin = 0;
+    }
+    if (m_buffer.size() - m_end < size) {
+        m_buffer.resize(qMax(m_buffer.size() * 2, m_end + size));
+    }
+    return m_buffer.data() + m_end;
+}
+
+bool PacketFramer::append(const char* data, int size)
+{
+    if (m_error) {
+        return false;
+    }
+    std::memcpy(reserve(size), data, size_t(size));
+    m_end += size;
+    checkHeaders();
+    findFrame();
+    return !m_error;
+}
+
+bool PacketFramer::readFrom(QIODevice* device)
+{
+    while (!m_error) {
+        const qint64 available = device->bytesAvailable();
+        if (available <= 0) {
+            break;
+        }
+        const int chunkSize = int(qMin<qint64>(available, 1024 * 1024));
+        const qint64 read = device->read(reserve(chunkSize), chunkSize);
+        if (read <= 0) {
+            break;
+        }
+        m_end += int(read);
+        checkHeaders();
+
+        //Don't keep buffering a peer that never ends its frame
+        if (bufferedBytes() > m_maxFrameSize) {
+            findFrame();
+        }
+    }
+    return !m_error;
+}
+
+void PacketFramer::checkHeaders()
+{
+    //Every length is known as soon as its header arrived, there is no need to buffer a frame we'll refuse anyway
+    if (m_framing != LengthPrefixedFraming) {
+        return;
+    }
+
+    const char* data = m_buffer.constData() + m_begin;
+    const int size = m_end - m_begin;
+    while (!m_error && size - m_scanned >= HeaderSize) {
+        const quint32 length = qFromBigEndian<quint32>(data + m_scanned + 1);
+        if (length > quint32(m_maxFrameSize)) {
+            qCWarning(KDECONNECT_CORE) << "PacketFramer: frame of" << length << "bytes exceeds the limit, giving up";
+            m_error = true;
+        } else {
+            m_scanned += HeaderSize + int(length);
+        }
+    }
+}
+
+bool PacketFramer::hasFrame() const
+{
+    return findFrame();
+}
+
+bool PacketFramer::findFrame() const
+{
+    if (m_frameEnd >= 0) {
+        return true;
+    }
+    if (m_error) {
+        return false;
+    }
+
+    const char* data = m_buffer.constData() + m_begin;
+    const int size = m_end - m_begin;
+
+    if (m_framing == LineFraming) {
+        const void* newline = std::memchr(data + m_scanned, '\n', size_t(size - m_scanned));
+        if (!newline) {
+            m_scanned = size;
+            if (size > m_maxFrameSize) {
+                qCWarning(KDECONNECT_CORE) << "PacketFramer: no newline in" << size << "bytes, giving up";
+                m_error = true;
+            }
+            return false;
+        }
+        m_frameEnd = int(static_cast<const char*>(newline) - data) + 1;
+    } else {
+        if (size < HeaderSize) {
+            return false;
+        }
+        const quint32 length = qFromBigEndian<quint32>(data + 1);
+        if (length > quint32(m_maxFrameSize)) {
+            qCWarning(KDECONNECT_CORE) << "PacketFramer: frame of" << length << "bytes exceeds the limit, giving up";
+            m_error = true;
+            return false;
+        }
+        if (size - HeaderSize < int(length)) {
+            return false;
+        }
+        m_frameEnd = HeaderSize + int(length);
+    }
+    return true;
+}
+
+void PacketFramer::discard(int size)
+{
+    Q_ASSERT(size >= 0 && size <= bufferedBytes());
+    m_begin += size;
+    m_scanned = qMax(0, m_scanned - size);
+    if (m_frameEnd >= 0) {
+        m_frameEnd -= size;
+    }
+    if (m_begin == m_end) {
+        m_begin = m_end = 0;
+    }
+}
+
+bool PacketFramer::nextFrame(Frame* frame)
+{
+    while (findFrame()) {
+        const char* data = m_buffer.constData() + m_begin;
+        const int frameSize = m_frameEnd;
+        m_begin += frameSize;
+        m_scanned = 0;
+        m_frameEnd = -1;
+        if (m_begin == m_end) {
+            //Nothing is left, so the next data can start at the front without moving anything
+            m_begin = m_end = 0;
+        }
+
+        if (m_framing == LineFraming) {
+            if (frameSize == 1) {
+                continue; //we don't want a single \n
+            }
+            frame->type = PacketFrame;
+            frame->data = QByteArray::fromRawData(data, frameSize);
+        } else {
+            frame->type = quint8(data[0]);
+            frame->data = QByteArray::fromRawData(data + HeaderSize, frameSize - HeaderSize);
+        }
+        return true;
+    }
+    return false;
+}
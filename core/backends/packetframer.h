@@ -0,0 +1,108 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKETFRAMER_H
+#define PACKETFRAMER_H
+
+#include <QByteArray>
+
+#include <kdeconnectcore_export.h>
+
+class QIODevice;
+
+/*
+ * Splits the bytes read from a link into frames, either newline terminated
+ * json lines or length prefixed binary frames (a one byte frame type followed
+ * by the payload length as a 32 bit big endian integer).
+ *
+ * Everything is kept in one contiguous buffer that is compacted instead of
+ * reallocated, and frames are handed out as views into it: the QByteArray
+ * returned by nextFrame() doesn't own its data and is only valid until the
+ * next call to a non-const method.
+ */
+class KDECONNECTCORE_EXPORT PacketFramer
+{
+public:
+    enum Framing {
+        LineFraming,
+        LengthPrefixedFraming
+    };
+
+    enum FrameType : quint8 {
+        PacketFrame = 1,
+        CompressedPacketFrame = 2,
+        //Payload substreams, see PayloadMultiplexer
+        PayloadDataFrame = 3,
+        PayloadEndFrame = 4,
+        PayloadCreditFrame = 5,
+        PayloadCancelFrame = 6
+    };
+
+    struct Frame {
+        quint8 type;
+        QByteArray data; //Includes the trailing newline in line framing
+    };
+
+    static const int HeaderSize = 5;
+    static const int DefaultMaxFrameSize = 64 * 1024 * 1024;
+
+    explicit PacketFramer(int maxFrameSize = DefaultMaxFrameSize);
+
+    //Only switch between frames, the bytes already buffered are parsed with the new framing
+    void setFraming(Framing framing);
+    Framing framing() const { return m_framing; }
+    void setMaxFrameSize(int maxFrameSize) { m_maxFrameSize = maxFrameSize; }
+    int maxFrameSize() const { return m_maxFrameSize; }
+
+    //Reads everything the device has buffered. Returns false once a frame exceeds the maximum size,
+    //from then on the stream can't be resynchronized and the connection should be dropped.
+    bool readFrom(QIODevice* device);
+    bool append(const char* data, int size);
+
+    bool hasFrame() const;
+    bool nextFrame(Frame* frame);
+    bool hasError() const { return m_error; }
+    int bufferedBytes() const { return m_end - m_begin; }
+
+    //The start of a frame that is still arriving, as a view like nextFrame(). Bytes the
+    //caller already decoded incrementally can be dropped with discard().
+    QByteArray pendingData() const { return QByteArray::fromRawData(m_buffer.constData() + m_begin, m_end - m_begin); }
+    void discard(int size);
+
+    static void writeHeader(char* header, quint8 type, quint32 size);
+
+private:
+    char* reserve(int size);
+    bool findFrame() const;
+    void checkHeaders();
+
+    Framing m_framing;
+    int m_maxFrameSize;
+    QByteArray m_buffer;
+    int m_begin; //First byte not handed out yet
+    int m_end;   //End of the buffered data
+
+    //Parsing state, relative to m_begin so compacting doesn't invalidate it
+    mutable int m_scanned;  //Bytes known to hold no newline, or the next header to check with length prefixes
+    mutable int m_frameEnd; //End of the next complete frame, -1 if not found yet
+    mutable bool m_error;
+};
+
+#endif
@@ -0,0 +1,338 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "payloadmultiplexer.h"
+
+#include <QtEndian>
+
+#include "bandwidthlimiter.h"
+#include "core_debug.h"
+#include "networkpacket.h"
+#include "packetframer.h"
+
+PayloadStream::PayloadStream(quint32 id, QObject* parent)
+    : QIODevice(parent)
+    , m_id(id)
+    , m_offset(0)
+    , m_unacknowledged(0)
+    , m_finished(false)
+{
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+qint64 PayloadStream::bytesAvailable() const
+{
+    return m_buffer.size() - m_offset + QIODevice::bytesAvailable();
+}
+
+bool PayloadStream::atEnd() const
+{
+    return m_finished && bytesAvailable() == 0;
+}
+
+void PayloadStream::appendData(const char* data, int size)
+{
+    //Compact instead of letting the buffer grow with everything ever received
+    if (m_offset > 0 && m_offset >= m_buffer.size() / 2) {
+        m_buffer.remove(0, m_offset);
+        m_offset = 0;
+    }
+    m_buffer.append(data, size);
+    Q_EMIT readyRead();
+}
+
+void PayloadStream::finish()
+{
+    m_finished = true;
+    Q_EMIT readChannelFinished();
+}
+
+void PayloadStream::fail(const QString& error)
+{
+    setErrorString(error);
+    finish();
+}
+
+qint64 PayloadStream::readData(char* data, qint64 maxSize)
+{
+    const int available = m_buffer.size() - m_offset;
+    if (available == 0) {
+        return m_finished ? -1 : 0;
+    }
+
+    const int size = int(qMin<qint64>(maxSize, available));
+    memcpy(data, m_buffer.constData() + m_offset, size);
+    m_offset += size;
+    if (m_offset == m_buffer.size()) {
+        m_buffer.resize(0);
+        m_offset = 0;
+    }
+
+    //Acknowledged in batches, a credit frame per read would be more overhead than data
+    m_unacknowledged += size;
+    if (!m_finished && m_unacknowledged >= PayloadMultiplexer::Window / 4) {
+        Q_EMIT consumed(m_id, m_unacknowledged);
+        m_unacknowledged = 0;
+    }
+    return size;
+}
+
+qint64 PayloadStream::writeData(const char* data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+PayloadMultiplexer::PayloadMultiplexer(QIODevice* device, QObject* parent)
+    : QObject(parent)
+    , m_device(device)
+    , m_nextId(1)
+    , m_sendScheduled(false)
+{
+    connect(m_device, &QIODevice::bytesWritten, this, &PayloadMultiplexer::sendSome);
+
+    m_throttleTimer.setSingleShot(true);
+    connect(&m_throttleTimer, &QTimer::timeout, this, &PayloadMultiplexer::sendSome);
+}
+
+PayloadMultiplexer::~PayloadMultiplexer()
+{
+    for (const QPointer<PayloadStream>& stream : qAsConst(m_incoming)) {
+        if (stream) {
+            stream->fail(QStringLiteral("Connection closed"));
+        }
+    }
+}
+
+bool PayloadMultiplexer::isSupportedBy(const NetworkPacket& identityPacket)
+{
+    return identityPacket.get<bool>(QStringLiteral("payloadStreams"));
+}
+
+bool PayloadMultiplexer::isPayloadFrame(quint8 type)
+{
+    return type >= PacketFramer::PayloadDataFrame && type <= PacketFramer::PayloadCancelFrame;
+}
+
+quint32 PayloadMultiplexer::send(const QSharedPointer<QIODevice>& source, qint64 size)
+{
+    const quint32 id = m_nextId++;
+
+    if (!source->isOpen() && !source->open(QIODevice::ReadOnly)) {
+        qCWarning(KDECONNECT_CORE) << "PayloadMultiplexer: error when opening the input to upload" << source->errorString();
+    }
+    if (source->isSequential()) {
+        connect(source.data(), &QIODevice::readyRead, this, &PayloadMultiplexer::scheduleSend);
+        connect(source.data(), &QIODevice::readChannelFinished, this, &PayloadMultiplexer::scheduleSend);
+    }
+
+    m_outgoing.insert(id, { source, size, Window });
+    m_sendOrder.append(id);
+    scheduleSend();
+    return id;
+}
+
+QSharedPointer<QIODevice> PayloadMultiplexer::receive(quint32 id)
+{
+    if (PayloadStream* previous = m_incoming.take(id)) {
+        previous->fail(QStringLiteral("Stream id reused"));
+    }
+
+    PayloadStream* stream = new PayloadStream(id);
+    connect(stream, &PayloadStream::consumed, this, [this](quint32 id, qint64 bytes) {
+        char credit[4];
+        qToBigEndian<quint32>(quint32(bytes), reinterpret_cast<uchar*>(credit));
+        writeControlFrame(PacketFramer::PayloadCreditFrame, id, credit, sizeof(credit));
+    });
+    //Nobody wants the payload anymore, tell the sender to stop
+    connect(stream, &QObject::destroyed, this, [this, id]() {
+        if (m_incoming.remove(id)) {
+            writeControlFrame(PacketFramer::PayloadCancelFrame, id, nullptr, 0);
+        }
+    });
+
+    m_incoming.insert(id, stream);
+    return QSharedPointer<QIODevice>(stream);
+}
+
+bool PayloadMultiplexer::handleFrame(quint8 type, const QByteArray& frame)
+{
+    if (frame.size() < IdSize) {
+        return false;
+    }
+    const quint32 id = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(frame.constData()));
+    const char* const data = frame.constData() + IdSize;
+    const int size = frame.size() - IdSize;
+
+    switch (type) {
+    case PacketFramer::PayloadDataFrame: {
+        PayloadStream* stream = m_incoming.value(id);
+        if (!stream) {
+            return true; //Cancelled, the sender will stop once it sees it
+        }
+        if (stream->bytesAvailable() + size > Window) {
+            qCWarning(KDECONNECT_CORE) << "PayloadMultiplexer: peer ignored flow control on stream" << id;
+            m_incoming.remove(id);
+            stream->fail(QStringLiteral("Flow control violated"));
+            return false;
+        }
+        stream->appendData(data, size);
+        return true;
+    }
+    case PacketFramer::PayloadEndFrame: {
+        PayloadStream* stream = m_incoming.take(id);
+        if (stream) {
+            if (size > 0 && data[0] != 0) {
+                stream->fail(QStringLiteral("Upload aborted by the sender"));
+            } else {
+                stream->finish();
+            }
+        }
+        return true;
+    }
+    case PacketFramer::PayloadCreditFrame: {
+        if (size < 4) {
+            return false;
+        }
+        auto it = m_outgoing.find(id);
+        if (it != m_outgoing.end()) {
+            it->credit += qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(data));
+            scheduleSend();
+        }
+        return true;
+    }
+    case PacketFramer::PayloadCancelFrame:
+        if (m_outgoing.contains(id)) {
+            qCDebug(KDECONNECT_CORE) << "PayloadMultiplexer: peer cancelled stream" << id;
+            m_outgoing.remove(id);
+            m_sendOrder.removeOne(id);
+        }
+        return true;
+    }
+    return false;
+}
+
+void PayloadMultiplexer::scheduleSend()
+{
+    if (!m_sendScheduled) {
+        m_sendScheduled = true;
+        QMetaObject::invokeMethod(this, "sendSome", Qt::QueuedConnection);
+    }
+}
+
+void PayloadMultiplexer::sendSome()
+{
+    m_sendScheduled = false;
+
+    const int prefixSize = PacketFramer::HeaderSize + IdSize;
+    if (m_chunk.size() != prefixSize + ChunkSize) {
+        m_chunk.resize(prefixSize + ChunkSize);
+    }
+
+    //Streams without credit or data are skipped, stop once a whole round made no progress
+    int idle = 0;
+    while (!m_sendOrder.isEmpty() && idle < m_sendOrder.size() && m_device->bytesToWrite() < MaxPendingWrite) {
+        const quint32 id = m_sendOrder.takeFirst();
+        OutgoingStream& stream = m_outgoing[id];
+        QIODevice* source = stream.source.data();
+
+        if (stream.remaining == 0) {
+            endOutgoing(id, false);
+            continue;
+        }
+        if (stream.credit <= 0) {
+            m_sendOrder.append(id);
+            ++idle;
+            continue;
+        }
+
+        qint64 maxSize = qMin<qint64>(ChunkSize, stream.credit);
+        if (stream.remaining > 0) {
+            maxSize = qMin(maxSize, stream.remaining);
+        }
+        BandwidthLimiter* limiter = m_deviceId.isEmpty() ? nullptr : BandwidthLimiter::instance();
+        if (limiter) {
+            maxSize = limiter->allowance(m_deviceId, maxSize);
+            if (maxSize == 0) {
+                //Nobody may send, it's the same device for every stream
+                m_sendOrder.prepend(id);
+                if (!m_throttleTimer.isActive()) {
+                    m_throttleTimer.start(limiter->msecsToWait(m_deviceId));
+                }
+                return;
+            }
+        }
+        const qint64 size = source->read(m_chunk.data() + prefixSize, maxSize);
+        if (size < 0 || (size == 0 && source->atEnd())) {
+            //A source that ends before its announced size is an aborted upload
+            endOutgoing(id, size < 0 ? stream.remaining != -1 : stream.remaining > 0);
+            continue;
+        }
+        if (size == 0) {
+            m_sendOrder.append(id); //Waits for readyRead
+            ++idle;
+            continue;
+        }
+
+        PacketFramer::writeHeader(m_chunk.data(), PacketFramer::PayloadDataFrame, quint32(IdSize + size));
+        qToBigEndian<quint32>(id, reinterpret_cast<uchar*>(m_chunk.data() + PacketFramer::HeaderSize));
+        m_device->write(m_chunk.constData(), prefixSize + size);
+        if (limiter) {
+            limiter->consume(m_deviceId, size);
+        }
+
+        stream.credit -= size;
+        if (stream.remaining > 0) {
+            stream.remaining -= size;
+        }
+        if (stream.remaining == 0) {
+            endOutgoing(id, false);
+        } else {
+            m_sendOrder.append(id);
+        }
+        idle = 0;
+    }
+}
+
+void PayloadMultiplexer::endOutgoing(quint32 id, bool aborted)
+{
+    const char status = aborted ? 1 : 0;
+    writeControlFrame(PacketFramer::PayloadEndFrame, id, &status, 1);
+
+    QSharedPointer<QIODevice> source = m_outgoing.take(id).source;
+    m_sendOrder.removeOne(id);
+    disconnect(source.data(), nullptr, this, nullptr);
+    source->close();
+    if (aborted) {
+        qCWarning(KDECONNECT_CORE) << "PayloadMultiplexer: upload of stream" << id << "aborted";
+    }
+}
+
+void PayloadMultiplexer::writeControlFrame(quint8 type, quint32 id, const char* data, int size)
+{
+    char header[PacketFramer::HeaderSize + IdSize];
+    PacketFramer::writeHeader(header, type, quint32(IdSize + size));
+    qToBigEndian<quint32>(id, reinterpret_cast<uchar*>(header + PacketFramer::HeaderSize));
+    m_device->write(header, sizeof(header));
+    if (size > 0) {
+        m_device->write(data, size);
+    }
+}
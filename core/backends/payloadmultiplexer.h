@@ -0,0 +1,147 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PAYLOADMULTIPLEXER_H
+#define PAYLOADMULTIPLEXER_H
+
+#include <QHash>
+#include <QIODevice>
+#include <QList>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QTimer>
+
+#include <kdeconnectcore_export.h>
+
+class NetworkPacket;
+
+/*
+ * The receiving end of a payload carried by a PayloadMultiplexer. Data is
+ * buffered until read, and reading it is what grants the sender more credit.
+ */
+class KDECONNECTCORE_EXPORT PayloadStream
+    : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    explicit PayloadStream(quint32 id, QObject* parent = nullptr);
+
+    quint32 id() const { return m_id; }
+    bool isFinished() const { return m_finished; }
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override;
+    bool atEnd() const override;
+
+    //Called by the multiplexer as frames arrive
+    void appendData(const char* data, int size);
+    void finish();
+    void fail(const QString& error);
+
+Q_SIGNALS:
+    void consumed(quint32 id, qint64 bytes);
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+
+private:
+    const quint32 m_id;
+    QByteArray m_buffer;
+    int m_offset;
+    qint64 m_unacknowledged;
+    bool m_finished;
+};
+
+/*
+ * Carries payloads as substreams of an already encrypted link, instead of a new
+ * listening port and TLS handshake for every payload. The packet announcing a
+ * payload gets a "streamId" in its payloadTransferInfo, and the payload follows
+ * in frames of the link (see PacketFramer) tagged with that id:
+ *
+ *   PayloadDataFrame   sender -> receiver  id, bytes
+ *   PayloadEndFrame    sender -> receiver  id, status (0 complete, 1 aborted)
+ *   PayloadCreditFrame receiver -> sender  id, bytes the receiver has read
+ *   PayloadCancelFrame receiver -> sender  id
+ *
+ * Every stream may only have Window bytes in flight, and the multiplexer only
+ * hands data to the socket while less than MaxPendingWrite bytes are queued in
+ * it. Streams take turns chunk by chunk, and packets written to the socket
+ * directly never wait behind more than about that much payload. Once a device
+ * is set, the BandwidthLimiter shapes the payloads too.
+ */
+class KDECONNECTCORE_EXPORT PayloadMultiplexer
+    : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int IdSize = 4;
+    static const int ChunkSize = 64 * 1024 - IdSize;
+    static const int Window = 512 * 1024;
+    static const int MaxPendingWrite = 128 * 1024;
+
+    explicit PayloadMultiplexer(QIODevice* device, QObject* parent = nullptr);
+    ~PayloadMultiplexer() override;
+
+    static bool isSupportedBy(const NetworkPacket& identityPacket); //Advertised as "payloadStreams" in the identity packet
+    static bool isPayloadFrame(quint8 type);
+
+    //Starts sending source once control returns to the event loop, so the packet announcing
+    //the returned id can be written first. A negative size sends until the source ends.
+    quint32 send(const QSharedPointer<QIODevice>& source, qint64 size);
+    QSharedPointer<QIODevice> receive(quint32 id);
+
+    //Returns false if the peer broke the protocol
+    bool handleFrame(quint8 type, const QByteArray& frame);
+
+    //Payloads are limited as going to this device, not at all if empty
+    void setDeviceId(const QString& deviceId) { m_deviceId = deviceId; }
+
+    int outgoingCount() const { return m_outgoing.size(); }
+    int incomingCount() const { return m_incoming.size(); }
+
+private Q_SLOTS:
+    void sendSome();
+
+private:
+    struct OutgoingStream {
+        QSharedPointer<QIODevice> source;
+        qint64 remaining; //-1 if unknown
+        qint64 credit;
+    };
+
+    void scheduleSend();
+    void endOutgoing(quint32 id, bool aborted);
+    void writeControlFrame(quint8 type, quint32 id, const char* data, int size);
+
+    QIODevice* m_device;
+    quint32 m_nextId;
+    QHash<quint32, OutgoingStream> m_outgoing;
+    QList<quint32> m_sendOrder; //Round robin between the outgoing streams
+    QHash<quint32, QPointer<PayloadStream>> m_incoming;
+    QByteArray m_chunk;
+    bool m_sendScheduled;
+    QString m_deviceId;
+    QTimer m_throttleTimer;
+};
+
+#endif
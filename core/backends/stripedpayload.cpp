@@ -0,0 +1,236 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "stripedpayload.h"
+
+#include <QtEndian>
+
+#include <algorithm>
+
+#include "core_debug.h"
+#include "networkpacket.h"
+
+StripedPayload::StripedPayload(qint64 size, QObject* parent)
+    : QIODevice(parent)
+    , m_size(size)
+    , m_position(0)
+{
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    connect(this, &QIODevice::aboutToClose, this, &StripedPayload::closeStripes);
+}
+
+void StripedPayload::addStripe(QIODevice* stripe)
+{
+    stripe->setParent(this);
+    m_stripes.append({ stripe, QByteArray(), -1, 0, 0, false });
+    connect(stripe, &QIODevice::readyRead, this, &StripedPayload::stripeDataArrived);
+    connect(stripe, &QIODevice::readChannelFinished, this, &StripedPayload::stripeClosed);
+}
+
+void StripedPayload::writeHeader(char* header, qint64 offset, qint64 length)
+{
+    qToBigEndian<qint64>(offset, reinterpret_cast<uchar*>(header));
+    qToBigEndian<qint64>(length, reinterpret_cast<uchar*>(header + 8));
+}
+
+int StripedPayload::stripesSupportedBy(const NetworkPacket& identityPacket)
+{
+    return qBound(1, identityPacket.get<int>(QStringLiteral("payloadStripes"), 1), MaxStripes);
+}
+
+bool StripedPayload::readHeader(Stripe& stripe)
+{
+    if (stripe.offset >= 0) {
+        return true;
+    }
+
+    stripe.header += stripe.device->read(HeaderSize - stripe.header.size());
+    if (stripe.header.size() < HeaderSize) {
+        return false;
+    }
+
+    const uchar* header = reinterpret_cast<const uchar*>(stripe.header.constData());
+    const qint64 offset = qFromBigEndian<qint64>(header);
+    const qint64 length = qFromBigEndian<qint64>(header + 8);
+    //Received bytes are what tells readers the payload is complete, so a stripe past
+    //the end or over another one would hide a gap
+    bool valid = offset >= 0 && length >= 0 && (m_size < 0 || (offset <= m_size && length <= m_size - offset));
+    for (const Stripe& other : qAsConst(m_stripes)) {
+        if (valid && other.offset >= 0 && offset < other.offset + other.length && other.offset < offset + length) {
+            valid = false;
+        }
+    }
+    if (!valid) {
+        qCWarning(KDECONNECT_CORE) << "StripedPayload: invalid stripe" << offset << length << "of" << m_size;
+        stripe.device->close();
+        return false;
+    }
+    stripe.offset = offset;
+    stripe.length = length;
+    return true;
+}
+
+int StripedPayload::indexOf(QObject* device) const
+{
+    for (int i = 0; i < m_stripes.size(); ++i) {
+        if (m_stripes[i].device == device) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int StripedPayload::inOrderStripe() const
+{
+    for (int i = 0; i < m_stripes.size(); ++i) {
+        const Stripe& stripe = m_stripes[i];
+        if (stripe.offset >= 0 && stripe.offset <= m_position && m_position < stripe.offset + stripe.length) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void StripedPayload::stripeDataArrived()
+{
+    const int index = indexOf(sender());
+    if (index < 0 || !readHeader(m_stripes[index])) {
+        return;
+    }
+
+    if (m_stripes[index].device->bytesAvailable() > 0) {
+        Q_EMIT stripeReadyRead(index);
+        if (index == inOrderStripe()) {
+            Q_EMIT readyRead();
+        }
+    }
+}
+
+void StripedPayload::stripeClosed()
+{
+    const int index = indexOf(sender());
+    if (index < 0 || m_stripes[index].finished) {
+        return;
+    }
+    m_stripes[index].finished = true;
+
+    //Whatever is still buffered can be read, and readers notice the end
+    Q_EMIT stripeReadyRead(index);
+    if (isFinished()) {
+        Q_EMIT readChannelFinished();
+    }
+}
+
+void StripedPayload::closeStripes()
+{
+    for (const Stripe& stripe : qAsConst(m_stripes)) {
+        stripe.device->close();
+    }
+}
+
+qint64 StripedPayload::readStripe(int index, char* data, qint64 maxSize, qint64* position)
+{
+    Stripe& stripe = m_stripes[index];
+    if (!readHeader(stripe)) {
+        return 0;
+    }
+
+    const qint64 size = stripe.device->read(data, qMin(maxSize, stripe.length - stripe.received));
+    if (size <= 0) {
+        return 0;
+    }
+    *position = stripe.offset + stripe.received;
+    stripe.received += size;
+    return size;
+}
+
+qint64 StripedPayload::contiguousBytes() const
+{
+    QVector<const Stripe*> stripes;
+    for (const Stripe& stripe : m_stripes) {
+        if (stripe.offset >= 0) {
+            stripes.append(&stripe);
+        }
+    }
+    std::sort(stripes.begin(), stripes.end(), [](const Stripe* a, const Stripe* b) { return a->offset < b->offset; });
+
+    qint64 contiguous = 0;
+    for (const Stripe* stripe : qAsConst(stripes)) {
+        if (stripe->offset != contiguous) {
+            break;
+        }
+        contiguous += stripe->received;
+        if (stripe->received < stripe->length) {
+            break;
+        }
+    }
+    return contiguous;
+}
+
+bool StripedPayload::isFinished() const
+{
+    for (const Stripe& stripe : m_stripes) {
+        if (!stripe.finished) {
+            return false;
+        }
+    }
+    return true;
+}
+
+qint64 StripedPayload::bytesAvailable() const
+{
+    const int index = inOrderStripe();
+    if (index < 0) {
+        return QIODevice::bytesAvailable();
+    }
+    const Stripe& stripe = m_stripes[index];
+    return qMin(stripe.device->bytesAvailable(), stripe.length - stripe.received) + QIODevice::bytesAvailable();
+}
+
+bool StripedPayload::atEnd() const
+{
+    return isFinished() && bytesAvailable() == 0;
+}
+
+qint64 StripedPayload::readData(char* data, qint64 maxSize)
+{
+    const int index = inOrderStripe();
+    if (index < 0) {
+        return 0;
+    }
+    qint64 position;
+    const qint64 size = readStripe(index, data, maxSize, &position);
+    m_position += size;
+
+    //The next stripe may be buffered already, and won't say so again
+    const int next = inOrderStripe();
+    if (next != index && next >= 0 && m_stripes[next].device->bytesAvailable() > 0) {
+        QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
+    }
+    return size;
+}
+
+qint64 StripedPayload::writeData(const char* data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
@@ -0,0 +1,104 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef STRIPEDPAYLOAD_H
+#define STRIPEDPAYLOAD_H
+
+#include <QIODevice>
+#include <QVector>
+
+#include <kdeconnectcore_export.h>
+
+class NetworkPacket;
+
+/*
+ * A payload received over several connections at once, each one carrying a
+ * contiguous range of it (a stripe). Every stripe starts with a header with the
+ * offset of its range in the payload and its length, as big endian 64 bit integers.
+ *
+ * Stripes must lie within the payload and not overlap each other, a stripe
+ * whose header says otherwise is closed without reading any of it.
+ *
+ * Read like any other QIODevice, it returns the payload in order, one stripe
+ * after the other, while the rest waits in the sockets. Consumers able to write
+ * anywhere, like FileTransferJob, use readStripe() and take each stripe as it comes.
+ */
+class KDECONNECTCORE_EXPORT StripedPayload
+    : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    //@p size is the one of the whole payload, -1 if unknown
+    explicit StripedPayload(qint64 size, QObject* parent = nullptr);
+
+    //Takes ownership of @p stripe, which must emit readChannelFinished when done
+    void addStripe(QIODevice* stripe);
+    int stripeCount() const { return m_stripes.size(); }
+
+    //Reads what arrived on stripe @p index, @p position is set to where it goes in the payload
+    qint64 readStripe(int index, char* data, qint64 maxSize, qint64* position);
+    //How much of the payload arrived without gaps, counting from its start
+    qint64 contiguousBytes() const;
+    //No stripe will get any more data
+    bool isFinished() const;
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override;
+    bool atEnd() const override;
+
+    static const int HeaderSize = 16;
+    static const int MaxStripes = 8;
+    static void writeHeader(char* header, qint64 offset, qint64 length);
+    static int stripesSupportedBy(const NetworkPacket& identityPacket); //Advertised as "payloadStripes" in the identity packet
+
+Q_SIGNALS:
+    void stripeReadyRead(int index);
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+
+private Q_SLOTS:
+    void stripeDataArrived();
+    void stripeClosed();
+    void closeStripes();
+
+private:
+    struct Stripe {
+        QIODevice* device;
+        QByteArray header;
+        qint64 offset; //-1 until the header arrived
+        qint64 length;
+        qint64 received;
+        bool finished;
+    };
+
+    bool readHeader(Stripe& stripe);
+    int indexOf(QObject* device) const;
+    int inOrderStripe() const;
+
+    QVector<Stripe> m_stripes;
+    const qint64 m_size;
+    qint64 m_position;
+};
+
+#endif
@@ -34,6 +34,7 @@
     #include "backends/bluetooth/bluetoothlinkprovider.h"
 #endif
 
+#include "backends/bandwidthlimiter.h"
 #include "backends/lan/lanlinkprovider.h"
 #include "backends/loopback/loopbacklinkprovider.h"
 #include "device.h"
@@ -242,6 +243,18 @@ QString Daemon::announcedName()
     return KdeConnectConfig::instance()->name();
 }
 
+qint64 Daemon::payloadRateLimit()
+{
+    return BandwidthLimiter::instance()->rate();
+}
+
+void Daemon::setPayloadRateLimit(qint64 rate)
+{
+    rate = qMax<qint64>(0, rate);
+    KdeConnectConfig::instance()->setPayloadRateLimit(rate);
+    BandwidthLimiter::instance()->setRate(rate);
+}
+
 QNetworkAccessManager* Daemon::networkAccessManager()
 {
     static QPointer<QNetworkAccessManager> manager;
@@ -68,6 +68,10 @@ public Q_SLOTS:
     Q_SCRIPTABLE QString announcedName();
     Q_SCRIPTABLE void setAnnouncedName(const QString& name);
 
+    //Bytes per second all payloads together may use, 0 for unlimited. Devices have their own limit too
+    Q_SCRIPTABLE qint64 payloadRateLimit();
+    Q_SCRIPTABLE void setPayloadRateLimit(qint64 rate);
+
     //Returns a list of ids. The respective devices can be manipulated using the dbus path: "/modules/kdeconnect/Devices/"+id
     Q_SCRIPTABLE QStringList devices(bool onlyReachable = false, bool onlyPaired = false) const;
 
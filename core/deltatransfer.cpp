@@ -0,0 +1,444 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "deltatransfer.h"
+#include <core_debug.h>
+
+#include <QCryptographicHash>
+#include <QTimer>
+#include <QtEndian>
+
+#include <cmath>
+#include <cstring>
+
+enum DeltaCommand {
+    LiteralCommand = 1,
+    CopyCommand = 2
+};
+
+static const int ReadChunkSize = 256 * 1024;
+//Encoded output is produced about this much at a time
+static const int OutputChunkSize = 64 * 1024;
+//Unmatched bytes are sent once this many piled up, which bounds what the encoder holds
+static const int MaxLiteralSize = 64 * 1024;
+
+static void appendUint32(QByteArray& data, quint32 value)
+{
+    uchar bytes[4];
+    qToBigEndian<quint32>(value, bytes);
+    data.append(reinterpret_cast<const char*>(bytes), 4);
+}
+
+static quint32 readUint32(const char* data)
+{
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(data));
+}
+
+DeltaSignatures::DeltaSignatures()
+    : m_blockSize(0)
+{
+}
+
+int DeltaSignatures::blockSizeFor(qint64 size)
+{
+    const int root = int(std::sqrt(double(size))) & ~1023;
+    return qBound(MinBlockSize, root, MaxBlockSize);
+}
+
+QByteArray DeltaSignatures::compute(const QString& path, int blockSize)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+
+    QByteArray signatures;
+    signatures.reserve(8 + file.size() / blockSize * EntrySize);
+    appendUint32(signatures, blockSize);
+    appendUint32(signatures, 0);
+
+    QByteArray block(blockSize, Qt::Uninitialized);
+    quint32 count = 0;
+    while (file.read(block.data(), blockSize) == blockSize) {
+        appendUint32(signatures, rollingChecksum(block.constData(), blockSize));
+        signatures.append(strongChecksum(block.constData(), blockSize));
+        ++count;
+    }
+    if (file.error() != QFile::NoError) {
+        return QByteArray();
+    }
+
+    qToBigEndian<quint32>(count, reinterpret_cast<uchar*>(signatures.data() + 4));
+    return signatures;
+}
+
+quint32 DeltaSignatures::rollingChecksum(const char* data, int size)
+{
+    quint32 a = 0;
+    quint32 b = 0;
+    for (int i = 0; i < size; ++i) {
+        const quint32 byte = uchar(data[i]);
+        a += byte;
+        b += (size - i) * byte;
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+QByteArray DeltaSignatures::strongChecksum(const char* data, int size)
+{
+    //Only tells blocks with the same rolling checksum apart, the whole file is verified with SHA-256
+    return QCryptographicHash::hash(QByteArray::fromRawData(data, size), QCryptographicHash::Md5);
+}
+
+bool DeltaSignatures::parse(const QByteArray& signatures)
+{
+    if (signatures.size() < 8) {
+        return false;
+    }
+    const quint32 blockSize = readUint32(signatures.constData());
+    const quint32 count = readUint32(signatures.constData() + 4);
+    if (blockSize < quint32(MinBlockSize) || blockSize > quint32(MaxBlockSize)
+        || (signatures.size() - 8) / EntrySize != qint64(count) || (signatures.size() - 8) % EntrySize) {
+        return false;
+    }
+
+    m_blockSize = blockSize;
+    m_rolling.clear();
+    m_rolling.reserve(count);
+    m_strong.resize(count);
+    const char* entry = signatures.constData() + 8;
+    for (quint32 i = 0; i < count; ++i, entry += EntrySize) {
+        m_rolling.insert(readUint32(entry), i);
+        m_strong[i] = QByteArray(entry + 4, StrongSize);
+    }
+    return true;
+}
+
+int DeltaSignatures::find(quint32 rolling, const char* data, int preferred) const
+{
+    auto it = m_rolling.constFind(rolling);
+    if (it == m_rolling.constEnd()) {
+        return -1;
+    }
+
+    const QByteArray strong = strongChecksum(data, m_blockSize);
+    if (preferred >= 0 && preferred < m_strong.size() && m_strong[preferred] == strong) {
+        return preferred; //Continues the run of blocks being copied
+    }
+    for (; it != m_rolling.constEnd() && it.key() == rolling; ++it) {
+        if (m_strong[it.value()] == strong) {
+            return it.value();
+        }
+    }
+    return -1;
+}
+
+DeltaEncoder::DeltaEncoder(const QSharedPointer<QIODevice>& source, const DeltaSignatures& signatures, QObject* parent)
+    : QIODevice(parent)
+    , m_source(source)
+    , m_signatures(signatures)
+    , m_position(0)
+    , m_literalStart(0)
+    , m_sourceDone(false)
+    , m_rolling(false)
+    , m_a(0)
+    , m_b(0)
+    , m_copyStart(-1)
+    , m_copyCount(0)
+    , m_outputPosition(0)
+    , m_finished(false)
+{
+}
+
+bool DeltaEncoder::atEnd() const
+{
+    return m_finished && m_outputPosition >= m_output.size() && QIODevice::bytesAvailable() == 0;
+}
+
+qint64 DeltaEncoder::bytesAvailable() const
+{
+    return m_output.size() - m_outputPosition + QIODevice::bytesAvailable();
+}
+
+qint64 DeltaEncoder::readData(char* data, qint64 maxSize)
+{
+    if (m_outputPosition >= m_output.size()) {
+        m_output.clear();
+        m_outputPosition = 0;
+        encodeSome();
+    }
+
+    const qint64 size = qMin<qint64>(maxSize, m_output.size() - m_outputPosition);
+    memcpy(data, m_output.constData() + m_outputPosition, size);
+    m_outputPosition += size;
+    return size;
+}
+
+qint64 DeltaEncoder::writeData(const char* data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+void DeltaEncoder::encodeSome()
+{
+    const int blockSize = m_signatures.blockSize();
+    while (!m_finished && m_output.size() < OutputChunkSize) {
+        if (m_input.size() - m_position <= blockSize && !m_sourceDone) {
+            fill();
+            continue;
+        }
+
+        const int available = m_input.size() - m_position;
+        if (available < blockSize || m_signatures.blockCount() == 0) {
+            //Too little left to match a block, or no blocks to match
+            m_position = m_input.size();
+            flushLiteral(m_position);
+            if (m_sourceDone) {
+                flushCopy();
+                m_finished = true;
+            }
+            continue;
+        }
+
+        const char* window = m_input.constData() + m_position;
+        if (!m_rolling) {
+            const quint32 checksum = DeltaSignatures::rollingChecksum(window, blockSize);
+            m_a = checksum & 0xffff;
+            m_b = checksum >> 16;
+            m_rolling = true;
+        }
+
+        const int block = m_signatures.find(m_a | (m_b << 16), window, m_copyCount ? m_copyStart + m_copyCount : -1);
+        if (block >= 0) {
+            flushLiteral(m_position);
+            if (m_copyCount && block == m_copyStart + m_copyCount) {
+                ++m_copyCount;
+            } else {
+                flushCopy();
+                m_copyStart = block;
+                m_copyCount = 1;
+            }
+            m_position += blockSize;
+            m_literalStart = m_position;
+            m_rolling = false;
+            continue;
+        }
+
+        if (available == blockSize) {
+            //The source is done and the last window matched nothing
+            m_position = m_input.size();
+            continue;
+        }
+
+        //Slide the window by a byte
+        const quint32 out = uchar(m_input.at(m_position));
+        const quint32 in = uchar(m_input.at(m_position + blockSize));
+        m_a = (m_a - out + in) & 0xffff;
+        m_b = (m_b - blockSize * out + m_a) & 0xffff;
+        ++m_position;
+        if (m_position - m_literalStart >= MaxLiteralSize) {
+            flushLiteral(m_position);
+        }
+    }
+}
+
+void DeltaEncoder::fill()
+{
+    //Only the bytes not encoded yet are kept
+    if (m_literalStart > 0) {
+        m_input.remove(0, m_literalStart);
+        m_position -= m_literalStart;
+        m_literalStart = 0;
+    }
+
+    const int before = m_input.size();
+    m_input.resize(before + ReadChunkSize);
+    const qint64 size = m_source->read(m_input.data() + before, ReadChunkSize);
+    m_input.resize(before + int(qMax<qint64>(size, 0)));
+    if (size <= 0) {
+        m_sourceDone = true;
+    }
+}
+
+void DeltaEncoder::flushLiteral(int end)
+{
+    if (end <= m_literalStart) {
+        return;
+    }
+    //Blocks matched before these bytes go first
+    flushCopy();
+    m_output.append(char(LiteralCommand));
+    appendUint32(m_output, end - m_literalStart);
+    m_output.append(m_input.constData() + m_literalStart, end - m_literalStart);
+    m_literalStart = end;
+}
+
+void DeltaEncoder::flushCopy()
+{
+    if (!m_copyCount) {
+        return;
+    }
+    m_output.append(char(CopyCommand));
+    appendUint32(m_output, m_copyStart);
+    appendUint32(m_output, m_copyCount);
+    m_copyCount = 0;
+}
+
+DeltaDecoder::DeltaDecoder(const QSharedPointer<QIODevice>& delta, const QString& basePath, int blockSize, QObject* parent)
+    : QIODevice(parent)
+    , m_delta(delta)
+    , m_base(basePath)
+    , m_blockSize(blockSize)
+    , m_inputPosition(0)
+    , m_literalLeft(0)
+    , m_copyPosition(0)
+    , m_copyLeft(0)
+    , m_deltaDone(false)
+{
+    connect(m_delta.data(), &QIODevice::readyRead, this, &QIODevice::readyRead);
+    auto deltaDone = [this]() {
+        if (!m_deltaDone) {
+            m_deltaDone = true;
+            Q_EMIT readChannelFinished();
+        }
+    };
+    connect(m_delta.data(), &QIODevice::readChannelFinished, this, deltaDone);
+    connect(m_delta.data(), &QIODevice::aboutToClose, this, deltaDone);
+}
+
+bool DeltaDecoder::open(OpenMode mode)
+{
+    if (!m_base.open(QIODevice::ReadOnly)) {
+        setErrorString(m_base.errorString());
+        return false;
+    }
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void DeltaDecoder::close()
+{
+    QIODevice::close();
+    m_base.close();
+    m_delta->close();
+}
+
+bool DeltaDecoder::atEnd() const
+{
+    return m_deltaDone && !m_literalLeft && !m_copyLeft && m_inputPosition >= m_input.size()
+        && (!m_delta->isOpen() || !m_delta->bytesAvailable());
+}
+
+qint64 DeltaDecoder::readData(char* data, qint64 maxSize)
+{
+    qint64 produced = 0;
+    while (produced < maxSize) {
+        if (m_literalLeft) {
+            if (!ensureInput(1)) {
+                break;
+            }
+            const qint64 size = qMin(qMin(m_literalLeft, maxSize - produced), qint64(m_input.size() - m_inputPosition));
+            memcpy(data + produced, m_input.constData() + m_inputPosition, size);
+            m_inputPosition += size;
+            m_literalLeft -= size;
+            produced += size;
+        } else if (m_copyLeft) {
+            const qint64 size = qMin(m_copyLeft, maxSize - produced);
+            if (!m_base.seek(m_copyPosition) || m_base.read(data + produced, size) != size) {
+                fail(QStringLiteral("Couldn't read the old copy: ") + m_base.errorString());
+                break;
+            }
+            m_copyPosition += size;
+            m_copyLeft -= size;
+            produced += size;
+        } else if (!parseCommand()) {
+            break;
+        }
+    }
+
+    if (m_inputPosition >= ReadChunkSize) {
+        m_input.remove(0, m_inputPosition);
+        m_inputPosition = 0;
+    }
+    return produced;
+}
+
+qint64 DeltaDecoder::writeData(const char* data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+bool DeltaDecoder::parseCommand()
+{
+    if (!ensureInput(1)) {
+        return false;
+    }
+
+    switch (m_input.at(m_inputPosition)) {
+    case LiteralCommand:
+        if (!ensureInput(5)) {
+            return false;
+        }
+        m_literalLeft = readUint32(m_input.constData() + m_inputPosition + 1);
+        m_inputPosition += 5;
+        return true;
+    case CopyCommand:
+        if (!ensureInput(9)) {
+            return false;
+        }
+        m_copyPosition = qint64(readUint32(m_input.constData() + m_inputPosition + 1)) * m_blockSize;
+        m_copyLeft = qint64(readUint32(m_input.constData() + m_inputPosition + 5)) * m_blockSize;
+        m_inputPosition += 9;
+        return true;
+    default:
+        fail(QStringLiteral("Invalid delta command"));
+        return false;
+    }
+}
+
+bool DeltaDecoder::ensureInput(int size)
+{
+    while (m_input.size() - m_inputPosition < size) {
+        const QByteArray more = m_delta->isOpen() ? m_delta->read(ReadChunkSize) : QByteArray();
+        if (more.isEmpty()) {
+            return false;
+        }
+        m_input.append(more);
+    }
+    return true;
+}
+
+void DeltaDecoder::fail(const QString& error)
+{
+    qCWarning(KDECONNECT_CORE) << "Can't rebuild" << m_base.fileName() << "from its delta:" << error;
+    setErrorString(error);
+    m_literalLeft = 0;
+    m_copyLeft = 0;
+    m_input.clear();
+    m_inputPosition = 0;
+
+    //What was rebuilt so far is right, the reader sees the data end there
+    QTimer::singleShot(0, this, [this]() {
+        m_delta->close();
+    });
+}
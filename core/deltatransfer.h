@@ -0,0 +1,157 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DELTATRANSFER_H
+#define DELTATRANSFER_H
+
+#include <QFile>
+#include <QIODevice>
+#include <QMultiHash>
+#include <QSharedPointer>
+#include <QVector>
+
+#include "kdeconnectcore_export.h"
+
+/*
+ * Sending only what changed in a file the receiver has an older copy of, the way
+ * rsync does it. The receiver describes its copy block by block:
+ *
+ *   quint32 blockSize, quint32 blockCount
+ *   per block: quint32 rolling checksum, 16 bytes MD5
+ *
+ * and the sender answers with the new file as a stream of commands:
+ *
+ *   LiteralCommand  quint32 length, the bytes
+ *   CopyCommand     quint32 first block, quint32 block count, taken from the old copy
+ *
+ * All numbers are big-endian. Only whole blocks are described, a shorter tail of
+ * the old copy is never referenced.
+ */
+class KDECONNECTCORE_EXPORT DeltaSignatures
+{
+public:
+    static const int MinBlockSize = 2 * 1024;
+    static const int MaxBlockSize = 64 * 1024;
+    static const int StrongSize = 16;
+    static const int EntrySize = 4 + StrongSize;
+
+    DeltaSignatures();
+
+    //About the square root of the size, so neither the signatures nor the blocks get big
+    static int blockSizeFor(qint64 size);
+    //Empty if the file can't be read
+    static QByteArray compute(const QString& path, int blockSize);
+
+    static quint32 rollingChecksum(const char* data, int size);
+    static QByteArray strongChecksum(const char* data, int size);
+
+    bool parse(const QByteArray& signatures);
+    int blockSize() const { return m_blockSize; }
+    int blockCount() const { return m_strong.size(); }
+
+    //The block with these contents, preferably @p preferred, or -1
+    int find(quint32 rolling, const char* data, int preferred) const;
+
+private:
+    int m_blockSize;
+    QMultiHash<quint32, int> m_rolling;
+    QVector<QByteArray> m_strong;
+};
+
+/*
+ * Encodes a file against the signatures of an older copy, reading it as the
+ * stream is read. Its size isn't known beforehand, it's done once atEnd().
+ */
+class KDECONNECTCORE_EXPORT DeltaEncoder
+    : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    DeltaEncoder(const QSharedPointer<QIODevice>& source, const DeltaSignatures& signatures, QObject* parent = nullptr);
+
+    bool isSequential() const override { return true; }
+    bool atEnd() const override;
+    qint64 bytesAvailable() const override;
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+
+private:
+    void encodeSome();
+    void fill();
+    void flushLiteral(int end);
+    void flushCopy();
+
+    QSharedPointer<QIODevice> m_source;
+    const DeltaSignatures m_signatures;
+    QByteArray m_input;
+    int m_position; //Start of the window in m_input
+    int m_literalStart; //Bytes from here to m_position matched no block
+    bool m_sourceDone;
+    bool m_rolling;
+    quint32 m_a;
+    quint32 m_b;
+    int m_copyStart;
+    int m_copyCount;
+    QByteArray m_output;
+    int m_outputPosition;
+    bool m_finished;
+};
+
+/*
+ * Rebuilds a file from what a DeltaEncoder sent and the older copy its
+ * signatures were computed from. Reads like the new file itself.
+ */
+class KDECONNECTCORE_EXPORT DeltaDecoder
+    : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    DeltaDecoder(const QSharedPointer<QIODevice>& delta, const QString& basePath, int blockSize, QObject* parent = nullptr);
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override { return true; }
+    bool atEnd() const override;
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 maxSize) override;
+
+private:
+    bool parseCommand();
+    bool ensureInput(int size);
+    void fail(const QString& error);
+
+    QSharedPointer<QIODevice> m_delta;
+    QFile m_base;
+    const int m_blockSize;
+    QByteArray m_input;
+    int m_inputPosition;
+    qint64 m_literalLeft;
+    qint64 m_copyPosition;
+    qint64 m_copyLeft;
+    bool m_deltaDone;
+};
+
+#endif
@@ -21,6 +21,8 @@
 #include "device.h"
 
 #include <QDBusConnection>
+#include <QElapsedTimer>
+#include <QQueue>
 #include <QVector>
 #include <QSet>
 #include <QSslCertificate>
@@ -32,10 +34,12 @@
 #include "core_debug.h"
 #include "kdeconnectplugin.h"
 #include "pluginloader.h"
+#include "backends/bandwidthlimiter.h"
 #include "backends/devicelink.h"
 #include "backends/lan/landevicelink.h"
 #include "backends/linkprovider.h"
 #include "networkpacket.h"
+#include "packettyperegistry.h"
 #include "kdeconnectconfig.h"
 #include "daemon.h"
 
@@ -48,7 +52,9 @@ public:
     DevicePrivate(const QString &id)
         : m_deviceId(id)
     {
-
+        if (BandwidthLimiter* limiter = BandwidthLimiter::instance()) {
+            limiter->setDeviceRate(id, KdeConnectConfig::instance()->payloadRateLimit(id));
+        }
     }
 
     ~DevicePrivate()
@@ -65,11 +71,34 @@ public:
     QVector<DeviceLink *> m_deviceLinks;
     QHash<QString, KdeConnectPlugin *> m_plugins;
 
-    QMultiMap<QString, KdeConnectPlugin *> m_pluginsByIncomingCapability;
+    //Indexed by PacketTypeRegistry id
+    QVector<QVector<KdeConnectPlugin *>> m_pluginsByIncomingType;
     QSet<QString> m_supportedPlugins;
     QSet<PairingHandler *> m_pairRequests;
+
+    //What was received but not handed to the plugins yet, in order
+    struct PendingDelivery {
+        NetworkPacket packet;
+        QVariantList elements;
+        bool isElements; //Elements of a streamed array of packet, see receivePacketElements()
+    };
+    QQueue<PendingDelivery> m_pendingDeliveries;
 };
 
+//How long received packets may be handed to plugins before yielding to the event loop, in ms
+static const int s_deliveryTimeBudget = 10;
+
+static void addIncomingTypes(QVector<QVector<KdeConnectPlugin*>>* pluginsByIncomingType, KdeConnectPlugin* plugin, const QSet<QString>& incomingCapabilities)
+{
+    for (const QString& interface : incomingCapabilities) {
+        const int typeId = PacketTypeRegistry::intern(interface);
+        if (typeId >= pluginsByIncomingType->size()) {
+            pluginsByIncomingType->resize(typeId + 1);
+        }
+        (*pluginsByIncomingType)[typeId].append(plugin);
+    }
+}
+
 static void warn(const QString& info)
 {
     qWarning() << "Device pairing error" << info;
@@ -112,6 +141,31 @@ Device::~Device()
     delete d;
 }
 
+qint64 Device::payloadRateLimit() const
+{
+    BandwidthLimiter* limiter = BandwidthLimiter::instance();
+    return limiter ? limiter->deviceRate(d->m_deviceId) : KdeConnectConfig::instance()->payloadRateLimit(d->m_deviceId);
+}
+
+qint64 Device::payloadRate() const
+{
+    BandwidthLimiter* limiter = BandwidthLimiter::instance();
+    return limiter ? limiter->currentRate(d->m_deviceId) : 0;
+}
+
+void Device::setPayloadRateLimit(qint64 rate)
+{
+    rate = qMax<qint64>(0, rate);
+    if (rate == payloadRateLimit()) {
+        return;
+    }
+    KdeConnectConfig::instance()->setPayloadRateLimit(rate, d->m_deviceId);
+    if (BandwidthLimiter* limiter = BandwidthLimiter::instance()) {
+        limiter->setDeviceRate(d->m_deviceId, rate);
+    }
+    Q_EMIT payloadRateLimitChanged(rate);
+}
+
 QString Device::id() const
 {
     return d->m_deviceId;
@@ -155,7 +209,7 @@ QStringList Device::loadedPlugins() const
 void Device::reloadPlugins()
 {
     QHash<QString, KdeConnectPlugin*> newPluginMap, oldPluginMap = d->m_plugins;
-    QMultiMap<QString, KdeConnectPlugin*> newPluginsByIncomingCapability;
+    QVector<QVector<KdeConnectPlugin*>> newPluginsByIncomingType;
 
     if (isTrusted() && isReachable()) { //Do not load any plugin for unpaired devices, nor useless loading them for unreachable devices
 
@@ -175,9 +229,7 @@ void Device::reloadPlugins()
                 }
                 Q_ASSERT(plugin);
 
-                for (const QString& interface : incomingCapabilities) {
-                    newPluginsByIncomingCapability.insert(interface, plugin);
-                }
+                addIncomingTypes(&newPluginsByIncomingType, plugin, incomingCapabilities);
 
                 newPluginMap[pluginName] = plugin;
             }
@@ -190,7 +242,7 @@ void Device::reloadPlugins()
     //them anymore, otherwise they would have been moved to the newPluginMap)
     qDeleteAll(d->m_plugins);
     d->m_plugins = newPluginMap;
-    d->m_pluginsByIncomingCapability = newPluginsByIncomingCapability;
+    d->m_pluginsByIncomingType = newPluginsByIncomingType;
 
     QDBusConnection bus = QDBusConnection::sessionBus();
     for (KdeConnectPlugin* plugin : qAsConst(d->m_plugins)) {
@@ -290,6 +342,10 @@ void Device::addLink(const NetworkPacket& identityPacket, DeviceLink* link)
 
     connect(link, &DeviceLink::receivedPacket,
             this, &Device::privateReceivedPacket);
+    connect(link, &DeviceLink::receivedPackets,
+            this, &Device::privateReceivedPackets);
+    connect(link, &DeviceLink::receivedPacketElements,
+            this, &Device::privateReceivedPacketElements);
 
     std::sort(d->m_deviceLinks.begin(), d->m_deviceLinks.end(), lessThan);
 
@@ -391,11 +447,75 @@ bool Device::sendPacket(NetworkPacket& np)
     return false;
 }
 
+void Device::privateReceivedPackets(const QVector<NetworkPacket>& packets)
+{
+    for (const NetworkPacket& np : packets) {
+        Q_ASSERT(np.type() != PACKET_TYPE_PAIR);
+        d->m_pendingDeliveries.enqueue({ np, QVariantList(), false });
+    }
+    deliverPendingPackets();
+}
+
+void Device::privateReceivedPacketElements(const NetworkPacket& header, const QVariantList& elements)
+{
+    //Must not overtake the packets that came before
+    if (!d->m_pendingDeliveries.isEmpty()) {
+        d->m_pendingDeliveries.enqueue({ header, elements, true });
+        return;
+    }
+    deliverPacketElements(header, elements);
+}
+
 void Device::privateReceivedPacket(const NetworkPacket& np)
 {
     Q_ASSERT(np.type() != PACKET_TYPE_PAIR);
+    if (!d->m_pendingDeliveries.isEmpty()) {
+        d->m_pendingDeliveries.enqueue({ np, QVariantList(), false });
+        return;
+    }
+    deliverPacket(np);
+}
+
+void Device::deliverPendingPackets()
+{
+    //Plugins can take their time with each packet, a big batch must not starve the GUI either
+    QElapsedTimer timer;
+    timer.start();
+
+    while (!d->m_pendingDeliveries.isEmpty()) {
+        if (timer.elapsed() >= s_deliveryTimeBudget) {
+            QMetaObject::invokeMethod(this, "deliverPendingPackets", Qt::QueuedConnection);
+            return;
+        }
+
+        //Dequeued first, a plugin may spin an event loop and get here again
+        const DevicePrivate::PendingDelivery delivery = d->m_pendingDeliveries.dequeue();
+        if (delivery.isElements) {
+            deliverPacketElements(delivery.packet, delivery.elements);
+        } else {
+            deliverPacket(delivery.packet);
+        }
+    }
+}
+
+void Device::deliverPacketElements(const NetworkPacket& header, const QVariantList& elements)
+{
+    //Untrusted devices get unpaired when the rest of the packet arrives
+    if (!isTrusted()) {
+        return;
+    }
+
+    const QVector<KdeConnectPlugin*> plugins = d->m_pluginsByIncomingType.value(header.typeId());
+    for (KdeConnectPlugin* plugin : plugins) {
+        plugin->receivePacketElements(header, elements);
+    }
+}
+
+void Device::deliverPacket(const NetworkPacket& np)
+{
     if (isTrusted()) {
-        const QList<KdeConnectPlugin*> plugins = d->m_pluginsByIncomingCapability.values(np.type());
+        //Shares the vector, so a plugin reloading plugins from receivePacket can't invalidate it
+        const QVector<KdeConnectPlugin*> plugins = d->m_pluginsByIncomingType.value(np.typeId());
         if (plugins.isEmpty()) {
             qWarning() << "discarding unsupported packet" << np.type() << "for" << name();
         }
@@ -424,6 +544,15 @@ QStringList Device::availableLinks() const
     return sl;
 }
 
+QVariantMap Device::linkStatistics() const
+{
+    QVariantMap statistics;
+    for (DeviceLink* dl : qAsConst(d->m_deviceLinks)) {
+        statistics[dl->provider()->name()] = dl->statistics();
+    }
+    return statistics;
+}
+
 void Device::cleanUnneededLinks() {
     if (isTrusted()) {
         return;
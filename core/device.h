@@ -44,6 +44,8 @@ class KDECONNECTCORE_EXPORT Device
     Q_PROPERTY(bool isTrusted READ isTrusted NOTIFY trustedChanged)
     Q_PROPERTY(QStringList supportedPlugins READ supportedPlugins NOTIFY pluginsChanged)
     Q_PROPERTY(bool hasPairingRequests READ hasPairingRequests NOTIFY hasPairingRequestsChanged)
+    Q_PROPERTY(qint64 payloadRateLimit READ payloadRateLimit NOTIFY payloadRateLimitChanged)
+    Q_PROPERTY(qint64 payloadRate READ payloadRate)
 
 public:
 
@@ -87,6 +89,8 @@ public:
     Q_SCRIPTABLE bool isTrusted() const;
 
     Q_SCRIPTABLE QStringList availableLinks() const;
+    //Counters of every link, by link provider name, see DeviceLink::statistics()
+    Q_SCRIPTABLE QVariantMap linkStatistics() const;
     bool isReachable() const;
 
     Q_SCRIPTABLE QStringList loadedPlugins() const;
@@ -121,8 +125,18 @@ public Q_SLOTS:
     Q_SCRIPTABLE bool hasPairingRequests() const;
 
     Q_SCRIPTABLE QString pluginIconName(const QString& pluginName);
+
+    //Bytes per second payloads to this device may use, 0 for unlimited, see BandwidthLimiter
+    Q_SCRIPTABLE qint64 payloadRateLimit() const;
+    Q_SCRIPTABLE void setPayloadRateLimit(qint64 rate);
+    //Bytes per second payloads were sent to this device at lately. It changes with every
+    //chunk written, so there is no signal for it: poll it while a transfer is running
+    Q_SCRIPTABLE qint64 payloadRate() const;
 private Q_SLOTS:
     void privateReceivedPacket(const NetworkPacket& np);
+    void privateReceivedPackets(const QVector<NetworkPacket>& packets);
+    void privateReceivedPacketElements(const NetworkPacket& header, const QVariantList& elements);
+    void deliverPendingPackets();
     void linkDestroyed(QObject* o);
     void pairStatusChanged(DeviceLink::PairStatus current);
     void addPairingRequest(PairingHandler* handler);
@@ -136,12 +150,15 @@ Q_SIGNALS:
     Q_SCRIPTABLE void nameChanged(const QString& name);
 
     Q_SCRIPTABLE void hasPairingRequestsChanged(bool hasPairingRequests);
+    Q_SCRIPTABLE void payloadRateLimitChanged(qint64 rate);
 
 private: //Methods
     static DeviceType str2type(const QString& deviceType);
     static QString type2str(DeviceType deviceType);
 
     void setName(const QString& name);
+    void deliverPacket(const NetworkPacket& np);
+    void deliverPacketElements(const NetworkPacket& header, const QVariantList& elements);
     QString iconForStatus(bool reachable, bool paired) const;
 
 private:
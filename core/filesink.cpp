@@ -0,0 +1,324 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "filesink.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QThread>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#endif
+
+//Writes go to disk in blocks of this size, aligned to it within the file
+static const qint64 BlockSize = 1024 * 1024;
+
+namespace {
+class FileSinkThread : public QThread
+{
+public:
+    FileSinkThread()
+    {
+        setObjectName(QStringLiteral("FileSink"));
+        start();
+    }
+
+    ~FileSinkThread() override
+    {
+        quit();
+        wait();
+    }
+};
+}
+
+Q_GLOBAL_STATIC(FileSinkThread, s_sinkThread)
+
+class FileSinkWriter
+    : public QObject
+{
+    Q_OBJECT
+
+public:
+    FileSinkWriter(const QString& path, FileSink::Mode mode, qint64 offset, qint64 size, bool reserved)
+        : m_path(path)
+        , m_mode(mode)
+        , m_offset(offset)
+        , m_size(size)
+        , m_reserved(reserved)
+        , m_file(nullptr)
+        , m_position(0)
+        , m_closed(false)
+    {
+    }
+
+    ~FileSinkWriter() override
+    {
+        //An uncommitted QSaveFile removes its temporary file
+        delete m_file;
+        releaseName();
+    }
+
+public Q_SLOTS:
+    void open();
+    void write(const QByteArray& data);
+    void writeAt(qint64 position, const QByteArray& data);
+    void close(bool commit, qint64 keepSize);
+
+Q_SIGNALS:
+    void bytesWritten(qint64 bytes);
+    void done(const QString& errorString);
+
+private:
+    void preallocate();
+    bool flushBlocks(bool all);
+    void fail(const QString& errorString);
+    void releaseName();
+
+    const QString m_path;
+    const FileSink::Mode m_mode;
+    const qint64 m_offset;
+    const qint64 m_size;
+    bool m_reserved; //The empty file a Replace sink holds the name with, until it is replaced or removed
+    QFileDevice* m_file;
+    QByteArray m_block;
+    qint64 m_position;
+    bool m_closed;
+};
+
+void FileSinkWriter::open()
+{
+    //Unbuffered, the blocks we write are large enough already
+    if (m_mode == FileSink::Replace) {
+        if (!m_reserved) {
+            fail(QStringLiteral("%1 already exists").arg(m_path));
+            return;
+        }
+        m_file = new QSaveFile(m_path);
+        if (!m_file->open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
+            fail(m_file->errorString());
+            return;
+        }
+    } else {
+        QFile* file = new QFile(m_path);
+        m_file = file;
+        if (!file->open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+            fail(file->errorString());
+            return;
+        }
+        if (file->size() < m_offset || !file->resize(m_offset) || !file->seek(m_offset)) {
+            fail(QStringLiteral("Can't append to %1 at %2").arg(m_path).arg(m_offset));
+            return;
+        }
+        m_position = m_offset;
+    }
+    preallocate();
+}
+
+void FileSinkWriter::preallocate()
+{
+#if defined(Q_OS_LINUX) && defined(FALLOC_FL_KEEP_SIZE)
+    //Reserving the space up front keeps the file in one piece and reports a full disk
+    //right away. The size is left alone, so a partial file still tells how much arrived
+    if (m_size > 0 && fallocate(m_file->handle(), FALLOC_FL_KEEP_SIZE, m_position, m_size) != 0 && errno == ENOSPC) {
+        fail(QString::fromLocal8Bit(strerror(errno)));
+    }
+#endif
+}
+
+void FileSinkWriter::write(const QByteArray& data)
+{
+    if (m_closed) {
+        return;
+    }
+    m_block.append(data);
+    flushBlocks(false);
+}
+
+void FileSinkWriter::writeAt(qint64 position, const QByteArray& data)
+{
+    if (m_closed) {
+        return;
+    }
+
+    const qint64 start = (m_mode == FileSink::Append ? m_offset : 0) + position;
+#ifdef Q_OS_UNIX
+    //No seeking back and forth between the pieces
+    qint64 written = 0;
+    while (written < data.size()) {
+        const ssize_t size = pwrite(m_file->handle(), data.constData() + written, data.size() - written, start + written);
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size <= 0) {
+            fail(QString::fromLocal8Bit(strerror(errno)));
+            return;
+        }
+        written += size;
+    }
+#else
+    if (!m_file->seek(start) || m_file->write(data) != data.size()) {
+        fail(m_file->errorString());
+        return;
+    }
+#endif
+    Q_EMIT bytesWritten(data.size());
+}
+
+bool FileSinkWriter::flushBlocks(bool all)
+{
+    while (!m_block.isEmpty()) {
+        //Stay aligned to the blocks of the file, whatever offset we started at
+        const qint64 blockRemaining = BlockSize - m_position % BlockSize;
+        if (!all && m_block.size() < blockRemaining) {
+            return true;
+        }
+
+        const qint64 size = qMin<qint64>(m_block.size(), blockRemaining);
+        if (m_file->write(m_block.constData(), size) != size) {
+            fail(m_file->errorString());
+            return false;
+        }
+        m_block.remove(0, size);
+        m_position += size;
+        Q_EMIT bytesWritten(size);
+    }
+    return true;
+}
+
+void FileSinkWriter::close(bool commit, qint64 keepSize)
+{
+    if (m_closed) {
+        return;
+    }
+
+    //What an Append sink got is worth keeping even when aborted
+    if ((commit || m_mode == FileSink::Append) && !flushBlocks(true)) {
+        return;
+    }
+
+    QString errorString;
+    if (m_mode == FileSink::Replace) {
+        QSaveFile* file = static_cast<QSaveFile*>(m_file);
+        if (commit && file->commit()) {
+            m_reserved = false; //Replaced
+        } else {
+            if (commit) {
+                errorString = file->errorString();
+            }
+            releaseName();
+        }
+    } else {
+        if (!commit && keepSize >= 0 && keepSize < m_file->size()) {
+            m_file->resize(keepSize);
+        }
+        m_file->close();
+    }
+    delete m_file;
+    m_file = nullptr;
+    m_closed = true;
+    Q_EMIT done(errorString);
+}
+
+void FileSinkWriter::fail(const QString& errorString)
+{
+    m_closed = true;
+    m_block.clear();
+    delete m_file;
+    m_file = nullptr;
+    releaseName();
+    Q_EMIT done(errorString.isEmpty() ? QStringLiteral("Unknown error writing %1").arg(m_path) : errorString);
+}
+
+void FileSinkWriter::releaseName()
+{
+    if (m_mode == FileSink::Replace && m_reserved) {
+        QFile::remove(m_path);
+        m_reserved = false;
+    }
+}
+
+//Creates an empty file under @p path, unless there is one already. QSaveFile only
+//takes the name when it commits, two sinks could otherwise overwrite each other
+static bool reserveName(const QString& path)
+{
+#ifdef Q_OS_UNIX
+    const int fd = ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return false;
+    }
+    ::close(fd);
+    return true;
+#else
+    QFile file(path);
+    return !file.exists() && file.open(QIODevice::WriteOnly);
+#endif
+}
+
+FileSink::FileSink(const QString& path, Mode mode, qint64 offset, qint64 size, QObject* parent)
+    : QObject(parent)
+    , m_writer(new FileSinkWriter(path, mode, offset, size, mode == Replace && reserveName(path)))
+    , m_pending(0)
+{
+    m_writer->moveToThread(s_sinkThread());
+    connect(m_writer, &FileSinkWriter::bytesWritten, this, &FileSink::writerWrote);
+    connect(m_writer, &FileSinkWriter::done, this, &FileSink::done);
+    QMetaObject::invokeMethod(m_writer, "open", Qt::QueuedConnection);
+}
+
+FileSink::~FileSink()
+{
+    //Runs after whatever was queued to the writer before
+    m_writer->deleteLater();
+}
+
+void FileSink::write(const QByteArray& data)
+{
+    m_pending += data.size();
+    QMetaObject::invokeMethod(m_writer, "write", Qt::QueuedConnection, Q_ARG(QByteArray, data));
+}
+
+void FileSink::writeAt(qint64 position, const QByteArray& data)
+{
+    m_pending += data.size();
+    QMetaObject::invokeMethod(m_writer, "writeAt", Qt::QueuedConnection, Q_ARG(qint64, position), Q_ARG(QByteArray, data));
+}
+
+void FileSink::finish()
+{
+    QMetaObject::invokeMethod(m_writer, "close", Qt::QueuedConnection, Q_ARG(bool, true), Q_ARG(qint64, -1));
+}
+
+void FileSink::abort(qint64 keepSize)
+{
+    QMetaObject::invokeMethod(m_writer, "close", Qt::QueuedConnection, Q_ARG(bool, false), Q_ARG(qint64, keepSize));
+}
+
+void FileSink::writerWrote(qint64 bytes)
+{
+    m_pending -= bytes;
+    Q_EMIT bytesWritten(bytes);
+}
+
+#include "filesink.moc"
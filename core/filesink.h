@@ -0,0 +1,91 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FILESINK_H
+#define FILESINK_H
+
+#include <QObject>
+#include <QString>
+
+#include "kdeconnectcore_export.h"
+
+class FileSinkWriter;
+
+/**
+ * @short Writes a received payload straight to a local file, off the main thread
+ *
+ * Data passed to write() is queued to a worker thread shared by all sinks, which
+ * stores it in large blocks aligned to the file offset. When the size is known
+ * the file is preallocated up front. A Replace sink creates an empty file under
+ * its name right away, fails if there is one already, writes under a temporary
+ * name and renames that over it when finished; an Append sink extends a partial
+ * file and keeps whatever it got when aborted.
+ */
+class KDECONNECTCORE_EXPORT FileSink
+    : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Mode {
+        Replace,
+        Append
+    };
+
+    /**
+     * @p offset is where an Append sink starts writing, anything after it is dropped.
+     * @p size is the number of bytes that will be written, or -1 if unknown.
+     */
+    FileSink(const QString& path, Mode mode, qint64 offset, qint64 size, QObject* parent = nullptr);
+    ~FileSink() override;
+
+    void write(const QByteArray& data);
+    ///Writes @p data @p position bytes after where the sink started, instead of after the last write
+    void writeAt(qint64 position, const QByteArray& data);
+    ///Flushes everything and, for Replace sinks, renames the file into place
+    void finish();
+    /**
+     * Flushes what an Append sink got, cut to @p keepSize bytes if given, e.g. when
+     * it was written out of order. A Replace sink leaves nothing behind, not even
+     * the empty file it held the name with.
+     */
+    void abort(qint64 keepSize = -1);
+
+    ///Bytes handed to write() that are not on disk yet
+    qint64 pendingBytes() const { return m_pending; }
+
+Q_SIGNALS:
+    void bytesWritten(qint64 bytes);
+    /**
+     * Emitted once after finish() or abort(), or as soon as writing fails,
+     * with an empty @p errorString on success.
+     */
+    void done(const QString& errorString);
+
+private Q_SLOTS:
+    void writerWrote(qint64 bytes);
+
+private:
+    FileSinkWriter* m_writer;
+    qint64 m_pending;
+};
+
+#endif
@@ -21,23 +21,46 @@
 
 #include "filetransferjob.h"
 #include "daemon.h"
+#include "filesink.h"
+#include "deltatransfer.h"
+#include "hashingfile.h"
+#include "backends/stripedpayload.h"
 #include <core_debug.h>
 
 #include <qalgorithms.h>
 #include <QFileInfo>
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
 #include <QDebug>
+#include <QTimer>
 
 #include <KLocalizedString>
 
+//How long to wait for the sender's digest once all the data arrived
+static const int DigestTimeout = 10000;
+//Received data waiting for the disk is capped at this, the rest stays in the socket
+static const qint64 MaxPendingBytes = 8 * 1024 * 1024;
+static const qint64 ReadChunkSize = 256 * 1024;
+
 FileTransferJob::FileTransferJob(const QSharedPointer<QIODevice>& origin, qint64 size, const QUrl& destination)
     : KJob()
     , m_origin(origin)
     , m_reply(Q_NULLPTR)
+    , m_sink(Q_NULLPTR)
+    , m_striped(Q_NULLPTR)
     , m_from(QStringLiteral("KDE Connect"))
     , m_destination(destination)
     , m_speedBytes(0)
     , m_written(0)
     , m_size(size)
+    , m_offset(0)
+    , m_resumable(false)
+    , m_verifyDigest(false)
+    , m_received(false)
+    , m_originClosed(false)
+    , m_sinkClosing(false)
+    , m_incomplete(false)
+    , m_hash(QCryptographicHash::Sha256)
 {
     Q_ASSERT(m_origin);
     //Disabled this assert: QBluetoothSocket doesn't report "->isReadable() == true" until it's connected
@@ -51,25 +74,60 @@ FileTransferJob::FileTransferJob(const QSharedPointer<QIODevice>& origin, qint64
     qCDebug(KDECONNECT_CORE) << "FileTransferJob Downloading payload to" << destination << "size:" << size;
 }
 
+void FileTransferJob::setResumeOffset(qint64 offset)
+{
+    Q_ASSERT(m_destination.isLocalFile());
+    m_offset = offset;
+    m_resumable = true;
+}
+
+bool FileTransferJob::setDeltaBase(const QString& basePath, int blockSize)
+{
+    Q_ASSERT(m_destination.isLocalFile());
+    QSharedPointer<DeltaDecoder> decoder(new DeltaDecoder(m_origin, basePath, blockSize));
+    if (!decoder->open(QIODevice::ReadOnly)) {
+        qCWarning(KDECONNECT_CORE) << "Can't rebuild a file from" << basePath << decoder->errorString();
+        return false;
+    }
+    //Everything after this reads the rebuilt file, digest included
+    m_origin = decoder;
+    return true;
+}
+
 void FileTransferJob::start()
 {
+    //The sink takes the name of a new local file right away, so a share received next doesn't pick it too
+    if (m_destination.isLocalFile() && (m_resumable || !QFile::exists(m_destination.toLocalFile()))) {
+        m_sink = new FileSink(m_destination.toLocalFile(), m_resumable ? FileSink::Append : FileSink::Replace, m_offset, m_size, this);
+        connect(m_sink, &FileSink::bytesWritten, this, &FileTransferJob::readLocal);
+        connect(m_sink, &FileSink::done, this, &FileTransferJob::sinkDone);
+    }
     QMetaObject::invokeMethod(this, "doStart", Qt::QueuedConnection);
     //qCDebug(KDECONNECT_CORE) << "FileTransferJob start";
 }
 
 void FileTransferJob::doStart()
 {
+    if (error()) {
+        return; //The sink failed already
+    }
+
     description(this, i18n("Receiving file over KDE Connect"),
         { i18nc("File transfer origin", "From"), m_from }
     );
 
-    if (m_destination.isLocalFile() && QFile::exists(m_destination.toLocalFile())) {
+    if (m_destination.isLocalFile() && !m_sink) {
         setError(2);
         setErrorText(i18n("Filename already present"));
         emitResult();
         return;
     }
 
+    if (m_destination.isLocalFile()) {
+        startLocalTransfer();
+        return;
+    }
+
     if (m_origin->bytesAvailable())
         startTransfer();
     connect(m_origin.data(), &QIODevice::readyRead, this, &FileTransferJob::startTransfer);
@@ -122,7 +180,7 @@ void FileTransferJob::transferFailed(QNetworkReply::NetworkError error)
 
 void FileTransferJob::transferFinished()
 {
-    //TODO: MD5-check the file
+    //Remote destinations see the data only through QNAM, so there is no digest to verify
     if (m_size == m_written) {
         qCDebug(KDECONNECT_CORE) << "Finished transfer" << m_destination;
 
@@ -140,8 +198,198 @@ void FileTransferJob::transferFinished()
     }
 }
 
+void FileTransferJob::startLocalTransfer()
+{
+    //Written from here rather than through QNetworkAccessManager, which in the daemon is
+    //KIO's and would ship every byte to a worker process first
+    description(this, i18n("Receiving file over KDE Connect"),
+                        { i18nc("File transfer origin", "From"), m_from },
+                        { i18nc("File transfer destination", "To"), m_destination.toLocalFile() });
+    if (m_size >= 0) {
+        setTotalAmount(Bytes, m_offset + m_size);
+    }
+    setProcessedAmount(Bytes, m_offset);
+
+    m_striped = qobject_cast<StripedPayload*>(m_origin.data());
+    if (m_striped) {
+        connect(m_striped, &StripedPayload::stripeReadyRead, this, &FileTransferJob::readLocal);
+    } else {
+        connect(m_origin.data(), &QIODevice::readyRead, this, &FileTransferJob::readLocal);
+    }
+    connect(m_origin.data(), &QIODevice::readChannelFinished, this, &FileTransferJob::originClosed);
+    connect(m_origin.data(), &QIODevice::aboutToClose, this, &FileTransferJob::originClosed);
+    readLocal();
+}
+
+void FileTransferJob::readLocal()
+{
+    if (!m_sink || m_sinkClosing) {
+        return;
+    }
+
+    //Stop reading while the disk is behind, a LAN payload socket buffers a few MB more and the sender waits
+    bool starved = false;
+    while (!m_striped && (m_size < 0 || m_written < m_size)) {
+        if (m_sink->pendingBytes() >= MaxPendingBytes) {
+            break;
+        }
+        const QByteArray chunk = m_origin->isOpen() ? m_origin->read(m_size < 0 ? ReadChunkSize : qMin(ReadChunkSize, m_size - m_written)) : QByteArray();
+        if (chunk.isEmpty()) {
+            starved = true;
+            break;
+        }
+        if (m_verifyDigest) {
+            m_hash.addData(chunk);
+        }
+        m_written += chunk.size();
+        m_sink->write(chunk);
+    }
+    if (m_striped) {
+        starved = readStripes();
+    }
+
+    if (!m_timer.isValid())
+        m_timer.start();
+    setProcessedAmount(Bytes, m_offset + m_written);
+    const auto elapsed = m_timer.elapsed();
+    if (elapsed > 0) {
+        emitSpeed((1000 * m_written) / elapsed);
+    }
+
+    const bool originDone = m_originClosed || !m_origin->isOpen() || (!m_origin->isSequential() && m_origin->atEnd());
+    if (m_written == m_size || (m_size < 0 && starved && originDone)) {
+        m_sinkClosing = true;
+        m_sink->finish();
+    } else if (starved && originDone) {
+        //Unlike a transfer through QNetworkAccessManager, a partial file keeps what we got
+        qCDebug(KDECONNECT_CORE) << "Received incomplete file" << m_destination << m_offset + m_written << "of" << m_offset + m_size;
+        m_incomplete = true;
+        m_sinkClosing = true;
+        //Stripes leave holes, only what arrived without a gap can be resumed from
+        m_sink->abort(m_striped ? m_offset + m_striped->contiguousBytes() : -1);
+    }
+}
+
+bool FileTransferJob::readStripes()
+{
+    //Every stripe is written where it belongs as soon as it arrives
+    bool progress = true;
+    while (progress) {
+        progress = false;
+        for (int i = 0; i < m_striped->stripeCount(); ++i) {
+            if (m_sink->pendingBytes() >= MaxPendingBytes) {
+                return false;
+            }
+            if (m_stripeChunk.isEmpty()) {
+                m_stripeChunk = QByteArray(ReadChunkSize, Qt::Uninitialized);
+            }
+            qint64 position;
+            const qint64 size = m_striped->readStripe(i, m_stripeChunk.data(), m_stripeChunk.size(), &position);
+            if (size <= 0) {
+                continue;
+            }
+            if (m_size >= 0 && position + size > m_size) {
+                //StripedPayload keeps stripes within the payload it was told about, this one is bigger
+                qCWarning(KDECONNECT_CORE) << "Stripe" << i << "of" << m_destination << "goes past" << m_size;
+                m_origin->close();
+                return true;
+            }
+            m_stripeChunk.resize(size);
+            m_written += size;
+            m_sink->writeAt(position, m_stripeChunk);
+            m_stripeChunk = QByteArray(); //Now owned by the sink
+            progress = true;
+        }
+    }
+    return true;
+}
+
+void FileTransferJob::originClosed()
+{
+    m_originClosed = true;
+    readLocal();
+}
+
+void FileTransferJob::sinkDone(const QString& errorString)
+{
+    m_sink->deleteLater();
+    m_sink = Q_NULLPTR;
+
+    if (!errorString.isEmpty()) {
+        qCWarning(KDECONNECT_CORE) << "Couldn't write" << m_destination << errorString;
+        m_origin->close();
+        setError(4);
+        setErrorText(i18n("Couldn't write %1: %2", m_destination.toLocalFile(), errorString));
+        emitResult();
+        return;
+    }
+
+    if (m_incomplete) {
+        setError(3);
+        setErrorText(i18n("Received incomplete file from: %1", m_from));
+        emitResult();
+        return;
+    }
+
+    qCDebug(KDECONNECT_CORE) << "Finished transfer" << m_destination;
+    if (m_striped && m_verifyDigest) {
+        //Stripes are written out of order, so the file is hashed once all of it is there
+        QFutureWatcher<QByteArray>* watcher = new QFutureWatcher<QByteArray>(this);
+        connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher]() {
+            watcher->deleteLater();
+            allReceived(watcher->result());
+        });
+        watcher->setFuture(QtConcurrent::run(&HashingFile::hashFile, m_destination.toLocalFile(), m_offset));
+        return;
+    }
+    allReceived(m_verifyDigest ? m_hash.result() : QByteArray());
+}
+
+void FileTransferJob::allReceived(const QByteArray& hashed)
+{
+    m_hashed = hashed;
+    m_received = true;
+    if (!m_verifyDigest) {
+        emitResult();
+    } else if (!m_digest.isEmpty()) {
+        verifyDigest();
+    } else {
+        //The digest follows the data, give it some time to arrive
+        QTimer::singleShot(DigestTimeout, this, &FileTransferJob::verifyDigest);
+    }
+}
+
+void FileTransferJob::setDigest(const QByteArray& digest)
+{
+    m_digest = digest;
+    verifyDigest();
+}
+
+void FileTransferJob::verifyDigest()
+{
+    if (!m_received || !m_verifyDigest) {
+        return;
+    }
+    m_verifyDigest = false;
+
+    if (m_digest.isEmpty()) {
+        qCWarning(KDECONNECT_CORE) << "No digest arrived for" << m_destination << ", it can't be verified";
+    } else if (m_digest != m_hashed) {
+        qCWarning(KDECONNECT_CORE) << "Digest mismatch for" << m_destination;
+        setError(DigestMismatchError);
+        setErrorText(i18n("Received corrupted file from: %1", m_from));
+    }
+    emitResult();
+}
+
 bool FileTransferJob::doKill()
 {
+    if (m_sink) {
+        //Keeps what a partial file got so far, anything else is discarded
+        m_sink->abort();
+        delete m_sink;
+        m_sink = Q_NULLPTR;
+    }
     if (m_reply) {
         m_reply->close();
     }
@@ -24,6 +24,7 @@
 
 #include <KJob>
 
+#include <QCryptographicHash>
 #include <QElapsedTimer>
 #include <QIODevice>
 #include <QSharedPointer>
@@ -32,11 +33,14 @@
 
 #include "kdeconnectcore_export.h"
 
+class FileSink;
+class StripedPayload;
+
 /**
  * @short It will stream a device into a url destination
  *
- * Given a QIODevice, the file transfer job will use the system's QNetworkAccessManager
- * for putting the stream into the requested location.
+ * Given a QIODevice, the file transfer job writes local destinations through a FileSink,
+ * and uses the system's QNetworkAccessManager for putting the stream anywhere else.
  */
 class KDECONNECTCORE_EXPORT FileTransferJob
     : public KJob
@@ -44,6 +48,11 @@ class KDECONNECTCORE_EXPORT FileTransferJob
     Q_OBJECT
 
 public:
+    enum {
+        //Past the codes of QNetworkReply::NetworkError, which end up in error() too
+        DigestMismatchError = KJob::UserDefinedError + 1
+    };
+
     /**
      * @p origin specifies the data to read from.
      * @p size specifies the expected size of the stream we're reading.
@@ -54,8 +63,36 @@ public:
     QUrl destination() const { return m_destination; }
     void setOriginName(const QString& from) { m_from = from; }
 
+    /**
+     * Treats the local destination as a partial file that already holds the first
+     * @p offset bytes; the stream is appended after them and whatever arrives is
+     * kept if the transfer is interrupted, so it can be resumed later on.
+     */
+    void setResumeOffset(qint64 offset);
+    qint64 resumeOffset() const { return m_offset; }
+
+    /**
+     * Hashes what is received on the way to the local file, or the whole file once
+     * a striped payload is written, and only finishes once the SHA-256 the sender
+     * computed (see setDigest) matches.
+     */
+    void setVerifyDigest(bool verify) { m_verifyDigest = verify; }
+    void setDigest(const QByteArray& digest);
+    /**
+     * Takes what arrives as a delta against @p basePath (see DeltaEncoder) and
+     * writes the file it rebuilds. The size is the one of the rebuilt file.
+     */
+    bool setDeltaBase(const QString& basePath, int blockSize);
+
+    ///What the data matched once the job finished without error, empty if it wasn't verified
+    QByteArray digest() const { return m_digest; }
+
 private Q_SLOTS:
     void doStart();
+    void readLocal();
+    void originClosed();
+    void sinkDone(const QString& errorString);
+    void verifyDigest();
 
 protected:
     bool doKill() override;
@@ -64,15 +101,31 @@ private:
     void startTransfer();
     void transferFailed(QNetworkReply::NetworkError error);
     void transferFinished();
+    void startLocalTransfer();
+    bool readStripes();
+    void allReceived(const QByteArray& hashed);
 
     QSharedPointer<QIODevice> m_origin;
     QNetworkReply* m_reply;
+    FileSink* m_sink;
+    StripedPayload* m_striped; //Set if the origin is one
+    QByteArray m_stripeChunk;
     QString m_from;
     QUrl m_destination;
     QElapsedTimer m_timer;
     qulonglong m_speedBytes;
     qint64 m_written;
     qint64 m_size;
+    qint64 m_offset;
+    bool m_resumable;
+    bool m_verifyDigest;
+    bool m_received;
+    bool m_originClosed;
+    bool m_sinkClosing;
+    bool m_incomplete;
+    QCryptographicHash m_hash;
+    QByteArray m_hashed; //What m_hash came to, or the striped file was hashed to once complete
+    QByteArray m_digest;
 };
 
 #endif
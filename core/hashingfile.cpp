@@ -0,0 +1,90 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hashingfile.h"
+
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
+
+HashingFile::HashingFile(const QString& path)
+    : QFile(path)
+    , m_hash(QCryptographicHash::Sha256)
+    , m_remaining(0)
+    , m_done(false)
+{
+}
+
+bool HashingFile::openAt(qint64 offset)
+{
+    //Unbuffered, so every byte handed out went through readData exactly once
+    if (!open(QIODevice::ReadOnly | QIODevice::Unbuffered) || offset < 0 || offset > size() || !seek(offset)) {
+        return false;
+    }
+    m_remaining = size() - offset;
+    return true;
+}
+
+qint64 HashingFile::readData(char* data, qint64 maxSize)
+{
+    const qint64 size = QFile::readData(data, maxSize);
+    if (size > 0) {
+        m_hash.addData(data, size);
+        m_remaining -= size;
+    }
+
+    //Readers stop either on atEnd() or on an empty read, so check for both
+    if (!m_done && size >= 0 && (size == 0 || m_remaining <= 0)) {
+        m_done = true;
+        Q_EMIT digestReady(m_hash.result());
+    }
+    return size;
+}
+
+void HashingFile::hashInBackground(const QSharedPointer<HashingFile>& file)
+{
+    if (file->m_done) {
+        return;
+    }
+    //Nothing read from here on is hashed, and the file isn't needed for it either
+    file->m_done = true;
+
+    QFutureWatcher<QByteArray>* watcher = new QFutureWatcher<QByteArray>;
+    connect(watcher, &QFutureWatcherBase::finished, watcher, [watcher, file]() {
+        const QByteArray digest = watcher->result();
+        if (!digest.isEmpty()) {
+            Q_EMIT file->digestReady(digest);
+        }
+        watcher->deleteLater();
+    });
+    watcher->setFuture(QtConcurrent::run(&HashingFile::hashFile, file->fileName(), file->size() - file->m_remaining));
+}
+
+QByteArray HashingFile::hashFile(const QString& path, qint64 offset)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(offset)) {
+        return QByteArray();
+    }
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!hash.addData(&file)) {
+        return QByteArray();
+    }
+    return hash.result();
+}
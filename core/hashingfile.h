@@ -0,0 +1,72 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HASHINGFILE_H
+#define HASHINGFILE_H
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QSharedPointer>
+
+#include "kdeconnectcore_export.h"
+
+/**
+ * @short A file payload that hashes its contents as the backend reads them
+ *
+ * Once everything from the opening offset to the end of the file went through
+ * read(), digestReady() hands out the SHA-256 of those bytes. The file is read
+ * only once, by whoever uploads it, and it still is a QFile to the backends.
+ */
+class KDECONNECTCORE_EXPORT HashingFile
+    : public QFile
+{
+    Q_OBJECT
+
+public:
+    explicit HashingFile(const QString& path);
+
+    /**
+     * Opens the file for reading, positioned at @p offset, so only the rest of
+     * it is sent and hashed.
+     */
+    bool openAt(qint64 offset);
+
+    /**
+     * For backends that send the file through handles of their own (see
+     * UploadJob::setStripes): hashes the rest of it on a worker thread instead,
+     * and keeps @p file alive until digestReady() was emitted.
+     */
+    static void hashInBackground(const QSharedPointer<HashingFile>& file);
+    ///The SHA-256 of @p path from @p offset to its end, empty if it can't be read
+    static QByteArray hashFile(const QString& path, qint64 offset);
+
+Q_SIGNALS:
+    void digestReady(const QByteArray& digest);
+
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+
+private:
+    QCryptographicHash m_hash;
+    qint64 m_remaining;
+    bool m_done;
+};
+
+#endif
@@ -158,6 +158,33 @@ void KdeConnectConfig::setName(const QString& name)
     d->m_config->sync();
 }
 
+int KdeConnectConfig::payloadStripes()
+{
+    return d->m_config->value(QStringLiteral("payloadStripes"), 1).toInt();
+}
+
+void KdeConnectConfig::setPayloadStripes(int stripes)
+{
+    d->m_config->setValue(QStringLiteral("payloadStripes"), stripes);
+    d->m_config->sync();
+}
+
+static QString payloadRateLimitKey(const QString& deviceId)
+{
+    return deviceId.isEmpty() ? QStringLiteral("payloadRateLimit") : QStringLiteral("payloadRateLimits/") + deviceId;
+}
+
+qint64 KdeConnectConfig::payloadRateLimit(const QString& deviceId)
+{
+    return qMax<qint64>(0, d->m_config->value(payloadRateLimitKey(deviceId), 0).toLongLong());
+}
+
+void KdeConnectConfig::setPayloadRateLimit(qint64 rate, const QString& deviceId)
+{
+    d->m_config->setValue(payloadRateLimitKey(deviceId), rate);
+    d->m_config->sync();
+}
+
 QString KdeConnectConfig::deviceType()
 {
     return QStringLiteral("desktop"); // TODO
@@ -58,6 +58,14 @@ public:
 
     void setName(const QString& name);
 
+    //How many connections a large payload may be split across, 1 unless configured. Backends clamp it
+    int payloadStripes();
+    void setPayloadStripes(int stripes);
+
+    //Bytes per second payloads may be sent at, 0 for unlimited, in total or to one device
+    qint64 payloadRateLimit(const QString& deviceId = QString());
+    void setPayloadRateLimit(qint64 rate, const QString& deviceId = QString());
+
     /*
      * Trusted devices
      */
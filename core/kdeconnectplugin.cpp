@@ -83,6 +83,12 @@ QString KdeConnectPlugin::dbusPath() const
     return {};
 }
 
+void KdeConnectPlugin::receivePacketElements(const NetworkPacket& header, const QVariantList& elements)
+{
+    Q_UNUSED(header);
+    Q_UNUSED(elements);
+}
+
 QString KdeConnectPlugin::iconName() const
 {
     return d->iconName;
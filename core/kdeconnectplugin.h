@@ -64,6 +64,13 @@ public Q_SLOTS:
      */
     virtual void connected() = 0;
 
+    /**
+     * Receives the elements of a body array registered with PacketTypeRegistry::setStreamedArray
+     * while the packet is still arriving. receivePacket() is called afterwards with the rest of
+     * the packet, without that array. header only has the id, type and body keys seen so far.
+     */
+    virtual void receivePacketElements(const NetworkPacket& header, const QVariantList& elements);
+
 private:
     QScopedPointer<KdeConnectPluginPrivate> d;
 
@@ -21,15 +21,28 @@
 #include "networkpacket.h"
 #include "core_debug.h"
 
-#include <QMetaObject>
-#include <QMetaProperty>
 #include <QByteArray>
 #include <QDataStream>
 #include <QDateTime>
-#include <QJsonDocument>
+#include <QJsonValue>
+#include <QLocale>
 #include <QDebug>
+#include <qnumeric.h>
 
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+#define KDECONNECT_CBOR_SUPPORT
+#include <QCborStreamReader>
+#include <QCborStreamWriter>
+#endif
+
+#include <cmath>
+#include <utility>
+
+#include "backends/packetcompressor.h"
+#include "backends/payloadmultiplexer.h"
+#include "backends/stripedpayload.h"
 #include "dbushelper.h"
+#include "packettyperegistry.h"
 #include "filetransferjob.h"
 #include "pluginloader.h"
 #include "kdeconnectconfig.h"
@@ -49,26 +62,19 @@ const int NetworkPacket::s_protocolVersion = 7;
 NetworkPacket::NetworkPacket(const QString& type, const QVariantMap& body)
     : m_id(QString::number(QDateTime::currentMSecsSinceEpoch()))
     , m_type(type)
+    , m_typeId(PacketTypeRegistry::lookup(type))
     , m_body(body)
     , m_payload()
     , m_payloadSize(0)
 {
 }
 
-NetworkPacket::NetworkPacket(const NetworkPacket& other)
-    : m_id(other.m_id)
-    , m_type(other.m_type)
-    , m_body(QVariantMap(other.m_body))
-    , m_payload(other.m_payload)
-    , m_payloadSize(other.m_payloadSize)
-{
-}
-
 void NetworkPacket::createIdentityPacket(NetworkPacket* np)
 {
     KdeConnectConfig* config = KdeConnectConfig::instance();
     np->m_id = QString::number(QDateTime::currentMSecsSinceEpoch());
     np->m_type = PACKET_TYPE_IDENTITY;
+    np->m_typeId = PacketTypeRegistry::IdentityType;
     np->m_payload = QSharedPointer<QIODevice>();
     np->m_payloadSize = 0;
     np->set(QStringLiteral("deviceId"), config->deviceId());
@@ -77,101 +83,1270 @@ void NetworkPacket::createIdentityPacket(NetworkPacket* np)
     np->set(QStringLiteral("protocolVersion"),  NetworkPacket::s_protocolVersion);
     np->set(QStringLiteral("incomingCapabilities"), PluginLoader::instance()->incomingCapabilities());
     np->set(QStringLiteral("outgoingCapabilities"), PluginLoader::instance()->outgoingCapabilities());
+    np->set(QStringLiteral("packetEncodings"), NetworkPacket::supportedEncodings());
+    np->set(QStringLiteral("packetCompression"), PacketCompressor::supportedMethods());
+    np->set(QStringLiteral("payloadStreams"), true);
+    np->set(QStringLiteral("payloadStripes"), StripedPayload::MaxStripes);
 
     //qCDebug(KDECONNECT_CORE) << "createIdentityPacket" << np->serialize();
 }
 
-template<class T>
-QVariantMap qobject2qvariant(const T* object)
+namespace {
+
+void appendUtf8(QByteArray* utf8, uint codePoint)
 {
-    QVariantMap map;
-    auto metaObject = T::staticMetaObject;
-    for(int i = metaObject.propertyOffset(); i < metaObject.propertyCount(); ++i) {
-        QMetaProperty prop = metaObject.property(i);
-        map.insert(QString::fromLatin1(prop.name()), prop.readOnGadget(object));
+    if (codePoint < 0x80) {
+        utf8->append(char(codePoint));
+    } else if (codePoint < 0x800) {
+        utf8->append(char(0xc0 | (codePoint >> 6)));
+        utf8->append(char(0x80 | (codePoint & 0x3f)));
+    } else if (codePoint < 0x10000) {
+        utf8->append(char(0xe0 | (codePoint >> 12)));
+        utf8->append(char(0x80 | ((codePoint >> 6) & 0x3f)));
+        utf8->append(char(0x80 | (codePoint & 0x3f)));
+    } else {
+        utf8->append(char(0xf0 | (codePoint >> 18)));
+        utf8->append(char(0x80 | ((codePoint >> 12) & 0x3f)));
+        utf8->append(char(0x80 | ((codePoint >> 6) & 0x3f)));
+        utf8->append(char(0x80 | (codePoint & 0x3f)));
     }
-
-    return map;
 }
 
-QByteArray NetworkPacket::serialize() const
+/**
+ * Writes QVariant values as compact JSON straight into a byte array, following
+ * the same conversions as QJsonValue::fromVariant() but without building a
+ * QJsonDocument first.
+ */
+class JsonWriter
 {
-    //Object -> QVariant
-    //QVariantMap variant;
-    //variant["id"] = mId;
-    //variant["type"] = mType;
-    //variant["body"] = mBody;
-    QVariantMap variant = qobject2qvariant(this);
+public:
+    explicit JsonWriter(QByteArray* out)
+        : m_out(out)
+    {
+    }
 
-    if (hasPayload()) {
-        //qCDebug(KDECONNECT_CORE) << "Serializing payloadTransferInfo";
-        variant[QStringLiteral("payloadSize")] = payloadSize();
-        variant[QStringLiteral("payloadTransferInfo")] = m_payloadTransferInfo;
+    void writeString(const QString& string)
+    {
+        m_out->append('"');
+        const ushort* c = string.utf16();
+        const ushort* const end = c + string.size();
+        for (; c != end; ++c) {
+            const ushort u = *c;
+            if (u >= 0x20 && u < 0x80 && u != '"' && u != '\\') {
+                m_out->append(char(u));
+                continue;
+            }
+            switch (u) {
+            case '"':  m_out->append("\\\""); break;
+            case '\\': m_out->append("\\\\"); break;
+            case '\b': m_out->append("\\b"); break;
+            case '\f': m_out->append("\\f"); break;
+            case '\n': m_out->append("\\n"); break;
+            case '\r': m_out->append("\\r"); break;
+            case '\t': m_out->append("\\t"); break;
+            default:
+                if (u < 0x20) {
+                    static const char hex[] = "0123456789abcdef";
+                    const char escaped[] = { '\\', 'u', '0', '0', hex[u >> 4], hex[u & 0xf] };
+                    m_out->append(escaped, sizeof(escaped));
+                } else if (QChar::isHighSurrogate(u) && c + 1 != end && QChar::isLowSurrogate(c[1])) {
+                    appendUtf8(m_out, QChar::surrogateToUcs4(u, c[1]));
+                    ++c;
+                } else if (QChar::isSurrogate(u)) {
+                    appendUtf8(m_out, QChar::ReplacementCharacter);
+                } else {
+                    appendUtf8(m_out, u);
+                }
+            }
+        }
+        m_out->append('"');
     }
 
-    //QVariant -> json
-    auto jsonDocument = QJsonDocument::fromVariant(variant);
-    QByteArray json = jsonDocument.toJson(QJsonDocument::Compact);
-    if (json.isEmpty()) {
-        qCDebug(KDECONNECT_CORE) << "Serialization error:";
-    } else {
-        /*if (!isEncrypted()) {
-            //qCDebug(KDECONNECT_CORE) << "Serialized packet:" << json;
-        }*/
-        json.append('\n');
+    void writeInteger(qint64 value)
+    {
+        const quint64 magnitude = value < 0 ? 0 - quint64(value) : quint64(value);
+        char buffer[24];
+        char* start = writeDigits(magnitude, buffer + sizeof(buffer));
+        if (value < 0) {
+            *--start = '-';
+        }
+        m_out->append(start, int(buffer + sizeof(buffer) - start));
     }
 
-    return json;
-}
+    void writeUnsigned(quint64 value)
+    {
+        char buffer[24];
+        const char* start = writeDigits(value, buffer + sizeof(buffer));
+        m_out->append(start, int(buffer + sizeof(buffer) - start));
+    }
+
+    void writeDouble(double value)
+    {
+        if (std::isfinite(value)) {
+            //Same formatting QJsonDocument uses: integers up to 2^53 in full, anything else shortest.
+            //Not comparing against a cast, which is undefined beyond the range of the integer type
+            const double absolute = std::abs(value);
+            const bool integral = absolute < 9007199254740992.0 && std::trunc(absolute) == absolute;
+            m_out->append(QByteArray::number(value, integral ? 'f' : 'g', QLocale::FloatingPointShortest));
+        } else {
+            m_out->append("null"); //See RFC4627 section 2.4
+        }
+    }
+
+    void writeMap(const QVariantMap& map)
+    {
+        m_out->append('{');
+        for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+            if (it != map.constBegin()) {
+                m_out->append(',');
+            }
+            writeString(it.key());
+            m_out->append(':');
+            writeValue(it.value());
+        }
+        m_out->append('}');
+    }
+
+    void writeHash(const QVariantHash& hash)
+    {
+        m_out->append('{');
+        for (auto it = hash.constBegin(); it != hash.constEnd(); ++it) {
+            if (it != hash.constBegin()) {
+                m_out->append(',');
+            }
+            writeString(it.key());
+            m_out->append(':');
+            writeValue(it.value());
+        }
+        m_out->append('}');
+    }
+
+    void writeList(const QVariantList& list)
+    {
+        m_out->append('[');
+        for (auto it = list.constBegin(); it != list.constEnd(); ++it) {
+            if (it != list.constBegin()) {
+                m_out->append(',');
+            }
+            writeValue(*it);
+        }
+        m_out->append(']');
+    }
+
+    void writeStringList(const QStringList& list)
+    {
+        m_out->append('[');
+        for (auto it = list.constBegin(); it != list.constEnd(); ++it) {
+            if (it != list.constBegin()) {
+                m_out->append(',');
+            }
+            writeString(*it);
+        }
+        m_out->append(']');
+    }
+
+    void writeValue(const QVariant& value)
+    {
+        switch (value.userType()) {
+        case QMetaType::UnknownType:
+        case QMetaType::Nullptr:
+            m_out->append("null");
+            break;
+        case QMetaType::Bool:
+            m_out->append(value.toBool() ? "true" : "false");
+            break;
+        case QMetaType::Char:
+        case QMetaType::SChar:
+        case QMetaType::Short:
+        case QMetaType::Int:
+        case QMetaType::Long:
+        case QMetaType::LongLong:
+            writeInteger(value.toLongLong());
+            break;
+        case QMetaType::UChar:
+        case QMetaType::UShort:
+        case QMetaType::UInt:
+        case QMetaType::ULong:
+        case QMetaType::ULongLong:
+            writeUnsigned(value.toULongLong());
+            break;
+        case QMetaType::Float:
+        case QMetaType::Double:
+            writeDouble(value.toDouble());
+            break;
+        case QMetaType::QString:
+            writeString(value.toString());
+            break;
+        case QMetaType::QStringList:
+            writeStringList(value.toStringList());
+            break;
+        case QMetaType::QVariantList:
+            writeList(value.toList());
+            break;
+        case QMetaType::QVariantMap:
+            writeMap(value.toMap());
+            break;
+        case QMetaType::QVariantHash:
+            writeHash(value.toHash());
+            break;
+        case QMetaType::QJsonValue:
+        case QMetaType::QJsonObject:
+        case QMetaType::QJsonArray:
+        case QMetaType::QJsonDocument:
+            writeValue(QJsonValue::fromVariant(value).toVariant());
+            break;
+        default: {
+            //Anything else is sent as its string representation, like QJsonValue::fromVariant does
+            const QString string = value.toString();
+            if (string.isEmpty()) {
+                m_out->append("null");
+            } else {
+                writeString(string);
+            }
+        }
+        }
+    }
+
+private:
+    static char* writeDigits(quint64 value, char* end)
+    {
+        do {
+            *--end = char('0' + value % 10);
+            value /= 10;
+        } while (value);
+        return end;
+    }
+
+    QByteArray* const m_out;
+};
+
+
+/**
+ * Decodes JSON text straight into QVariant values in a single pass over the
+ * bytes. Produces the same values QJsonDocument::toVariant() would (numbers
+ * are always doubles, objects are QVariantMaps, arrays are QVariantLists)
+ * without building the intermediate QJsonDocument tree.
+ */
+class JsonReader
+{
+public:
+    JsonReader(const char* begin, const char* end)
+        : m_begin(begin)
+        , m_pos(begin)
+        , m_end(end)
+        , m_depth(0)
+        , m_error(nullptr)
+    {
+    }
+
+    const char* errorString() const { return m_error; }
+    int offset() const { return int(m_pos - m_begin); }
+
+    //True if decoding failed only because the data ended, so it can be retried once more arrives
+    bool truncated() const { return m_error && m_pos == m_end; }
+
+    bool requireMore()
+    {
+        if (atEnd()) {
+            return fail("unexpected end of data");
+        }
+        return true;
+    }
+
+    bool atEnd()
+    {
+        skipWhitespace();
+        return m_pos == m_end;
+    }
+
+    bool consume(char c)
+    {
+        skipWhitespace();
+        if (m_pos == m_end || *m_pos != c) {
+            return false;
+        }
+        ++m_pos;
+        return true;
+    }
+
+    bool expect(char c, const char* error)
+    {
+        if (!consume(c)) {
+            return fail(error);
+        }
+        return true;
+    }
+
+    bool readString(QString* out)
+    {
+        skipWhitespace();
+        if (m_pos == m_end || *m_pos != '"') {
+            return fail("string expected");
+        }
+        ++m_pos;
+
+        //Fast path: no escape sequences, decode the bytes in place
+        const char* start = m_pos;
+        while (m_pos != m_end && *m_pos != '"' && *m_pos != '\\') {
+            ++m_pos;
+        }
+        if (m_pos == m_end) {
+            return fail("unterminated string");
+        }
+        if (*m_pos == '"') {
+            *out = QString::fromUtf8(start, int(m_pos - start));
+            ++m_pos;
+            return true;
+        }
+
+        //Slow path: unescape into a temporary utf8 buffer
+        QByteArray utf8(start, int(m_pos - start));
+        while (m_pos != m_end && *m_pos != '"') {
+            if (*m_pos != '\\') {
+                utf8.append(*m_pos++);
+                continue;
+            }
+            if (++m_pos == m_end) {
+                return fail("unterminated string");
+            }
+            switch (*m_pos++) {
+            case '"':  utf8.append('"'); break;
+            case '\\': utf8.append('\\'); break;
+            case '/':  utf8.append('/'); break;
+            case 'b':  utf8.append('\b'); break;
+            case 'f':  utf8.append('\f'); break;
+            case 'n':  utf8.append('\n'); break;
+            case 'r':  utf8.append('\r'); break;
+            case 't':  utf8.append('\t'); break;
+            case 'u': {
+                uint codePoint;
+                if (!readHex4(&codePoint)) {
+                    return fail("invalid unicode escape");
+                }
+                if (QChar::isHighSurrogate(codePoint) && m_end - m_pos >= 6 && m_pos[0] == '\\' && m_pos[1] == 'u') {
+                    const char* rewind = m_pos;
+                    m_pos += 2;
+                    uint low;
+                    if (readHex4(&low) && QChar::isLowSurrogate(low)) {
+                        codePoint = QChar::surrogateToUcs4(ushort(codePoint), ushort(low));
+                    } else {
+                        m_pos = rewind;
+                    }
+                }
+                if (QChar::isSurrogate(codePoint)) {
+                    codePoint = QChar::ReplacementCharacter;
+                }
+                appendUtf8(&utf8, codePoint);
+                break;
+            }
+            default:
+                return fail("invalid escape sequence");
+            }
+        }
+        if (m_pos == m_end) {
+            return fail("unterminated string");
+        }
+        ++m_pos;
+        *out = QString::fromUtf8(utf8);
+        return true;
+    }
+
+    bool readValue(QVariant* out)
+    {
+        skipWhitespace();
+        if (m_pos == m_end) {
+            return fail("value expected");
+        }
+
+        switch (*m_pos) {
+        case '{': {
+            QVariantMap map;
+            if (!readObject(&map)) {
+                return false;
+            }
+            *out = map;
+            return true;
+        }
+        case '[': {
+            QVariantList list;
+            if (!readArray(&list)) {
+                return false;
+            }
+            *out = list;
+            return true;
+        }
+        case '"': {
+            QString string;
+            if (!readString(&string)) {
+                return false;
+            }
+            *out = string;
+            return true;
+        }
+        case 't':
+            if (!readLiteral("true")) {
+                return false;
+            }
+            *out = true;
+            return true;
+        case 'f':
+            if (!readLiteral("false")) {
+                return false;
+            }
+            *out = false;
+            return true;
+        case 'n':
+            if (!readLiteral("null")) {
+                return false;
+            }
+            *out = QVariant();
+            return true;
+        default:
+            return readNumber(out);
+        }
+    }
+
+    bool readObject(QVariantMap* out)
+    {
+        if (!expect('{', "object expected") || !enter()) {
+            return false;
+        }
+        if (consume('}')) {
+            return leave();
+        }
+        do {
+            QString key;
+            QVariant value;
+            if (!readString(&key) || !expect(':', "colon expected") || !readValue(&value)) {
+                return false;
+            }
+            out->insert(key, value);
+        } while (consume(','));
+
+        return expect('}', "unterminated object") && leave();
+    }
+
+    bool readArray(QVariantList* out)
+    {
+        if (!expect('[', "array expected") || !enter()) {
+            return false;
+        }
+        if (consume(']')) {
+            return leave();
+        }
+        do {
+            QVariant value;
+            if (!readValue(&value)) {
+                return false;
+            }
+            out->append(value);
+        } while (consume(','));
+
+        return expect(']', "unterminated array") && leave();
+    }
+
+    bool readNumber(QVariant* out)
+    {
+        const char* start = m_pos;
+        bool integral = true;
+        if (m_pos != m_end && *m_pos == '-') {
+            ++m_pos;
+        }
+        const char* digits = m_pos;
+        while (m_pos != m_end && isDigit(*m_pos)) {
+            ++m_pos;
+        }
+        if (m_pos == digits) {
+            return fail("illegal value");
+        }
+        if (m_pos != m_end && *m_pos == '.') {
+            integral = false;
+            ++m_pos;
+            while (m_pos != m_end && isDigit(*m_pos)) {
+                ++m_pos;
+            }
+        }
+        if (m_pos != m_end && (*m_pos == 'e' || *m_pos == 'E')) {
+            integral = false;
+            ++m_pos;
+            if (m_pos != m_end && (*m_pos == '+' || *m_pos == '-')) {
+                ++m_pos;
+            }
+            while (m_pos != m_end && isDigit(*m_pos)) {
+                ++m_pos;
+            }
+        }
+
+        //Up to 15 digits always fit in a double without rounding
+        if (integral && m_pos - digits <= 15) {
+            qint64 value = 0;
+            for (const char* c = digits; c != m_pos; ++c) {
+                value = value * 10 + (*c - '0');
+            }
+            *out = double(*start == '-' ? -value : value);
+            return true;
+        }
+
+        bool ok;
+        const double value = QByteArray::fromRawData(start, int(m_pos - start)).toDouble(&ok);
+        if (!ok) {
+            return fail("illegal number");
+        }
+        *out = value;
+        return true;
+    }
 
-template <class T>
-void qvariant2qobject(const QVariantMap& variant, T* object)
+private:
+    static bool isDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    void skipWhitespace()
+    {
+        while (m_pos != m_end && (*m_pos == ' ' || *m_pos == '\n' || *m_pos == '\r' || *m_pos == '\t')) {
+            ++m_pos;
+        }
+    }
+
+    bool readLiteral(const char* literal)
+    {
+        const int length = int(qstrlen(literal));
+        if (m_end - m_pos < length) {
+            if (qstrncmp(m_pos, literal, uint(m_end - m_pos)) == 0) {
+                m_pos = m_end;
+            }
+            return fail("illegal value");
+        }
+        if (qstrncmp(m_pos, literal, uint(length)) != 0) {
+            return fail("illegal value");
+        }
+        m_pos += length;
+        return true;
+    }
+
+    bool readHex4(uint* out)
+    {
+        if (m_end - m_pos < 4) {
+            m_pos = m_end;
+            return false;
+        }
+        uint value = 0;
+        for (int i = 0; i < 4; ++i) {
+            const char c = *m_pos++;
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= uint(c - '0');
+            else if (c >= 'a' && c <= 'f') value |= uint(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') value |= uint(c - 'A' + 10);
+            else return false;
+        }
+        *out = value;
+        return true;
+    }
+
+    bool enter()
+    {
+        //Same nesting limit as QJsonDocument, protects the stack from hostile input
+        if (++m_depth > 1024) {
+            return fail("too deeply nested");
+        }
+        return true;
+    }
+
+    bool leave()
+    {
+        --m_depth;
+        return true;
+    }
+
+    bool fail(const char* error)
+    {
+        if (!m_error) {
+            m_error = error;
+        }
+        return false;
+    }
+
+    const char* const m_begin;
+    const char* m_pos;
+    const char* const m_end;
+    int m_depth;
+    const char* m_error;
+};
+
+#ifdef KDECONNECT_CBOR_SUPPORT
+
+/**
+ * Streams QVariant values as CBOR, with the same conversions JsonWriter does.
+ * Integral numbers are written as CBOR integers and other numbers in the
+ * smallest float type that keeps them exact.
+ */
+class CborWriter
 {
-    for ( QVariantMap::const_iterator iter = variant.begin(); iter != variant.end(); ++iter )
+public:
+    explicit CborWriter(QCborStreamWriter* stream)
+        : m_stream(stream)
+    {
+    }
+
+    void writeDouble(double value)
     {
-        const int propertyIndex = T::staticMetaObject.indexOfProperty(iter.key().toLatin1());
-        if (propertyIndex < 0) {
-            qCWarning(KDECONNECT_CORE) << "missing property" << object << iter.key();
-            continue;
+        if (!qIsFinite(value)) {
+            m_stream->appendNull(); //Same as json, which can't represent them
+        } else if (std::abs(value) < 9007199254740992.0 && value == std::floor(value)) {
+            m_stream->append(qint64(value));
+        } else if (double(float(value)) == value) {
+            m_stream->append(float(value));
+        } else {
+            m_stream->append(value);
         }
+    }
 
-        QMetaProperty property = T::staticMetaObject.property(propertyIndex);
-        bool ret = property.writeOnGadget(object, *iter);
-        if (!ret) {
-            qCWarning(KDECONNECT_CORE) << "couldn't set" << object << "->" << property.name() << '=' << *iter;
+    void writeMap(const QVariantMap& map)
+    {
+        m_stream->startMap(quint64(map.size()));
+        for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
+            m_stream->append(it.key());
+            writeValue(it.value());
         }
+        m_stream->endMap();
     }
+
+    void writeHash(const QVariantHash& hash)
+    {
+        m_stream->startMap(quint64(hash.size()));
+        for (auto it = hash.constBegin(); it != hash.constEnd(); ++it) {
+            m_stream->append(it.key());
+            writeValue(it.value());
+        }
+        m_stream->endMap();
+    }
+
+    void writeList(const QVariantList& list)
+    {
+        m_stream->startArray(quint64(list.size()));
+        for (const QVariant& value : list) {
+            writeValue(value);
+        }
+        m_stream->endArray();
+    }
+
+    void writeStringList(const QStringList& list)
+    {
+        m_stream->startArray(quint64(list.size()));
+        for (const QString& string : list) {
+            m_stream->append(string);
+        }
+        m_stream->endArray();
+    }
+
+    void writeValue(const QVariant& value)
+    {
+        switch (value.userType()) {
+        case QMetaType::UnknownType:
+        case QMetaType::Nullptr:
+            m_stream->appendNull();
+            break;
+        case QMetaType::Bool:
+            m_stream->append(value.toBool());
+            break;
+        case QMetaType::Char:
+        case QMetaType::SChar:
+        case QMetaType::Short:
+        case QMetaType::Int:
+        case QMetaType::Long:
+        case QMetaType::LongLong:
+            m_stream->append(value.toLongLong());
+            break;
+        case QMetaType::UChar:
+        case QMetaType::UShort:
+        case QMetaType::UInt:
+        case QMetaType::ULong:
+        case QMetaType::ULongLong:
+            m_stream->append(value.toULongLong());
+            break;
+        case QMetaType::Float:
+        case QMetaType::Double:
+            writeDouble(value.toDouble());
+            break;
+        case QMetaType::QString:
+            m_stream->append(value.toString());
+            break;
+        case QMetaType::QStringList:
+            writeStringList(value.toStringList());
+            break;
+        case QMetaType::QVariantList:
+            writeList(value.toList());
+            break;
+        case QMetaType::QVariantMap:
+            writeMap(value.toMap());
+            break;
+        case QMetaType::QVariantHash:
+            writeHash(value.toHash());
+            break;
+        case QMetaType::QJsonValue:
+        case QMetaType::QJsonObject:
+        case QMetaType::QJsonArray:
+        case QMetaType::QJsonDocument:
+            writeValue(QJsonValue::fromVariant(value).toVariant());
+            break;
+        default: {
+            const QString string = value.toString();
+            if (string.isEmpty()) {
+                m_stream->appendNull();
+            } else {
+                m_stream->append(string);
+            }
+        }
+        }
+    }
+
+private:
+    QCborStreamWriter* const m_stream;
+};
+
+/**
+ * Decodes CBOR into the same QVariant types JsonReader produces, so plugins
+ * can't tell which encoding a packet arrived in.
+ */
+class CborReader
+{
+public:
+    explicit CborReader(QCborStreamReader* stream)
+        : m_stream(stream)
+        , m_depth(0)
+    {
+    }
+
+    bool readString(QString* out)
+    {
+        auto chunk = m_stream->readString();
+        while (chunk.status == QCborStreamReader::Ok) {
+            out->append(chunk.data);
+            chunk = m_stream->readString();
+        }
+        return chunk.status == QCborStreamReader::EndOfString;
+    }
+
+    bool readMap(QVariantMap* out)
+    {
+        if (!m_stream->isMap() || ++m_depth > 1024 || !m_stream->enterContainer()) {
+            return false;
+        }
+        while (m_stream->hasNext()) {
+            QString key;
+            QVariant value;
+            if (!m_stream->isString() || !readString(&key) || !readValue(&value)) {
+                return false;
+            }
+            out->insert(key, value);
+        }
+        --m_depth;
+        return m_stream->leaveContainer();
+    }
+
+    bool readList(QVariantList* out)
+    {
+        if (!m_stream->isArray() || ++m_depth > 1024 || !m_stream->enterContainer()) {
+            return false;
+        }
+        if (m_stream->isLengthKnown()) {
+            out->reserve(int(qMin<quint64>(m_stream->length(), 4096)));
+        }
+        while (m_stream->hasNext()) {
+            QVariant value;
+            if (!readValue(&value)) {
+                return false;
+            }
+            out->append(value);
+        }
+        --m_depth;
+        return m_stream->leaveContainer();
+    }
+
+    bool readValue(QVariant* out)
+    {
+        switch (m_stream->type()) {
+        case QCborStreamReader::UnsignedInteger:
+            *out = double(m_stream->toUnsignedInteger());
+            return m_stream->next();
+        case QCborStreamReader::NegativeInteger:
+            *out = -1.0 - double(quint64(m_stream->toNegativeInteger()) - 1);
+            return m_stream->next();
+        case QCborStreamReader::Float16:
+            *out = double(float(m_stream->toFloat16()));
+            return m_stream->next();
+        case QCborStreamReader::Float:
+            *out = double(m_stream->toFloat());
+            return m_stream->next();
+        case QCborStreamReader::Double:
+            *out = m_stream->toDouble();
+            return m_stream->next();
+        case QCborStreamReader::String: {
+            QString string;
+            if (!readString(&string)) {
+                return false;
+            }
+            *out = string;
+            return true;
+        }
+        case QCborStreamReader::ByteArray: {
+            //We never send byte strings, but treat them as utf8 text like json would
+            QByteArray bytes;
+            auto chunk = m_stream->readByteArray();
+            while (chunk.status == QCborStreamReader::Ok) {
+                bytes.append(chunk.data);
+                chunk = m_stream->readByteArray();
+            }
+            if (chunk.status != QCborStreamReader::EndOfString) {
+                return false;
+            }
+            *out = QString::fromUtf8(bytes);
+            return true;
+        }
+        case QCborStreamReader::Array: {
+            QVariantList list;
+            if (!readList(&list)) {
+                return false;
+            }
+            *out = list;
+            return true;
+        }
+        case QCborStreamReader::Map: {
+            QVariantMap map;
+            if (!readMap(&map)) {
+                return false;
+            }
+            *out = map;
+            return true;
+        }
+        case QCborStreamReader::Tag:
+            //Tags carry no meaning for us, decode the tagged value
+            return m_stream->next() && readValue(out);
+        case QCborStreamReader::SimpleType:
+            if (m_stream->isBool()) {
+                *out = m_stream->toBool();
+            } else {
+                *out = QVariant();
+            }
+            return m_stream->next();
+        case QCborStreamReader::Invalid:
+            break;
+        }
+        return false;
+    }
+
+private:
+    QCborStreamReader* const m_stream;
+    int m_depth;
+};
+
+#endif
+
+}
+
+void NetworkPacket::serialize(QByteArray* out) const
+{
+    //Reserving marks the capacity as wanted, so resize(0) keeps the previous allocation around
+    out->reserve(qMax(out->capacity(), 512));
+    out->resize(0);
+
+    //NetworkPacket -> json
+    JsonWriter writer(out);
+    out->append("{\"id\":");
+    writer.writeString(m_id);
+    out->append(",\"type\":");
+    writer.writeString(m_type);
+    out->append(",\"body\":");
+    writer.writeMap(m_body);
+    //Always written, like the properties QJsonDocument used to serialize
+    out->append(",\"payloadSize\":");
+    writer.writeInteger(m_payloadSize);
+    out->append(",\"payloadTransferInfo\":");
+    writer.writeMap(m_payloadTransferInfo);
+    out->append("}\n");
+}
+
+QByteArray NetworkPacket::serialize() const
+{
+    QByteArray json;
+    serialize(&json);
+    return json;
 }
 
 bool NetworkPacket::unserialize(const QByteArray& a, NetworkPacket* np)
 {
-    //Json -> QVariant
-    QJsonParseError parseError;
-    auto parser = QJsonDocument::fromJson(a, &parseError);
-    if (parser.isNull()) {
-        qCDebug(KDECONNECT_CORE) << "Unserialization error:" << parseError.errorString();
+    //Json -> NetworkPacket, in a single pass and without QMetaProperty lookups
+    JsonReader reader(a.constData(), a.constData() + a.size());
+
+    //Fields missing from the document keep their current value, except for the payload ones
+    NetworkPacket decoded(*np);
+    decoded.m_payloadTransferInfo.clear();
+    QVariant payloadSize;
+
+    bool success = reader.expect('{', "object expected");
+    if (success && !reader.consume('}')) {
+        do {
+            QString key;
+            success = reader.readString(&key) && reader.expect(':', "colon expected");
+            if (!success) {
+                break;
+            }
+
+            if (key == QLatin1String("body")) {
+                decoded.m_body.clear();
+                success = reader.readObject(&decoded.m_body);
+            } else if (key == QLatin1String("type")) {
+                success = reader.readString(&decoded.m_type);
+            } else if (key == QLatin1String("id")) {
+                QVariant value;
+                success = reader.readValue(&value);
+                decoded.setIdFromVariant(value);
+            } else if (key == QLatin1String("payloadTransferInfo")) {
+                success = reader.readObject(&decoded.m_payloadTransferInfo);
+            } else if (key == QLatin1String("payloadSize")) {
+                success = reader.readValue(&payloadSize);
+            } else {
+                QVariant ignored;
+                success = reader.readValue(&ignored);
+                qCWarning(KDECONNECT_CORE) << "missing property" << key;
+            }
+        } while (success && reader.consume(','));
+
+        success = success && reader.expect('}', "unterminated object");
+    }
+    if (success && !reader.atEnd()) {
+        success = false;
+    }
+
+    if (!success) {
+        qCDebug(KDECONNECT_CORE) << "Unserialization error:" << (reader.errorString() ? reader.errorString() : "garbage at the end of the document") << "at offset" << reader.offset();
         return false;
     }
 
-    auto variant = parser.toVariant().toMap();
-    qvariant2qobject(variant, np);
+    decoded.m_payloadSize = payloadSize.toLongLong(); //Will return 0 if was not present, which is ok
+    decoded.finishUnserialize();
+    *np = std::move(decoded);
+    return true;
+}
+
+QStringList NetworkPacket::supportedEncodings()
+{
+#ifdef KDECONNECT_CBOR_SUPPORT
+    return { QStringLiteral("cbor"), QStringLiteral("json") };
+#else
+    return { QStringLiteral("json") };
+#endif
+}
+
+NetworkPacket::Encoding NetworkPacket::negotiateEncoding(const NetworkPacket& identityPacket)
+{
+#ifdef KDECONNECT_CBOR_SUPPORT
+    const QStringList peerEncodings = identityPacket.get<QStringList>(QStringLiteral("packetEncodings"));
+    if (peerEncodings.contains(QStringLiteral("cbor"))) {
+        return CborEncoding;
+    }
+#else
+    Q_UNUSED(identityPacket);
+#endif
+    //Peers that don't advertise anything only speak newline delimited json
+    return JsonEncoding;
+}
+
+void NetworkPacket::serializeCbor(QByteArray* out) const
+{
+    out->reserve(qMax(out->capacity(), 512));
+    out->resize(0);
 
-    np->m_payloadSize = variant[QStringLiteral("payloadSize")].toInt(); //Will return 0 if was not present, which is ok
-    if (np->m_payloadSize == -1) {
-        np->m_payloadSize = np->get<int>(QStringLiteral("size"), -1);
+#ifdef KDECONNECT_CBOR_SUPPORT
+    QCborStreamWriter stream(out);
+    CborWriter writer(&stream);
+    stream.startMap(hasPayload() ? 5 : 3);
+    stream.append(QLatin1String("id"));
+    stream.append(m_id);
+    stream.append(QLatin1String("type"));
+    stream.append(m_type);
+    stream.append(QLatin1String("body"));
+    writer.writeMap(m_body);
+    if (hasPayload()) {
+        stream.append(QLatin1String("payloadSize"));
+        stream.append(qint64(m_payloadSize));
+        stream.append(QLatin1String("payloadTransferInfo"));
+        writer.writeMap(m_payloadTransferInfo);
+    }
+    stream.endMap();
+#else
+    Q_ASSERT_X(false, "NetworkPacket::serializeCbor", "built without CBOR support");
+#endif
+}
+
+bool NetworkPacket::unserializeCbor(const QByteArray& cbor, NetworkPacket* np)
+{
+#ifdef KDECONNECT_CBOR_SUPPORT
+    QCborStreamReader stream(cbor);
+    CborReader reader(&stream);
+
+    NetworkPacket decoded(*np);
+    decoded.m_payloadTransferInfo.clear();
+    QVariant payloadSize;
+
+    bool success = stream.isMap() && stream.enterContainer();
+    while (success && stream.hasNext()) {
+        QString key;
+        success = stream.isString() && reader.readString(&key);
+        if (!success) {
+            break;
+        }
+
+        if (key == QLatin1String("body")) {
+            decoded.m_body.clear();
+            success = reader.readMap(&decoded.m_body);
+        } else if (key == QLatin1String("type")) {
+            success = stream.isString() && reader.readString(&decoded.m_type);
+        } else if (key == QLatin1String("id")) {
+            QVariant value;
+            success = reader.readValue(&value);
+            decoded.setIdFromVariant(value);
+        } else if (key == QLatin1String("payloadTransferInfo")) {
+            success = reader.readMap(&decoded.m_payloadTransferInfo);
+        } else if (key == QLatin1String("payloadSize")) {
+            success = reader.readValue(&payloadSize);
+        } else {
+            QVariant ignored;
+            success = reader.readValue(&ignored);
+            qCWarning(KDECONNECT_CORE) << "missing property" << key;
+        }
+    }
+    success = success && stream.leaveContainer() && stream.lastError() == QCborError::NoError;
+
+    if (!success) {
+        qCDebug(KDECONNECT_CORE) << "Unserialization error:" << stream.lastError().toString() << "at offset" << stream.currentOffset();
+        return false;
+    }
+
+    decoded.m_payloadSize = payloadSize.toLongLong();
+    decoded.finishUnserialize();
+    *np = std::move(decoded);
+    return true;
+#else
+    Q_UNUSED(cbor);
+    Q_UNUSED(np);
+    return false;
+#endif
+}
+
+void NetworkPacket::setIdFromVariant(const QVariant& id)
+{
+    //Android sends the id as a number, we send it as a string
+    m_id = (id.type() == QVariant::Double) ? QString::number(id.toLongLong()) : id.toString();
+}
+
+void NetworkPacket::setType(const QString& t)
+{
+    m_type = t;
+    m_typeId = PacketTypeRegistry::lookup(t);
+}
+
+void NetworkPacket::finishUnserialize()
+{
+    //Only looked up, never interned: types no plugin declared stay UnknownType
+    m_typeId = PacketTypeRegistry::lookup(m_type);
+
+    if (m_payloadSize == -1) {
+        m_payloadSize = get<int>(QStringLiteral("size"), -1);
     }
-    np->m_payloadTransferInfo = variant[QStringLiteral("payloadTransferInfo")].toMap(); //Will return an empty qvariantmap if was not present, which is ok
 
     //Ids containing characters that are not allowed as dbus paths would make app crash
-    if (np->m_body.contains(QStringLiteral("deviceId")))
+    if (m_body.contains(QStringLiteral("deviceId")))
     {
-        QString deviceId = np->get<QString>(QStringLiteral("deviceId"));
+        QString deviceId = get<QString>(QStringLiteral("deviceId"));
         DbusHelper::filterNonExportableCharacters(deviceId);
-        np->set(QStringLiteral("deviceId"), deviceId);
+        set(QStringLiteral("deviceId"), deviceId);
+    }
+}
+
+NetworkPacketStreamDecoder::NetworkPacketStreamDecoder()
+    : m_packet(QString())
+{
+    reset();
+}
+
+void NetworkPacketStreamDecoder::reset()
+{
+    m_stage = Begin;
+    m_streaming = false;
+    m_streamedKey.clear();
+    m_packet = NetworkPacket(QString());
+    m_payloadSize.clear();
+}
+
+int NetworkPacketStreamDecoder::decode(const QByteArray& data, QVariantList* elements)
+{
+    const char* const begin = data.constData();
+    const char* const end = begin + data.size();
+
+    //Before streaming starts nothing is kept, the header is parsed again from the start every time
+    if (!m_streaming && m_stage != Declined && m_stage != Failed) {
+        reset();
+    }
+
+    int consumed = 0;
+    while (m_stage != Finished && m_stage != Declined && m_stage != Failed) {
+        JsonReader reader(begin + consumed, end);
+        if (!step(&reader, elements)) {
+            if (!reader.truncated()) {
+                qCDebug(KDECONNECT_CORE) << "Unserialization error:" << reader.errorString() << "at offset" << consumed + reader.offset();
+                m_stage = Failed;
+            }
+            break;
+        }
+        consumed += reader.offset();
     }
 
+    if (!m_streaming) {
+        //Complete packets that never reached their array are decoded as a whole once the newline arrives
+        if (m_stage == Finished) {
+            reset();
+        }
+        return 0;
+    }
+    return consumed;
+}
+
+bool NetworkPacketStreamDecoder::takePacket(NetworkPacket* packet)
+{
+    if (m_stage != Finished) {
+        return false;
+    }
+    m_packet.m_payloadSize = m_payloadSize.toLongLong();
+    m_packet.finishUnserialize();
+    *packet = std::move(m_packet);
+    reset();
+    return true;
+}
+
+template<typename Reader>
+bool NetworkPacketStreamDecoder::separator(Reader* reader, char close, Stage next, Stage closed)
+{
+    if (!reader->requireMore()) {
+        return false;
+    }
+    if (reader->consume(',')) {
+        m_stage = next;
+        return true;
+    }
+    if (!reader->expect(close, "unterminated object")) {
+        return false;
+    }
+    m_stage = closed;
     return true;
+}
+
+//Decodes one member or array element, and only changes the state if it was complete
+template<typename Reader>
+bool NetworkPacketStreamDecoder::step(Reader* reader, QVariantList* elements)
+{
+    switch (m_stage) {
+    case Begin:
+        if (!reader->expect('{', "object expected") || !reader->requireMore()) {
+            return false;
+        }
+        m_stage = reader->consume('}') ? Finished : TopMember;
+        return true;
+
+    case TopMember: {
+        QString key;
+        if (!reader->readString(&key) || !reader->expect(':', "colon expected") || !reader->requireMore()) {
+            return false;
+        }
+
+        if (key == QLatin1String("body")) {
+            if (m_streamedKey.isEmpty()) {
+                m_stage = Declined;
+                return true;
+            }
+            if (!reader->expect('{', "object expected") || !reader->requireMore()) {
+                return false;
+            }
+            if (reader->consume('}')) {
+                return separator(reader, '}', TopMember, Finished);
+            }
+            //The type streams, so from here on decoded bytes are consumed
+            m_streaming = true;
+            m_stage = BodyMember;
+            return true;
+        }
 
+        QVariant value;
+        if (!reader->readValue(&value)) {
+            return false;
+        }
+        const Stage previous = m_stage;
+        if (!separator(reader, '}', TopMember, Finished)) {
+            m_stage = previous;
+            return false;
+        }
+
+        if (key == QLatin1String("type")) {
+            m_packet.setType(value.toString());
+            m_streamedKey = PacketTypeRegistry::streamedArray(m_packet.typeId());
+        } else if (key == QLatin1String("id")) {
+            m_packet.setIdFromVariant(value);
+        } else if (key == QLatin1String("payloadTransferInfo")) {
+            m_packet.m_payloadTransferInfo = value.toMap();
+        } else if (key == QLatin1String("payloadSize")) {
+            m_payloadSize = value;
+        } else {
+            qCWarning(KDECONNECT_CORE) << "missing property" << key;
+        }
+        return true;
+    }
+
+    case BodyMember: {
+        QString key;
+        if (!reader->readString(&key) || !reader->expect(':', "colon expected") || !reader->requireMore()) {
+            return false;
+        }
+
+        if (key == m_streamedKey) {
+            if (!reader->expect('[', "array expected") || !reader->requireMore()) {
+                return false;
+            }
+            m_stage = reader->consume(']') ? AfterArray : ArrayElement;
+            return true;
+        }
+
+        QVariant value;
+        if (!reader->readValue(&value) || !separator(reader, '}', BodyMember, AfterBody)) {
+            m_stage = BodyMember;
+            return false;
+        }
+        m_packet.m_body.insert(key, value);
+        return true;
+    }
+
+    case ArrayElement: {
+        QVariant value;
+        if (!reader->readValue(&value) || !separator(reader, ']', ArrayElement, AfterArray)) {
+            m_stage = ArrayElement;
+            return false;
+        }
+        elements->append(value);
+        return true;
+    }
+
+    case AfterArray:
+        return separator(reader, '}', BodyMember, AfterBody);
+
+    case AfterBody:
+        return separator(reader, '}', TopMember, Finished);
+
+    case Finished:
+    case Declined:
+    case Failed:
+        break;
+    }
+    return false;
 }
 
 FileTransferJob* NetworkPacket::createPayloadTransferJob(const QUrl& destination) const
@@ -25,6 +25,7 @@
 
 #include <QObject>
 #include <QString>
+#include <QStringList>
 #include <QVariant>
 #include <QIODevice>
 //#include <QtCrypto>
@@ -49,16 +50,34 @@ public:
     //const static QCA::EncryptionAlgorithm EncryptionAlgorithm;
     const static int s_protocolVersion;
 
+    //Wire formats a link can carry packets in, see negotiateEncoding()
+    enum Encoding {
+        JsonEncoding,   //Newline delimited json, understood by every peer
+        CborEncoding    //Length prefixed CBOR frames, only if both ends advertise it
+    };
+
     explicit NetworkPacket(const QString& type = QStringLiteral("empty"), const QVariantMap& body = {});
-    NetworkPacket(const NetworkPacket& other); // Copy constructor, required for QMetaType and queued signals
+    //Copies share the body and the payload (implicit sharing), the body is only detached when modified.
+    //Handing one received packet to several plugins or through queued signals copies nothing.
+    NetworkPacket(const NetworkPacket& other) = default;
+    NetworkPacket(NetworkPacket&& other) = default;
+    NetworkPacket& operator=(const NetworkPacket& other) = default;
+    NetworkPacket& operator=(NetworkPacket&& other) = default;
 
     static void createIdentityPacket(NetworkPacket*);
 
     QByteArray serialize() const;
+    void serialize(QByteArray* out) const; //Replaces the contents of out, reusing its capacity
     static bool unserialize(const QByteArray& json, NetworkPacket* out);
 
+    static QStringList supportedEncodings(); //Advertised as "packetEncodings" in the identity packet
+    static Encoding negotiateEncoding(const NetworkPacket& identityPacket);
+    void serializeCbor(QByteArray* out) const;
+    static bool unserializeCbor(const QByteArray& cbor, NetworkPacket* out);
+
     const QString& id() const { return m_id; }
     const QString& type() const { return m_type; }
+    int typeId() const { return m_typeId; } //See PacketTypeRegistry, UnknownType for types no plugin handles
     QVariantMap& body() { return m_body; }
     const QVariantMap& body() const { return m_body; }
 
@@ -81,14 +100,18 @@ public:
     bool hasPayloadTransferInfo() const { return !m_payloadTransferInfo.isEmpty(); }
 
 private:
+    friend class NetworkPacketStreamDecoder;
 
     void setId(const QString& id) { m_id = id; }
-    void setType(const QString& t) { m_type = t; }
+    void setType(const QString& t);
     void setBody(const QVariantMap& b) { m_body = b; }
     void setPayloadSize(qint64 s) { m_payloadSize = s; }
+    void setIdFromVariant(const QVariant& id);
+    void finishUnserialize();
 
     QString m_id;
     QString m_type;
+    int m_typeId;
     QVariantMap m_body;
 	
     QSharedPointer<QIODevice> m_payload;
@@ -97,6 +120,58 @@ private:
 
 };
 
+/*
+ * Decodes a json packet while it is still arriving. Once the decoder reaches the array
+ * registered for the packet type (see PacketTypeRegistry::setStreamedArray), every
+ * element is handed out as soon as it is complete and its bytes can be dropped, so
+ * memory stays bounded no matter how long the array is.
+ *
+ * Until then nothing is consumed: if the packet type doesn't stream, or the body comes
+ * before the type, the decoder declines and the line is decoded as a whole later on.
+ */
+class KDECONNECTCORE_EXPORT NetworkPacketStreamDecoder
+{
+public:
+    NetworkPacketStreamDecoder();
+
+    //Returns how many bytes of data were consumed. The caller drops them and passes the
+    //rest again, followed by newer bytes. Complete elements are appended to elements.
+    int decode(const QByteArray& data, QVariantList* elements);
+
+    bool isStreaming() const { return m_streaming; } //The rest of the line has to go through decode()
+    bool isDeclined() const { return m_stage == Declined; }
+    bool isFinished() const { return m_stage == Finished; }
+    bool hasError() const { return m_stage == Failed; }
+
+    //Id, type and the body keys decoded so far
+    const NetworkPacket& header() const { return m_packet; }
+    //The packet without the streamed array, once finished
+    bool takePacket(NetworkPacket* packet);
+    void reset();
+
+private:
+    enum Stage {
+        Begin,
+        TopMember,
+        BodyMember,
+        ArrayElement,
+        AfterArray,
+        AfterBody,
+        Finished,
+        Declined,
+        Failed
+    };
+
+    template<typename Reader> bool step(Reader* reader, QVariantList* elements);
+    template<typename Reader> bool separator(Reader* reader, char close, Stage next, Stage closed);
+
+    Stage m_stage;
+    bool m_streaming;
+    QString m_streamedKey;
+    NetworkPacket m_packet;
+    QVariant m_payloadSize;
+};
+
 KDECONNECTCORE_EXPORT QDebug operator<<(QDebug s, const NetworkPacket& pkg);
 Q_DECLARE_METATYPE(NetworkPacket)
 
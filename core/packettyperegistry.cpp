@@ -0,0 +1,111 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "packettyperegistry.h"
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QVector>
+
+#include "networkpackettypes.h"
+
+namespace {
+
+struct Registry
+{
+    Registry()
+    {
+        names.append(QString());
+        streamedArrays.append(QString());
+        insert(PACKET_TYPE_IDENTITY);
+        insert(PACKET_TYPE_PAIR);
+    }
+
+    int insert(const QString& type)
+    {
+        const int id = names.size();
+        ids.insert(type, id);
+        names.append(type);
+        streamedArrays.append(QString());
+        return id;
+    }
+
+    QReadWriteLock lock;
+    QHash<QString, int> ids;
+    QVector<QString> names;
+    QVector<QString> streamedArrays;
+};
+
+}
+
+Q_GLOBAL_STATIC(Registry, s_registry)
+
+int PacketTypeRegistry::intern(const QString& type)
+{
+    Registry* registry = s_registry();
+    {
+        QReadLocker locker(&registry->lock);
+        const int id = registry->ids.value(type, UnknownType);
+        if (id != UnknownType) {
+            return id;
+        }
+    }
+
+    QWriteLocker locker(&registry->lock);
+    const int id = registry->ids.value(type, UnknownType);
+    return (id != UnknownType) ? id : registry->insert(type);
+}
+
+int PacketTypeRegistry::lookup(const QString& type)
+{
+    Registry* registry = s_registry();
+    QReadLocker locker(&registry->lock);
+    return registry->ids.value(type, UnknownType);
+}
+
+QString PacketTypeRegistry::name(int typeId)
+{
+    Registry* registry = s_registry();
+    QReadLocker locker(&registry->lock);
+    return registry->names.value(typeId);
+}
+
+int PacketTypeRegistry::count()
+{
+    Registry* registry = s_registry();
+    QReadLocker locker(&registry->lock);
+    return registry->names.size();
+}
+
+void PacketTypeRegistry::setStreamedArray(int typeId, const QString& key)
+{
+    Registry* registry = s_registry();
+    QWriteLocker locker(&registry->lock);
+    if (typeId > UnknownType && typeId < registry->streamedArrays.size()) {
+        registry->streamedArrays[typeId] = key;
+    }
+}
+
+QString PacketTypeRegistry::streamedArray(int typeId)
+{
+    Registry* registry = s_registry();
+    QReadLocker locker(&registry->lock);
+    return registry->streamedArrays.value(typeId);
+}
@@ -0,0 +1,56 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKETTYPEREGISTRY_H
+#define PACKETTYPEREGISTRY_H
+
+#include <QString>
+
+#include "kdeconnectcore_export.h"
+
+/*
+ * Maps packet type strings to small consecutive integers, so packets can be
+ * routed by indexing a vector instead of comparing strings.
+ *
+ * Types are only added by intern(), which is called for the types declared by
+ * the installed plugins. Parsing a packet only uses lookup(), so a peer sending
+ * random types can't grow the table: those packets simply get UnknownType.
+ */
+class KDECONNECTCORE_EXPORT PacketTypeRegistry
+{
+public:
+    enum : int {
+        UnknownType = 0,
+        IdentityType = 1,
+        PairType = 2
+    };
+
+    static int intern(const QString& type);
+    static int lookup(const QString& type);
+    static QString name(int typeId);
+    static int count(); //Upper bound (exclusive) of the ids handed out so far
+
+    //Elements of this body array are handed to plugins while the packet is still arriving,
+    //see NetworkPacketStreamDecoder and KdeConnectPlugin::receivePacketElements
+    static void setStreamedArray(int typeId, const QString& key);
+    static QString streamedArray(int typeId);
+};
+
+#endif
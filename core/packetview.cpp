@@ -0,0 +1,42 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "packetview.h"
+
+#include "core_debug.h"
+
+namespace PacketView {
+
+Keys::Keys(std::initializer_list<QString> keys)
+{
+    m_indices.reserve(int(keys.size()));
+    int index = 0;
+    for (const QString& key : keys) {
+        m_indices.insert(key, index++);
+    }
+}
+
+bool reject(const NetworkPacket& np, const char* key, const QVariant& value)
+{
+    qCWarning(KDECONNECT_CORE) << "Rejecting packet of type" << np.type() << "with invalid" << key << value;
+    return false;
+}
+
+}
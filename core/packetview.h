@@ -0,0 +1,130 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKETVIEW_H
+#define PACKETVIEW_H
+
+#include <QHash>
+#include <QString>
+#include <QVariant>
+
+#include <initializer_list>
+
+#include "kdeconnectcore_export.h"
+#include "networkpacket.h"
+
+/*
+ * Typed views of packet bodies, so hot handlers read struct members instead of
+ * doing a string keyed lookup and a QVariant conversion for every field.
+ *
+ * A view is declared once from a list of fields, each one given as
+ * FIELD(type, member, "json key", default value):
+ *
+ *   #define MY_REQUEST_FIELDS(FIELD) \
+ *       FIELD(QString, name, "name", QString()) \
+ *       FIELD(int, volume, "volume", 0)
+ *   KDECONNECT_PACKET_VIEW(MyRequest, MY_REQUEST_FIELDS)
+ *
+ * MyRequest::decode() walks the body once, only looking at the keys it carries.
+ * A field with a value that can't be converted to its type rejects the whole
+ * packet, unknown keys are ignored and null values count as missing.
+ * has(MyRequest::volumeField) tells whether the packet carried a field at all.
+ */
+namespace PacketView {
+
+//Json key -> field index of one view
+class KDECONNECTCORE_EXPORT Keys
+{
+public:
+    Keys(std::initializer_list<QString> keys);
+    int indexOf(const QString& key) const { return m_indices.value(key, -1); }
+
+private:
+    QHash<QString, int> m_indices;
+};
+
+template<typename T>
+inline bool convert(const QVariant& value, T* out)
+{
+    if (value.userType() == qMetaTypeId<T>()) {
+        *out = value.value<T>();
+        return true;
+    }
+    QVariant converted(value);
+    if (!converted.convert(qMetaTypeId<T>())) {
+        return false;
+    }
+    *out = converted.value<T>();
+    return true;
+}
+
+inline bool isNull(const QVariant& value)
+{
+    return !value.isValid() || value.userType() == QMetaType::Nullptr;
+}
+
+//Logs why a packet was rejected, always returns false
+KDECONNECTCORE_EXPORT bool reject(const NetworkPacket& np, const char* key, const QVariant& value);
+
+}
+
+#define KDECONNECT_PACKET_VIEW_ENUM(type, member, key, defaultValue) member##Field,
+#define KDECONNECT_PACKET_VIEW_MEMBER(type, member, key, defaultValue) type member = defaultValue;
+#define KDECONNECT_PACKET_VIEW_KEY(type, member, key, defaultValue) QStringLiteral(key),
+#define KDECONNECT_PACKET_VIEW_CASE(type, member, key, defaultValue) \
+    case member##Field: \
+        if (!PacketView::convert(it.value(), &member)) { \
+            return PacketView::reject(np, key, it.value()); \
+        } \
+        break;
+
+#define KDECONNECT_PACKET_VIEW(Name, FIELDS) \
+    struct Name \
+    { \
+        enum Field { FIELDS(KDECONNECT_PACKET_VIEW_ENUM) FieldCount }; \
+        FIELDS(KDECONNECT_PACKET_VIEW_MEMBER) \
+        \
+        bool has(Field field) const { return m_present & (Q_UINT64_C(1) << field); } \
+        \
+        bool decode(const NetworkPacket& np) \
+        { \
+            static_assert(FieldCount <= 64, "Too many fields in " #Name); \
+            static const PacketView::Keys keys = { FIELDS(KDECONNECT_PACKET_VIEW_KEY) }; \
+            const QVariantMap& body = np.body(); \
+            for (auto it = body.constBegin(); it != body.constEnd(); ++it) { \
+                const int field = keys.indexOf(it.key()); \
+                if (field < 0 || PacketView::isNull(it.value())) { \
+                    continue; \
+                } \
+                switch (field) { \
+                FIELDS(KDECONNECT_PACKET_VIEW_CASE) \
+                default: \
+                    break; \
+                } \
+                m_present |= Q_UINT64_C(1) << field; \
+            } \
+            return true; \
+        } \
+        \
+    private: \
+        quint64 m_present = 0; \
+    };
+
+#endif
@@ -27,6 +27,7 @@
 #include "core_debug.h"
 #include "device.h"
 #include "kdeconnectplugin.h"
+#include "packettyperegistry.h"
 
 //In older Qt released, qAsConst isnt available
 #include "qtcompat_p.h"
@@ -42,6 +43,12 @@ PluginLoader::PluginLoader()
     const QVector<KPluginMetaData> data = KPluginLoader::findPlugins(QStringLiteral("kdeconnect/"));
     for (const KPluginMetaData& metadata : data) {
         plugins[metadata.pluginId()] = metadata;
+
+        //Give every type a plugin can receive an id before the first packet is parsed
+        const QStringList incomingTypes = KPluginMetaData::readStringList(metadata.rawData(), QStringLiteral("X-KdeConnect-SupportedPacketType"));
+        for (const QString& type : incomingTypes) {
+            PacketTypeRegistry::intern(type);
+        }
     }
 }
 
@@ -24,6 +24,27 @@
 #include <QObject>
 
 #include <core/networkpacket.h>
+#include <core/packetview.h>
+
+#define MOUSEPAD_REQUEST_FIELDS(FIELD) \
+    FIELD(float, dx, "dx", 0) \
+    FIELD(float, dy, "dy", 0) \
+    FIELD(bool, singleClick, "singleclick", false) \
+    FIELD(bool, doubleClick, "doubleclick", false) \
+    FIELD(bool, middleClick, "middleclick", false) \
+    FIELD(bool, rightClick, "rightclick", false) \
+    FIELD(bool, singleHold, "singlehold", false) \
+    FIELD(bool, singleRelease, "singlerelease", false) \
+    FIELD(bool, scroll, "scroll", false) \
+    FIELD(QString, key, "key", QString()) \
+    FIELD(int, specialKey, "specialKey", 0) \
+    FIELD(bool, ctrl, "ctrl", false) \
+    FIELD(bool, alt, "alt", false) \
+    FIELD(bool, shift, "shift", false) \
+    FIELD(bool, super, "super", false)
+
+//A kdeconnect.mousepad.request packet, see PacketView
+KDECONNECT_PACKET_VIEW(MousepadRequest, MOUSEPAD_REQUEST_FIELDS)
 
 class AbstractRemoteInput
     : public QObject
@@ -32,7 +53,7 @@ class AbstractRemoteInput
 public:
     explicit AbstractRemoteInput(QObject* parent = nullptr);
 
-    virtual bool handlePacket(const NetworkPacket& np) = 0;
+    virtual bool handlePacket(const MousepadRequest& request) = 0;
     virtual bool hasKeyboardSupport() { return false; };
 };
 
@@ -72,11 +72,15 @@ MousepadPlugin::~MousepadPlugin()
 
 bool MousepadPlugin::receivePacket(const NetworkPacket& np)
 {
-    if (m_impl) {
-        return m_impl->handlePacket(np);
-    } else {
+    if (!m_impl) {
+        return false;
+    }
+
+    MousepadRequest request;
+    if (!request.decode(np)) {
         return false;
     }
+    return m_impl->handlePacket(request);
 }
 
 
@@ -49,7 +49,7 @@ WaylandRemoteInput::WaylandRemoteInput(QObject* parent)
     registry->setup();
 }
 
-bool WaylandRemoteInput::handlePacket(const NetworkPacket& np)
+bool WaylandRemoteInput::handlePacket(const MousepadRequest& request)
 {
     if (!m_waylandInput) {
         return false;
@@ -60,44 +60,31 @@ bool WaylandRemoteInput::handlePacket(const NetworkPacket& np)
         m_waylandAuthenticationRequested = true;
     }
 
-    const float dx = np.get<float>(QStringLiteral("dx"), 0);
-    const float dy = np.get<float>(QStringLiteral("dy"), 0);
+    if (request.singleClick || request.doubleClick || request.middleClick || request.rightClick || request.singleHold || request.scroll || !request.key.isEmpty() || request.specialKey) {
 
-    const bool isSingleClick = np.get<bool>(QStringLiteral("singleclick"), false);
-    const bool isDoubleClick = np.get<bool>(QStringLiteral("doubleclick"), false);
-    const bool isMiddleClick = np.get<bool>(QStringLiteral("middleclick"), false);
-    const bool isRightClick = np.get<bool>(QStringLiteral("rightclick"), false);
-    const bool isSingleHold = np.get<bool>(QStringLiteral("singlehold"), false);
-    const bool isSingleRelease = np.get<bool>(QStringLiteral("singlerelease"), false);
-    const bool isScroll = np.get<bool>(QStringLiteral("scroll"), false);
-    const QString key = np.get<QString>(QStringLiteral("key"), QLatin1String(""));
-    const int specialKey = np.get<int>(QStringLiteral("specialKey"), 0);
-
-    if (isSingleClick || isDoubleClick || isMiddleClick || isRightClick || isSingleHold || isScroll || !key.isEmpty() || specialKey) {
-
-        if (isSingleClick) {
+        if (request.singleClick) {
             m_waylandInput->requestPointerButtonClick(Qt::LeftButton);
-        } else if (isDoubleClick) {
+        } else if (request.doubleClick) {
             m_waylandInput->requestPointerButtonClick(Qt::LeftButton);
             m_waylandInput->requestPointerButtonClick(Qt::LeftButton);
-        } else if (isMiddleClick) {
+        } else if (request.middleClick) {
             m_waylandInput->requestPointerButtonClick(Qt::MiddleButton);
-        } else if (isRightClick) {
+        } else if (request.rightClick) {
             m_waylandInput->requestPointerButtonClick(Qt::RightButton);
-        } else if (isSingleHold){
+        } else if (request.singleHold){
             //For drag'n drop
             m_waylandInput->requestPointerButtonPress(Qt::LeftButton);
-        } else if (isSingleRelease){
+        } else if (request.singleRelease){
             //For drag'n drop. NEVER USED (release is done by tapping, which actually triggers a isSingleClick). Kept here for future-proofnes.
             m_waylandInput->requestPointerButtonRelease(Qt::LeftButton);
-        } else if (isScroll) {
-            m_waylandInput->requestPointerAxis(Qt::Vertical, dy);
-        } else if (!key.isEmpty() || specialKey) {
+        } else if (request.scroll) {
+            m_waylandInput->requestPointerAxis(Qt::Vertical, request.dy);
+        } else if (!request.key.isEmpty() || request.specialKey) {
             // TODO: implement key support
         }
 
     } else { //Is a mouse move event
-        m_waylandInput->requestPointerMove(QSizeF(dx, dy));
+        m_waylandInput->requestPointerMove(QSizeF(request.dx, request.dy));
     }
     return true;
 }
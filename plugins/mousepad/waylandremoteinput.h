@@ -39,7 +39,7 @@ class WaylandRemoteInput
 public:
     explicit WaylandRemoteInput(QObject* parent);
 
-    bool handlePacket(const NetworkPacket& np) override;
+    bool handlePacket(const MousepadRequest& request) override;
 
 private:
     void setupWaylandIntegration();
@@ -72,32 +72,19 @@ WindowsRemoteInput::WindowsRemoteInput(QObject* parent)
 
 }
 
-bool WindowsRemoteInput::handlePacket(const NetworkPacket& np)
+bool WindowsRemoteInput::handlePacket(const MousepadRequest& request)
 {
-    float dx = np.get<float>(QStringLiteral("dx"), 0);
-    float dy = np.get<float>(QStringLiteral("dy"), 0);
-
-    bool isSingleClick = np.get<bool>(QStringLiteral("singleclick"), false);
-    bool isDoubleClick = np.get<bool>(QStringLiteral("doubleclick"), false);
-    bool isMiddleClick = np.get<bool>(QStringLiteral("middleclick"), false);
-    bool isRightClick = np.get<bool>(QStringLiteral("rightclick"), false);
-    bool isSingleHold = np.get<bool>(QStringLiteral("singlehold"), false);
-    bool isSingleRelease = np.get<bool>(QStringLiteral("singlerelease"), false);
-    bool isScroll = np.get<bool>(QStringLiteral("scroll"), false);
-    QString key = np.get<QString>(QStringLiteral("key"), QLatin1String(""));
-    int specialKey = np.get<int>(QStringLiteral("specialKey"), 0);
-
-    if (isSingleClick || isDoubleClick || isMiddleClick || isRightClick || isSingleHold || isScroll || !key.isEmpty() || specialKey) {
+    if (request.singleClick || request.doubleClick || request.middleClick || request.rightClick || request.singleHold || request.scroll || !request.key.isEmpty() || request.specialKey) {
 
 		INPUT input={0};
 		input.type = INPUT_MOUSE;
 
-        if (isSingleClick) {
+        if (request.singleClick) {
 			input.mi.dwFlags = MOUSEEVENTF_LEFTDOWN;
 			::SendInput(1,&input,sizeof(INPUT));
 			input.mi.dwFlags = MOUSEEVENTF_LEFTUP;
 			::SendInput(1,&input,sizeof(INPUT));
-        } else if (isDoubleClick) {
+        } else if (request.doubleClick) {
 			input.mi.dwFlags = MOUSEEVENTF_LEFTDOWN;
 			::SendInput(1,&input,sizeof(INPUT));
 			input.mi.dwFlags = MOUSEEVENTF_LEFTUP;
@@ -106,28 +93,28 @@ bool WindowsRemoteInput::handlePacket(const NetworkPacket& np)
 			::SendInput(1,&input,sizeof(INPUT));
 			input.mi.dwFlags = MOUSEEVENTF_LEFTUP;
 			::SendInput(1,&input,sizeof(INPUT));
-		} else if (isMiddleClick) {
+		} else if (request.middleClick) {
 			input.mi.dwFlags = MOUSEEVENTF_MIDDLEDOWN;
 			::SendInput(1,&input,sizeof(INPUT));
 			input.mi.dwFlags = MOUSEEVENTF_MIDDLEUP;
 			::SendInput(1,&input,sizeof(INPUT));
-        } else if (isRightClick) {
+        } else if (request.rightClick) {
 			input.mi.dwFlags = MOUSEEVENTF_RIGHTDOWN;
 			::SendInput(1,&input,sizeof(INPUT));
 			input.mi.dwFlags = MOUSEEVENTF_RIGHTUP;
 			::SendInput(1,&input,sizeof(INPUT));
-        } else if (isSingleHold){
+        } else if (request.singleHold){
 			input.mi.dwFlags = MOUSEEVENTF_LEFTDOWN;
 			::SendInput(1,&input,sizeof(INPUT));
-        } else if (isSingleRelease){
+        } else if (request.singleRelease){
 			input.mi.dwFlags = MOUSEEVENTF_LEFTUP;
 			::SendInput(1,&input,sizeof(INPUT));
-        } else if (isScroll) {
+        } else if (request.scroll) {
 			input.mi.dwFlags = MOUSEEVENTF_WHEEL;
-			input.mi.mouseData = dy;
+			input.mi.mouseData = request.dy;
 			::SendInput(1,&input,sizeof(INPUT));
 
-        } else if (!key.isEmpty() || specialKey) {
+        } else if (!request.key.isEmpty() || request.specialKey) {
             input.type = INPUT_KEYBOARD;
 
             input.ki.time = 0;
@@ -135,36 +122,31 @@ bool WindowsRemoteInput::handlePacket(const NetworkPacket& np)
             input.ki.wScan = 0;
             input.ki.dwFlags = 0;
 
-            bool ctrl = np.get<bool>(QStringLiteral("ctrl"), false);
-            bool alt = np.get<bool>(QStringLiteral("alt"), false);
-            bool shift = np.get<bool>(QStringLiteral("shift"), false);
-            bool super = np.get<bool>(QStringLiteral("super"), false);
-
-            if (ctrl) {
+            if (request.ctrl) {
                 input.ki.wVk = VK_LCONTROL;
                 ::SendInput(1,&input,sizeof(INPUT));
             }
-            if (alt) {
+            if (request.alt) {
                 input.ki.wVk = VK_LMENU;
                 ::SendInput(1,&input,sizeof(INPUT));
             }
-            if (shift) {
+            if (request.shift) {
                 input.ki.wVk = VK_LSHIFT;
                 ::SendInput(1,&input,sizeof(INPUT));
             }
-            if (super) {
+            if (request.super) {
                 input.ki.wVk = VK_LWIN;
                 ::SendInput(1,&input,sizeof(INPUT));
             }
 
-            if (specialKey)
+            if (request.specialKey)
             {
-                if (specialKey >= (int)arraySize(SpecialKeysMap)) {
+                if (request.specialKey >= (int)arraySize(SpecialKeysMap)) {
                     qWarning() << "Unsupported special key identifier";
                     return false;
                 }
 
-                input.ki.wVk = SpecialKeysMap[specialKey];
+                input.ki.wVk = SpecialKeysMap[request.specialKey];
                 ::SendInput(1,&input,sizeof(INPUT));
 
                 input.ki.dwFlags = KEYEVENTF_KEYUP;
@@ -172,8 +154,8 @@ bool WindowsRemoteInput::handlePacket(const NetworkPacket& np)
 
             } else {
 
-                for (int i=0;i<key.length();i++) {
-                    wchar_t inputChar = *QString(key.at(i)).utf16();
+                for (int i=0;i<request.key.length();i++) {
+                    wchar_t inputChar = *QString(request.key.at(i)).utf16();
                     short inputVk = VkKeyScanExW(inputChar, GetKeyboardLayout(0));
 
                     if(inputVk != -1) {
@@ -200,15 +182,15 @@ bool WindowsRemoteInput::handlePacket(const NetworkPacket& np)
                         input.ki.dwFlags = KEYEVENTF_KEYUP;
                         ::SendInput(1,&input,sizeof(INPUT));
 
-                        if ((inputVk & 0x100) && !shift) {
+                        if ((inputVk & 0x100) && !request.shift) {
                             input.ki.wVk = VK_LSHIFT;
                             ::SendInput(1,&input,sizeof(INPUT));
                         }
-                        if ((inputVk & 0x200) && !ctrl) {
+                        if ((inputVk & 0x200) && !request.ctrl) {
                             input.ki.wVk = VK_LCONTROL;
                             ::SendInput(1,&input,sizeof(INPUT));
                         }
-                        if ((inputVk & 0x400) && !alt) {
+                        if ((inputVk & 0x400) && !request.alt) {
                             input.ki.wVk = VK_LMENU;
                             ::SendInput(1,&input,sizeof(INPUT));
                         }
@@ -229,19 +211,19 @@ bool WindowsRemoteInput::handlePacket(const NetworkPacket& np)
             input.ki.dwFlags = KEYEVENTF_KEYUP;
             input.ki.wScan = 0;
 
-            if (ctrl) {
+            if (request.ctrl) {
                 input.ki.wVk = VK_LCONTROL;
                 ::SendInput(1,&input,sizeof(INPUT));
             }
-            if (alt) {
+            if (request.alt) {
                 input.ki.wVk = VK_LMENU;
                 ::SendInput(1,&input,sizeof(INPUT));
             }
-            if (shift) {
+            if (request.shift) {
                 input.ki.wVk = VK_LSHIFT;
                 ::SendInput(1,&input,sizeof(INPUT));
             }
-            if (super) {
+            if (request.super) {
                 input.ki.wVk = VK_LWIN;
                 ::SendInput(1,&input,sizeof(INPUT));
             }
@@ -250,7 +232,7 @@ bool WindowsRemoteInput::handlePacket(const NetworkPacket& np)
 
     } else { //Is a mouse move event
         QPoint point = QCursor::pos();
-        QCursor::setPos(point.x() + (int)dx, point.y() + (int)dy);
+        QCursor::setPos(point.x() + (int)request.dx, point.y() + (int)request.dy);
     }
     return true;
 }
@@ -31,7 +31,7 @@ class WindowsRemoteInput
 public:
     explicit WindowsRemoteInput(QObject* parent);
 
-    bool handlePacket(const NetworkPacket& np) override;
+    bool handlePacket(const MousepadRequest& request) override;
 };
 
 #endif
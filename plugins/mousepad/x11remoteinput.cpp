@@ -106,22 +106,9 @@ bool isLeftHanded(Display * display)
     }
 }
 
-bool X11RemoteInput::handlePacket(const NetworkPacket& np)
+bool X11RemoteInput::handlePacket(const MousepadRequest& request)
 {
-    float dx = np.get<float>(QStringLiteral("dx"), 0);
-    float dy = np.get<float>(QStringLiteral("dy"), 0);
-
-    bool isSingleClick = np.get<bool>(QStringLiteral("singleclick"), false);
-    bool isDoubleClick = np.get<bool>(QStringLiteral("doubleclick"), false);
-    bool isMiddleClick = np.get<bool>(QStringLiteral("middleclick"), false);
-    bool isRightClick = np.get<bool>(QStringLiteral("rightclick"), false);
-    bool isSingleHold = np.get<bool>(QStringLiteral("singlehold"), false);
-    bool isSingleRelease = np.get<bool>(QStringLiteral("singlerelease"), false);
-    bool isScroll = np.get<bool>(QStringLiteral("scroll"), false);
-    QString key = np.get<QString>(QStringLiteral("key"), QLatin1String(""));
-    int specialKey = np.get<int>(QStringLiteral("specialKey"), 0);
-
-    if (isSingleClick || isDoubleClick || isMiddleClick || isRightClick || isSingleHold || isScroll || !key.isEmpty() || specialKey) {
+    if (request.singleClick || request.doubleClick || request.middleClick || request.rightClick || request.singleHold || request.scroll || !request.key.isEmpty() || request.specialKey) {
         Display* display = QX11Info::display();
         if(!display) {
             return false;
@@ -131,54 +118,49 @@ bool X11RemoteInput::handlePacket(const NetworkPacket& np)
         int mainMouseButton = leftHanded? RightMouseButton : LeftMouseButton;
         int secondaryMouseButton = leftHanded? LeftMouseButton : RightMouseButton;
 
-        if (isSingleClick) {
+        if (request.singleClick) {
             XTestFakeButtonEvent(display, mainMouseButton, True, 0);
             XTestFakeButtonEvent(display, mainMouseButton, False, 0);
-        } else if (isDoubleClick) {
+        } else if (request.doubleClick) {
             XTestFakeButtonEvent(display, mainMouseButton, True, 0);
             XTestFakeButtonEvent(display, mainMouseButton, False, 0);
             XTestFakeButtonEvent(display, mainMouseButton, True, 0);
             XTestFakeButtonEvent(display, mainMouseButton, False, 0);
-        } else if (isMiddleClick) {
+        } else if (request.middleClick) {
             XTestFakeButtonEvent(display, MiddleMouseButton, True, 0);
             XTestFakeButtonEvent(display, MiddleMouseButton, False, 0);
-        } else if (isRightClick) {
+        } else if (request.rightClick) {
             XTestFakeButtonEvent(display, secondaryMouseButton, True, 0);
             XTestFakeButtonEvent(display, secondaryMouseButton, False, 0);
-        } else if (isSingleHold){
+        } else if (request.singleHold){
             //For drag'n drop
             XTestFakeButtonEvent(display, mainMouseButton, True, 0);
-        } else if (isSingleRelease){
+        } else if (request.singleRelease){
             //For drag'n drop. NEVER USED (release is done by tapping, which actually triggers a isSingleClick). Kept here for future-proofnes.
             XTestFakeButtonEvent(display, mainMouseButton, False, 0);
-        } else if (isScroll) {
-            if (dy < 0) {
+        } else if (request.scroll) {
+            if (request.dy < 0) {
                 XTestFakeButtonEvent(display, MouseWheelDown, True, 0);
                 XTestFakeButtonEvent(display, MouseWheelDown, False, 0);
-            } else if (dy > 0) {
+            } else if (request.dy > 0) {
                 XTestFakeButtonEvent(display, MouseWheelUp, True, 0);
                 XTestFakeButtonEvent(display, MouseWheelUp, False, 0);
             }
-        } else if (!key.isEmpty() || specialKey) {
+        } else if (!request.key.isEmpty() || request.specialKey) {
 
-            bool ctrl = np.get<bool>(QStringLiteral("ctrl"), false);
-            bool alt = np.get<bool>(QStringLiteral("alt"), false);
-            bool shift = np.get<bool>(QStringLiteral("shift"), false);
-            bool super = np.get<bool>(QStringLiteral("super"), false);
+            if (request.ctrl) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Control_L), True, 0);
+            if (request.alt) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Alt_L), True, 0);
+            if (request.shift) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Shift_L), True, 0);
+            if (request.super) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Super_L), True, 0);
 
-            if (ctrl) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Control_L), True, 0);
-            if (alt) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Alt_L), True, 0);
-            if (shift) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Shift_L), True, 0);
-            if (super) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Super_L), True, 0);
-
-            if (specialKey)
+            if (request.specialKey)
             {
-                if (specialKey >= (int)arraySize(SpecialKeysMap)) {
+                if (request.specialKey >= (int)arraySize(SpecialKeysMap)) {
                     qWarning() << "Unsupported special key identifier";
                     return false;
                 }
 
-                int keycode = XKeysymToKeycode(display, SpecialKeysMap[specialKey]);
+                int keycode = XKeysymToKeycode(display, SpecialKeysMap[request.specialKey]);
 
                 XTestFakeKeyEvent (display, keycode, True, 0);
                 XTestFakeKeyEvent (display, keycode, False, 0);
@@ -194,17 +176,17 @@ bool X11RemoteInput::handlePacket(const NetworkPacket& np)
                 }
 
                 //We use fakekey here instead of XTest (above) because it can handle utf characters instead of keycodes.
-                for (int i=0;i<key.length();i++) {
-                    QByteArray utf8 = QString(key.at(i)).toUtf8();
+                for (int i=0;i<request.key.length();i++) {
+                    QByteArray utf8 = QString(request.key.at(i)).toUtf8();
                     fakekey_press(m_fakekey, (const uchar*)utf8.constData(), utf8.size(), 0);
                     fakekey_release(m_fakekey);
                 }
             }
 
-            if (ctrl) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Control_L), False, 0);
-            if (alt) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Alt_L), False, 0);
-            if (shift) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Shift_L), False, 0);
-            if (super) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Super_L), False, 0);
+            if (request.ctrl) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Control_L), False, 0);
+            if (request.alt) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Alt_L), False, 0);
+            if (request.shift) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Shift_L), False, 0);
+            if (request.super) XTestFakeKeyEvent (display, XKeysymToKeycode(display, XK_Super_L), False, 0);
 
         }
 
@@ -212,7 +194,7 @@ bool X11RemoteInput::handlePacket(const NetworkPacket& np)
 
     } else { //Is a mouse move event
         QPoint point = QCursor::pos();
-        QCursor::setPos(point.x() + (int)dx, point.y() + (int)dy);
+        QCursor::setPos(point.x() + (int)request.dx, point.y() + (int)request.dy);
     }
     return true;
 }
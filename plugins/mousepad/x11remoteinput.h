@@ -34,7 +34,7 @@ public:
     explicit X11RemoteInput(QObject* parent);
     ~X11RemoteInput() override;
 
-    bool handlePacket(const NetworkPacket& np) override;
+    bool handlePacket(const MousepadRequest& request) override;
     bool hasKeyboardSupport() override;
 
 private:
@@ -225,9 +225,9 @@ void MprisControlPlugin::removePlayer(const QString& serviceName)
     sendPlayerList();
 }
 
-bool MprisControlPlugin::sendAlbumArt(const NetworkPacket& np)
+bool MprisControlPlugin::sendAlbumArt(const MprisRequest& request)
 {
-    const QString player = np.get<QString>(QStringLiteral("player"));
+    const QString& player = request.player;
     auto it = playerList.find(player);
     bool valid_player = (it != playerList.end());
     if (!valid_player) {
@@ -240,7 +240,7 @@ bool MprisControlPlugin::sendAlbumArt(const NetworkPacket& np)
 
     //Check if the supplied album art url indeed belongs to this mpris player
     QUrl playerAlbumArtUrl{nowPlayingMap[QStringLiteral("mpris:artUrl")].toString()};
-    QString requestedAlbumArtUrl = np.get<QString>(QStringLiteral("albumArtUrl"));
+    const QString& requestedAlbumArtUrl = request.albumArtUrl;
     if (!playerAlbumArtUrl.isValid() || playerAlbumArtUrl != QUrl(requestedAlbumArtUrl)) {
         return false;
     }
@@ -265,19 +265,24 @@ bool MprisControlPlugin::sendAlbumArt(const NetworkPacket& np)
 
 bool MprisControlPlugin::receivePacket (const NetworkPacket& np)
 {
-    if (np.has(QStringLiteral("playerList"))) {
+    MprisRequest request;
+    if (!request.decode(np)) {
+        return false;
+    }
+
+    if (request.has(MprisRequest::playerListField)) {
         return false; //Whoever sent this is an mpris client and not an mpris control!
     }
 
-    if (np.has(QStringLiteral("albumArtUrl"))) {
-        return sendAlbumArt(np);
+    if (request.has(MprisRequest::albumArtUrlField)) {
+        return sendAlbumArt(request);
     }
 
     //Send the player list
-    const QString player = np.get<QString>(QStringLiteral("player"));
+    const QString& player = request.player;
     auto it = playerList.find(player);
     bool valid_player = (it != playerList.end());
-    if (!valid_player || np.get<bool>(QStringLiteral("requestPlayerList"))) {
+    if (!valid_player || request.requestPlayerList) {
         sendPlayerList();
         if (!valid_player) {
             return true;
@@ -289,25 +294,23 @@ bool MprisControlPlugin::receivePacket (const NetworkPacket& np)
     // turn from pointer to reference to keep the patch diff small,
     // actual patch would change all "mprisInterface." into "mprisInterface->"
     auto& mprisInterface = *it.value().mediaPlayer2PlayerInterface();
-    if (np.has(QStringLiteral("action"))) {
-        const QString& action = np.get<QString>(QStringLiteral("action"));
-        //qCDebug(KDECONNECT_PLUGIN_MPRIS) << "Calling action" << action << "in" << serviceName;
+    if (request.has(MprisRequest::actionField)) {
+        //qCDebug(KDECONNECT_PLUGIN_MPRIS) << "Calling action" << request.action << "in" << serviceName;
         //TODO: Check for valid actions, currently we trust anything the other end sends us
-        mprisInterface.call(action);
+        mprisInterface.call(request.action);
     }
-    if (np.has(QStringLiteral("setVolume"))) {
-        double volume = np.get<int>(QStringLiteral("setVolume"))/100.f;
+    if (request.has(MprisRequest::setVolumeField)) {
+        double volume = request.setVolume/100.f;
         qCDebug(KDECONNECT_PLUGIN_MPRIS) << "Setting volume" << volume << "to" << serviceName;
         mprisInterface.setVolume(volume);
     }
-    if (np.has(QStringLiteral("Seek"))) {
-        int offset = np.get<int>(QStringLiteral("Seek"));
-        //qCDebug(KDECONNECT_PLUGIN_MPRIS) << "Seeking" << offset << "to" << serviceName;
-        mprisInterface.Seek(offset);
+    if (request.has(MprisRequest::seekField)) {
+        //qCDebug(KDECONNECT_PLUGIN_MPRIS) << "Seeking" << request.seek << "to" << serviceName;
+        mprisInterface.Seek(request.seek);
     }
 
-    if (np.has(QStringLiteral("SetPosition"))){
-        qlonglong position = np.get<qlonglong>(QStringLiteral("SetPosition"),0)*1000;
+    if (request.has(MprisRequest::setPositionField)){
+        qlonglong position = request.setPosition*1000;
         qlonglong seek = position - mprisInterface.position();
         //qCDebug(KDECONNECT_PLUGIN_MPRIS) << "Setting position by seeking" << seek << "to" << serviceName;
         mprisInterface.Seek(seek);
@@ -316,7 +319,7 @@ bool MprisControlPlugin::receivePacket (const NetworkPacket& np)
     //Send something read from the mpris interface
     NetworkPacket answer(PACKET_TYPE_MPRIS);
     bool somethingToSend = false;
-    if (np.get<bool>(QStringLiteral("requestNowPlaying"))) {
+    if (request.requestNowPlaying) {
         QVariantMap nowPlayingMap = mprisInterface.metadata();
         mprisPlayerMetadataToNetworkPacket(answer, nowPlayingMap);
 
@@ -334,7 +337,7 @@ bool MprisControlPlugin::receivePacket (const NetworkPacket& np)
 
         somethingToSend = true;
     }
-    if (np.get<bool>(QStringLiteral("requestVolume"))) {
+    if (request.requestVolume) {
         int volume = (int)(mprisInterface.volume() * 100);
         answer.set(QStringLiteral("volume"),volume);
         somethingToSend = true;
@@ -28,6 +28,7 @@
 #include <QSharedPointer>
 
 #include <core/kdeconnectplugin.h>
+#include <core/packetview.h>
 
 
 class OrgFreedesktopDBusPropertiesInterface;
@@ -53,6 +54,21 @@ private:
 
 #define PACKET_TYPE_MPRIS QStringLiteral("kdeconnect.mpris")
 
+#define MPRIS_REQUEST_FIELDS(FIELD) \
+    FIELD(QStringList, playerList, "playerList", QStringList()) \
+    FIELD(QString, albumArtUrl, "albumArtUrl", QString()) \
+    FIELD(QString, player, "player", QString()) \
+    FIELD(bool, requestPlayerList, "requestPlayerList", false) \
+    FIELD(QString, action, "action", QString()) \
+    FIELD(int, setVolume, "setVolume", 0) \
+    FIELD(int, seek, "Seek", 0) \
+    FIELD(qlonglong, setPosition, "SetPosition", 0) \
+    FIELD(bool, requestNowPlaying, "requestNowPlaying", false) \
+    FIELD(bool, requestVolume, "requestVolume", false)
+
+//A kdeconnect.mpris.request packet, see PacketView
+KDECONNECT_PACKET_VIEW(MprisRequest, MPRIS_REQUEST_FIELDS)
+
 Q_DECLARE_LOGGING_CATEGORY(KDECONNECT_PLUGIN_MPRIS)
 
 class MprisControlPlugin
@@ -76,7 +92,7 @@ private:
     void removePlayer(const QString& serviceName);
     void sendPlayerList();
     void mprisPlayerMetadataToNetworkPacket(NetworkPacket& np, const QVariantMap& nowPlayingMap) const;
-    bool sendAlbumArt(const NetworkPacket& np);
+    bool sendAlbumArt(const MprisRequest& request);
 
     QHash<QString, MprisPlayer> playerList;
     int prevVolume;
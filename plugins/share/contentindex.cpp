@@ -0,0 +1,205 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "contentindex.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrentRun>
+
+ContentIndex::ContentIndex(const QString& indexFile, QObject* parent)
+    : QObject(parent)
+    , m_indexFile(indexFile)
+    , m_dirty(false)
+{
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(SaveDelay);
+    connect(&m_saveTimer, &QTimer::timeout, this, &ContentIndex::save);
+    load();
+}
+
+ContentIndex::~ContentIndex()
+{
+    //Lookups still running add to the index as they go
+    for (QFuture<QString>& lookup : m_lookups) {
+        lookup.waitForFinished();
+    }
+    save();
+}
+
+QString ContentIndex::indexFileFor(const QString& deviceId)
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/kdeconnect/share_content_index_") + deviceId + QStringLiteral(".json");
+}
+
+QFuture<QString> ContentIndex::find(const QByteArray& digest, qint64 size, const QString& dir)
+{
+    for (auto it = m_lookups.begin(); it != m_lookups.end();) {
+        if (it->isFinished()) {
+            it = m_lookups.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    const QFuture<QString> lookup = QtConcurrent::run(this, &ContentIndex::lookup, digest, size, dir);
+    m_lookups.append(lookup);
+    return lookup;
+}
+
+QString ContentIndex::lookup(const QByteArray& digest, qint64 size, const QString& dir)
+{
+    QMutexLocker locker(&m_mutex);
+    const QHash<QString, Entry> entries = m_entries;
+    locker.unlock();
+
+    for (auto it = entries.constBegin(), itEnd = entries.constEnd(); it != itEnd; ++it) {
+        if (it->size == size && it->digest == digest && isCurrent(it.key(), *it)) {
+            return it.key();
+        }
+    }
+
+    if (size > MaxScanSize) {
+        return QString();
+    }
+
+    //Only files of the very same size can have the same contents
+    const QFileInfoList files = QDir(dir).entryInfoList(QDir::Files | QDir::Readable);
+    for (const QFileInfo& file : files) {
+        if (file.size() != size) {
+            continue;
+        }
+        const QString path = file.absoluteFilePath();
+        const auto it = entries.constFind(path);
+        if (it != entries.constEnd() && isCurrent(path, *it)) {
+            continue; //Already compared above
+        }
+        const QByteArray fileDigest = hashFile(path);
+        if (fileDigest.isEmpty()) {
+            continue;
+        }
+        insert(path, fileDigest);
+        if (fileDigest == digest) {
+            return path;
+        }
+    }
+    return QString();
+}
+
+void ContentIndex::add(const QString& path, const QByteArray& digest)
+{
+    insert(path, digest);
+}
+
+void ContentIndex::insert(const QString& path, const QByteArray& digest)
+{
+    const QFileInfo info(path);
+    if (!info.isFile()) {
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (m_entries.size() >= MaxEntries) {
+        for (auto it = m_entries.begin(); it != m_entries.end();) {
+            if (isCurrent(it.key(), *it)) {
+                ++it;
+            } else {
+                it = m_entries.erase(it);
+            }
+        }
+        while (m_entries.size() >= MaxEntries) {
+            m_entries.erase(m_entries.begin());
+        }
+    }
+
+    m_entries.insert(info.absoluteFilePath(), { info.size(), info.lastModified().toMSecsSinceEpoch(), digest });
+    m_dirty = true;
+    //Several files hashed or received in a row are written out once
+    QMetaObject::invokeMethod(&m_saveTimer, "start", Qt::QueuedConnection);
+}
+
+QByteArray ContentIndex::hashFile(const QString& path)
+{
+    QFile file(path);
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file)) {
+        return QByteArray();
+    }
+    return hash.result();
+}
+
+bool ContentIndex::isCurrent(const QString& path, const Entry& entry)
+{
+    const QFileInfo info(path);
+    return info.isFile() && info.size() == entry.size && info.lastModified().toMSecsSinceEpoch() == entry.mtime;
+}
+
+void ContentIndex::load()
+{
+    QFile file(m_indexFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    const QJsonObject index = QJsonDocument::fromJson(file.readAll()).object();
+    for (auto it = index.constBegin(), itEnd = index.constEnd(); it != itEnd; ++it) {
+        const QJsonObject entry = it.value().toObject();
+        const QByteArray digest = QByteArray::fromHex(entry.value(QStringLiteral("sha256")).toString().toLatin1());
+        if (digest.size() == 32) {
+            m_entries.insert(it.key(), { qint64(entry.value(QStringLiteral("size")).toDouble()),
+                                         qint64(entry.value(QStringLiteral("mtime")).toDouble()), digest });
+        }
+    }
+}
+
+void ContentIndex::save()
+{
+    QJsonObject index;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_dirty) {
+            return;
+        }
+        m_dirty = false;
+        for (auto it = m_entries.constBegin(), itEnd = m_entries.constEnd(); it != itEnd; ++it) {
+            index.insert(it.key(), QJsonObject {
+                { QStringLiteral("size"), double(it->size) },
+                { QStringLiteral("mtime"), double(it->mtime) },
+                { QStringLiteral("sha256"), QString::fromLatin1(it->digest.toHex()) }
+            });
+        }
+    }
+
+    QDir().mkpath(QFileInfo(m_indexFile).absolutePath());
+    QSaveFile file(m_indexFile);
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(QJsonDocument(index).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+}
@@ -0,0 +1,93 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CONTENTINDEX_H
+#define CONTENTINDEX_H
+
+#include <QByteArray>
+#include <QFuture>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+/**
+ * @short Remembers the SHA-256 of files a device sent us
+ *
+ * There is one per device, so a peer can only ever find out about files it sent
+ * itself or that are in the folder its shares are saved to. Received files whose
+ * digest was verified are added as they arrive, and files of that folder with
+ * the size asked for are hashed on demand, on a worker thread. Entries are keyed
+ * by path and only trusted while size and modification time still match, so a
+ * file edited since is hashed again or ignored.
+ */
+class ContentIndex
+    : public QObject
+{
+    Q_OBJECT
+
+public:
+    //Files up to this size are hashed when looked up, bigger ones are only known once received
+    static const qint64 MaxScanSize = 64 * 1024 * 1024;
+    static const int MaxEntries = 1000;
+    //Changes are written to the index file at most this often, in ms
+    static const int SaveDelay = 2000;
+
+    explicit ContentIndex(const QString& indexFile, QObject* parent = nullptr);
+    ~ContentIndex() override;
+
+    //Where the index of @p deviceId is stored, in the cache directory
+    static QString indexFileFor(const QString& deviceId);
+
+    /**
+     * Looks for a file with the given SHA-256 and size, in the index or in
+     * @p dir, on a worker thread. The result is an empty string if there's none.
+     */
+    QFuture<QString> find(const QByteArray& digest, qint64 size, const QString& dir);
+    void add(const QString& path, const QByteArray& digest);
+
+    static QByteArray hashFile(const QString& path);
+
+private Q_SLOTS:
+    void save();
+
+private:
+    struct Entry {
+        qint64 size;
+        qint64 mtime;
+        QByteArray digest;
+    };
+
+    QString lookup(const QByteArray& digest, qint64 size, const QString& dir);
+    void insert(const QString& path, const QByteArray& digest);
+    static bool isCurrent(const QString& path, const Entry& entry);
+    void load();
+
+    const QString m_indexFile;
+    QMutex m_mutex; //Guards m_entries, which lookups on worker threads add to
+    QHash<QString, Entry> m_entries;
+    bool m_dirty; //Entries changed since they were saved
+    QTimer m_saveTimer;
+    QList<QFuture<QString>> m_lookups;
+};
+
+#endif
@@ -0,0 +1,123 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "sharebatchjob.h"
+#include "share_debug.h"
+
+#include <KLocalizedString>
+
+ShareBatchJob::ShareBatchJob(int numberOfFiles, qint64 totalSize, const QString& from, QObject* parent)
+    : KJob(parent)
+    , m_numberOfFiles(numberOfFiles)
+    , m_from(from)
+    , m_finishedBytes(0)
+    , m_finishedFiles(0)
+    , m_failedFiles(0)
+{
+    setCapabilities(Killable);
+    setTotalAmount(Bytes, totalSize);
+    setTotalAmount(Files, numberOfFiles);
+    setProcessedAmount(Files, 0);
+}
+
+void ShareBatchJob::start()
+{
+    description(this, i18np("Receiving file over KDE Connect", "Receiving %1 files over KDE Connect", m_numberOfFiles),
+        { i18nc("File transfer origin", "From"), m_from }
+    );
+    m_timer.start();
+}
+
+void ShareBatchJob::addJob(KJob* job)
+{
+    m_jobs.insert(job, 0);
+    connect(job, &KJob::processedAmount, this, &ShareBatchJob::jobProgress);
+    connect(job, &KJob::result, this, &ShareBatchJob::jobFinished);
+}
+
+void ShareBatchJob::jobProgress(KJob* job, KJob::Unit unit, qulonglong amount)
+{
+    if (unit != Bytes || !m_jobs.contains(job)) {
+        return;
+    }
+    m_jobs[job] = amount;
+    updateProgress();
+}
+
+void ShareBatchJob::jobFinished(KJob* job)
+{
+    m_finishedBytes += m_jobs.take(job);
+    if (job->error()) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "File of a batch failed" << job->errorString();
+    }
+    fileDone(job->error());
+}
+
+void ShareBatchJob::addExistingFile(qint64 size)
+{
+    m_finishedBytes += size;
+    fileDone(false);
+}
+
+void ShareBatchJob::fileDone(bool failed)
+{
+    if (failed) {
+        ++m_failedFiles;
+    } else {
+        ++m_finishedFiles;
+    }
+    setProcessedAmount(Files, m_finishedFiles);
+    updateProgress();
+
+    if (m_finishedFiles + m_failedFiles < m_numberOfFiles) {
+        return;
+    }
+    if (m_failedFiles) {
+        setError(UserDefinedError);
+        setErrorText(i18np("%1 file could not be received from: %2", "%1 files could not be received from: %2", m_failedFiles, m_from));
+    }
+    emitResult();
+}
+
+void ShareBatchJob::updateProgress()
+{
+    qulonglong processed = m_finishedBytes;
+    for (qulonglong bytes : qAsConst(m_jobs)) {
+        processed += bytes;
+    }
+    setProcessedAmount(Bytes, processed);
+
+    //Trackers derive the remaining time from this and the total
+    const qint64 elapsed = m_timer.elapsed();
+    if (elapsed > 0) {
+        emitSpeed(1000 * processed / elapsed);
+    }
+}
+
+bool ShareBatchJob::doKill()
+{
+    const QList<KJob*> jobs = m_jobs.keys();
+    m_jobs.clear();
+    for (KJob* job : jobs) {
+        job->kill();
+    }
+    return true;
+}
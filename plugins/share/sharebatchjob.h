@@ -0,0 +1,70 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SHAREBATCHJOB_H
+#define SHAREBATCHJOB_H
+
+#include <KJob>
+
+#include <QElapsedTimer>
+#include <QHash>
+
+/**
+ * @short Reports the files of one batch share as a single job
+ *
+ * The sender announces how many files and bytes a batch has in every one of its
+ * packets, so the totals are known from the first file on. Progress, speed and
+ * therefore the remaining time add up the transfer jobs of all its files.
+ */
+class ShareBatchJob
+    : public KJob
+{
+    Q_OBJECT
+
+public:
+    ShareBatchJob(int numberOfFiles, qint64 totalSize, const QString& from, QObject* parent = nullptr);
+
+    void start() override;
+    void addJob(KJob* job);
+    ///A file that was there already, which counts as received at once
+    void addExistingFile(qint64 size);
+
+protected:
+    bool doKill() override;
+
+private Q_SLOTS:
+    void jobProgress(KJob* job, KJob::Unit unit, qulonglong amount);
+    void jobFinished(KJob* job);
+
+private:
+    void fileDone(bool failed);
+    void updateProgress();
+
+    const int m_numberOfFiles;
+    const QString m_from;
+    QHash<KJob*, qulonglong> m_jobs; //Bytes processed by the running jobs
+    qulonglong m_finishedBytes;
+    int m_finishedFiles;
+    int m_failedFiles;
+    QElapsedTimer m_timer;
+};
+
+#endif
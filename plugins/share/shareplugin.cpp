@@ -28,24 +28,62 @@
 #include <QDBusConnection>
 #include <QDebug>
 #include <QTemporaryFile>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+#include <QBuffer>
+#include <QUuid>
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
 
 #include <KLocalizedString>
 #include <KJobTrackerInterface>
 #include <KPluginFactory>
 #include <KIO/MkpathJob>
+#include <KIO/FileCopyJob>
 
 #include "core/filetransferjob.h"
+#include "core/hashingfile.h"
+#include "core/deltatransfer.h"
+#include "sharebatchjob.h"
+#include "contentindex.h"
+
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 K_PLUGIN_FACTORY_WITH_JSON( KdeConnectPluginFactory, "kdeconnect_share.json", registerPlugin< SharePlugin >(); )
 
 Q_LOGGING_CATEGORY(KDECONNECT_PLUGIN_SHARE, "kdeconnect.plugin.share")
 
+//Interrupted transfers are retried this many times while the device stays reachable,
+//after that only when it connects again
+static const int MaxResumeAttempts = 3;
+static const int ResumeDelay = 5000;
+//Partial files nobody resumed are dropped after a week
+static const qint64 PartialExpiry = 7 * 24 * 3600;
+static const int MaxRememberedTransfers = 16;
+//Files of a batch being uploaded at the same time
+static const int MaxConcurrentUploads = 4;
+//Deltas are offered for files at least this big, and built against older copies up to this big
+static const qint64 MinDeltaSize = 64 * 1024;
+static const qint64 MaxDeltaBaseSize = 256 * 1024 * 1024;
+static const qint64 MaxSignaturesSize = 32 * 1024 * 1024;
+static const int SignaturesTimeout = 30000;
+//How long an older copy is kept for a delta the sender didn't start yet, it may be queued behind other uploads
+static const int DeltaBaseTimeout = 10 * 60 * 1000;
+
 SharePlugin::SharePlugin(QObject* parent, const QVariantList& args)
     : KdeConnectPlugin(parent, args)
+    , m_contentIndex(new ContentIndex(ContentIndex::indexFileFor(device()->id()), this))
+    , m_activeUploads(0)
 {
 }
 
-QUrl SharePlugin::destinationDir() const
+QUrl SharePlugin::incomingDir() const
 {
     const QString defaultDownloadPath = QStandardPaths::writableLocation(QStandardPaths::DownloadLocation);
     QUrl dir = QUrl::fromLocalFile(config()->get<QString>(QStringLiteral("incoming_path"), defaultDownloadPath));
@@ -53,6 +91,12 @@ QUrl SharePlugin::destinationDir() const
     if (dir.path().contains(QLatin1String("%1"))) {
         dir.setPath(dir.path().arg(device()->name()));
     }
+    return dir;
+}
+
+QUrl SharePlugin::destinationDir() const
+{
+    const QUrl dir = incomingDir();
 
     KJob* job = KIO::mkpath(dir);
     bool ret = job->exec();
@@ -63,12 +107,92 @@ QUrl SharePlugin::destinationDir() const
     return dir;
 }
 
+//Makes destination share the blocks of source on filesystems that can (btrfs, xfs), without copying anything
+static bool cloneFile(const QString& source, const QString& destination)
+{
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    QFile in(source);
+    QFile out(destination);
+    if (!in.open(QIODevice::ReadOnly) || !out.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    if (ioctl(out.handle(), FICLONE, in.handle()) == 0) {
+        return true;
+    }
+    out.remove();
+#else
+    Q_UNUSED(source);
+    Q_UNUSED(destination);
+#endif
+    return false;
+}
+
 static QString cleanFilename(const QString &filename)
 {
     int idx = filename.lastIndexOf(QLatin1Char('/'));
     return idx>=0 ? filename.mid(idx + 1) : filename;
 }
 
+//Identifies the contents being shared, so a resumed transfer never mixes two versions of a file
+static QString transferIdFor(const QFileInfo& info)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(info.canonicalFilePath().toUtf8());
+    hash.addData(QByteArray::number(info.size()));
+    hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+//Transfer ids end up in file names, so only accept what transferIdFor() generates
+static bool isValidTransferId(const QString& transferId)
+{
+    if (transferId.size() != 40) {
+        return false;
+    }
+    for (const QChar c : transferId) {
+        if (!c.isDigit() && (c < QLatin1Char('a') || c > QLatin1Char('f'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//Partial files live hidden next to the final ones, with a sidecar describing them
+static QString partialPath(const QString& dir, const QString& transferId)
+{
+    return dir + QStringLiteral("/.kdeconnect-") + transferId + QStringLiteral(".part");
+}
+
+static QString sidecarPath(const QString& dir, const QString& transferId)
+{
+    return dir + QStringLiteral("/.kdeconnect-") + transferId + QStringLiteral(".resume");
+}
+
+static QJsonObject readSidecar(const QString& path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QJsonObject();
+    }
+    return QJsonDocument::fromJson(file.readAll()).object();
+}
+
+static void writeSidecar(const QString& path, const QJsonObject& sidecar)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCWarning(KDECONNECT_PLUGIN_SHARE) << "Couldn't write" << path << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(sidecar).toJson(QJsonDocument::Compact));
+}
+
+static void removePartial(const QString& dir, const QString& transferId)
+{
+    QFile::remove(partialPath(dir, transferId));
+    QFile::remove(sidecarPath(dir, transferId));
+}
+
 bool SharePlugin::receivePacket(const NetworkPacket& np)
 {
 /*
@@ -90,23 +214,39 @@ bool SharePlugin::receivePacket(const NetworkPacket& np)
     }
 */
 
+    if (np.type() == PACKET_TYPE_SHARE_SIGNATURES) {
+        //The peer has an older copy of a file we shared, and describes it
+        receiveSignatures(np);
+        return true;
+    } else if (np.type() == PACKET_TYPE_SHARE_DIGEST) {
+        //The digest of a payload we just received, computed by the sender while reading it
+        FileTransferJob* job = m_incomingJobs.value(np.get<QString>(QStringLiteral("transferId")));
+        if (job) {
+            job->setDigest(QByteArray::fromHex(np.get<QByteArray>(QStringLiteral("sha256"))));
+        }
+        return true;
+    } else if (np.type() == PACKET_TYPE_SHARE_HAVE) {
+        //The peer already had a file we shared and won't fetch it, stop waiting for it
+        const QSharedPointer<HashingFile> file = m_offeredFiles.take(np.get<QString>(QStringLiteral("transferId"))).toStrongRef();
+        if (file) {
+            file->close();
+        }
+        return true;
+    } else if (np.type() == PACKET_TYPE_SHARE_RESUME) {
+        //The peer lost part of a file we shared, and asks for the rest of it
+        resumeUpload(np.get<QString>(QStringLiteral("transferId")), np.get<qint64>(QStringLiteral("offset")));
+        return true;
+    }
+
     qCDebug(KDECONNECT_PLUGIN_SHARE) << "File transfer";
 
     if (np.hasPayload()) {
         const QString filename = cleanFilename(np.get<QString>(QStringLiteral("filename"), QString::number(QDateTime::currentMSecsSinceEpoch())));
         const QUrl dir = destinationDir().adjusted(QUrl::StripTrailingSlash);
-        QUrl destination(dir);
-        destination.setPath(dir.path() + '/' + filename, QUrl::DecodedMode);
-        if (destination.isLocalFile() && QFile::exists(destination.toLocalFile())) {
-            destination.setPath(dir.path() + '/' + KIO::suggestName(dir, filename), QUrl::DecodedMode);
+        if (dir.isLocalFile() && receiveExisting(np, dir.toLocalFile(), filename)) {
+            return true;
         }
-//         qCDebug(KDECONNECT_PLUGIN_SHARE) << "receiving file" << filename << "in" << dir << "into" << destination;
-
-        FileTransferJob* job = np.createPayloadTransferJob(destination);
-        job->setOriginName(device()->name() + ": " + filename);
-        connect(job, &KJob::result, this, &SharePlugin::finished);
-        KIO::getJobTracker()->registerJob(job);
-        job->start();
+        receiveFile(np, dir, filename);
     } else if (np.has(QStringLiteral("text"))) {
         QString text = np.get<QString>(QStringLiteral("text"));
         if (!QStandardPaths::findExecutable(QStringLiteral("kate")).isEmpty()) {
@@ -137,6 +277,32 @@ bool SharePlugin::receivePacket(const NetworkPacket& np)
     return true;
 }
 
+void SharePlugin::receiveFile(const NetworkPacket& np, const QUrl& dir, const QString& filename)
+{
+    const QString transferId = np.get<QString>(QStringLiteral("transferId"));
+    if (dir.isLocalFile() && isValidTransferId(transferId) && np.get<bool>(QStringLiteral("delta"))
+        && requestDelta(np, dir.toLocalFile(), filename, transferId)) {
+        return;
+    }
+    if (dir.isLocalFile() && isValidTransferId(transferId) && (np.payloadSize() >= 0 || np.get<bool>(QStringLiteral("deltaEncoded")))) {
+        receiveResumable(np, dir, filename, transferId);
+        return;
+    }
+
+    QUrl destination(dir);
+    destination.setPath(dir.path() + '/' + filename, QUrl::DecodedMode);
+    if (destination.isLocalFile() && QFile::exists(destination.toLocalFile())) {
+        destination.setPath(dir.path() + '/' + KIO::suggestName(dir, filename), QUrl::DecodedMode);
+    }
+//     qCDebug(KDECONNECT_PLUGIN_SHARE) << "receiving file" << filename << "in" << dir << "into" << destination;
+
+    FileTransferJob* job = np.createPayloadTransferJob(destination);
+    job->setOriginName(device()->name() + ": " + filename);
+    connect(job, &KJob::result, this, &SharePlugin::finished);
+    trackJob(np, job);
+    job->start();
+}
+
 void SharePlugin::finished(KJob* job)
 {
     FileTransferJob* ftjob = qobject_cast<FileTransferJob*>(job);
@@ -148,6 +314,422 @@ void SharePlugin::finished(KJob* job)
     }
 }
 
+void SharePlugin::receiveResumable(const NetworkPacket& np, const QUrl& dir, const QString& filename, const QString& transferId)
+{
+    const QString dirPath = dir.toLocalFile();
+    const QString partPath = partialPath(dirPath, transferId);
+    //A delta rebuilds the whole file, its payload size says nothing about it
+    const bool delta = np.get<bool>(QStringLiteral("deltaEncoded"));
+    //Whatever the sender answered with, the older copy is no longer waited on
+    const QString deltaBase = m_deltaBases.take(transferId);
+    const qint64 offset = delta ? 0 : np.get<qint64>(QStringLiteral("offset"), 0);
+    const qint64 size = delta ? np.get<qint64>(QStringLiteral("size")) : offset + np.payloadSize();
+
+    if (delta && deltaBase.isEmpty()) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Got a delta of" << filename << "we didn't ask for, asking for all of it";
+        requestFile(transferId, 0);
+        return;
+    }
+    if (offset > 0) {
+        const QJsonObject sidecar = readSidecar(sidecarPath(dirPath, transferId));
+        if (sidecar.value(QStringLiteral("size")).toDouble() != size || QFileInfo(partPath).size() < offset) {
+            qCDebug(KDECONNECT_PLUGIN_SHARE) << "Can't resume" << filename << "at" << offset << ", asking for all of it";
+            removePartial(dirPath, transferId);
+            requestFile(transferId, 0);
+            return;
+        }
+    } else {
+        writeSidecar(sidecarPath(dirPath, transferId), {
+            { QStringLiteral("filename"), filename },
+            { QStringLiteral("size"), size },
+            { QStringLiteral("offset"), 0 },
+            { QStringLiteral("deviceId"), device()->id() }
+        });
+    }
+
+    FileTransferJob* job = delta ? new FileTransferJob(np.payload(), size, QUrl::fromLocalFile(partPath))
+                                 : np.createPayloadTransferJob(QUrl::fromLocalFile(partPath));
+    job->setResumeOffset(offset);
+    if (delta && !job->setDeltaBase(deltaBase, np.get<int>(QStringLiteral("blockSize")))) {
+        delete job;
+        requestFile(transferId, 0);
+        return;
+    }
+    if (np.get<QString>(QStringLiteral("hash")) == QLatin1String("sha256")) {
+        job->setVerifyDigest(true);
+        m_incomingJobs.insert(transferId, job);
+    }
+    job->setOriginName(device()->name() + ": " + filename);
+    connect(job, &KJob::result, this, [this, dirPath, filename, transferId](KJob* job) {
+        resumableFinished(job, dirPath, filename, transferId);
+    });
+    trackJob(np, job);
+    job->start();
+}
+
+void SharePlugin::resumableFinished(KJob* job, const QString& dir, const QString& filename, const QString& transferId)
+{
+    const QString partPath = partialPath(dir, transferId);
+    m_incomingJobs.remove(transferId);
+
+    if (!job->error()) {
+        m_resumeAttempts.remove(transferId);
+        QString destination = dir + '/' + filename;
+        if (QFile::exists(destination)) {
+            destination = dir + '/' + KIO::suggestName(QUrl::fromLocalFile(dir), filename);
+        }
+        if (!QFile::rename(partPath, destination)) {
+            qCWarning(KDECONNECT_PLUGIN_SHARE) << "Couldn't move" << partPath << "to" << destination;
+            return;
+        }
+        QFile::remove(sidecarPath(dir, transferId));
+        //A digest covering the whole file makes it available to later shares of the same contents
+        FileTransferJob* ftjob = qobject_cast<FileTransferJob*>(job);
+        if (ftjob && ftjob->resumeOffset() == 0 && !ftjob->digest().isEmpty()) {
+            m_contentIndex->add(destination, ftjob->digest());
+        }
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "File transfer finished." << destination;
+        Q_EMIT shareReceived(QUrl::fromLocalFile(destination).toString());
+        return;
+    }
+
+    if (job->error() == FileTransferJob::DigestMismatchError) {
+        //Some of what we kept is wrong, and there is no telling which part: start over
+        removePartial(dir, transferId);
+        if (++m_resumeAttempts[transferId] <= MaxResumeAttempts) {
+            requestFile(transferId, 0);
+        }
+        return;
+    }
+
+    const qint64 offset = QFileInfo(partPath).size();
+    QJsonObject sidecar = readSidecar(sidecarPath(dir, transferId));
+    if (offset <= 0 || sidecar.isEmpty()) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "File transfer failed." << filename << job->errorString();
+        removePartial(dir, transferId);
+        return;
+    }
+
+    qCDebug(KDECONNECT_PLUGIN_SHARE) << "File transfer interrupted, keeping" << offset << "bytes of" << filename;
+    sidecar[QStringLiteral("offset")] = offset;
+    writeSidecar(sidecarPath(dir, transferId), sidecar);
+
+    if (++m_resumeAttempts[transferId] <= MaxResumeAttempts) {
+        QTimer::singleShot(ResumeDelay, this, [this, dir, transferId]() {
+            requestResume(dir, transferId);
+        });
+    }
+}
+
+void SharePlugin::requestResume(const QString& dir, const QString& transferId)
+{
+    const QJsonObject sidecar = readSidecar(sidecarPath(dir, transferId));
+    if (sidecar.isEmpty() || !device()->isReachable()) {
+        return;
+    }
+
+    //Only trust the bytes that made it to disk
+    const qint64 offset = qMin<qint64>(sidecar.value(QStringLiteral("offset")).toDouble(), QFileInfo(partialPath(dir, transferId)).size());
+    qCDebug(KDECONNECT_PLUGIN_SHARE) << "Asking to resume" << sidecar.value(QStringLiteral("filename")).toString() << "at" << offset;
+    requestFile(transferId, offset);
+}
+
+void SharePlugin::requestFile(const QString& transferId, qint64 offset)
+{
+    NetworkPacket packet(PACKET_TYPE_SHARE_RESUME);
+    packet.set<QString>(QStringLiteral("transferId"), transferId);
+    packet.set<qint64>(QStringLiteral("offset"), offset);
+    sendPacket(packet);
+}
+
+bool SharePlugin::requestDelta(const NetworkPacket& np, const QString& dir, const QString& filename, const QString& transferId)
+{
+    //An older copy under the same name is what the new one most likely was made from
+    const QFileInfo base(dir + '/' + filename);
+    if (np.has(QStringLiteral("offset")) || !base.isFile() || base.size() < MinDeltaSize || base.size() > MaxDeltaBaseSize) {
+        return false;
+    }
+
+    //Reading all of the older copy takes a while, the full payload waits meanwhile
+    const QString basePath = base.filePath();
+    QFutureWatcher<QByteArray>* watcher = new QFutureWatcher<QByteArray>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, np, dir, filename, transferId, basePath]() {
+        watcher->deleteLater();
+        const QByteArray signatures = watcher->result();
+        if (signatures.isEmpty()) {
+            receiveResumable(np, QUrl::fromLocalFile(dir), filename, transferId);
+        } else {
+            sendSignatures(np, transferId, basePath, signatures);
+        }
+    });
+    watcher->setFuture(QtConcurrent::run(&DeltaSignatures::compute, basePath, DeltaSignatures::blockSizeFor(base.size())));
+    return true;
+}
+
+void SharePlugin::sendSignatures(const NetworkPacket& np, const QString& transferId, const QString& basePath, const QByteArray& signatures)
+{
+    m_deltaBases.insert(transferId, basePath);
+    QTimer::singleShot(DeltaBaseTimeout, this, [this, transferId, basePath]() {
+        if (m_deltaBases.value(transferId) == basePath) {
+            qCDebug(KDECONNECT_PLUGIN_SHARE) << "No delta arrived for" << basePath;
+            m_deltaBases.remove(transferId);
+        }
+    });
+    qCDebug(KDECONNECT_PLUGIN_SHARE) << "Asking for a delta of" << transferId << "against" << basePath;
+
+    //The full payload is left alone, the sender answers with a delta instead. What the
+    //batch needs to know comes back with it.
+    NetworkPacket reply(PACKET_TYPE_SHARE_SIGNATURES);
+    for (const QString& key : { QStringLiteral("batchId"), QStringLiteral("numberOfFiles"), QStringLiteral("totalPayloadSize"), QStringLiteral("open") }) {
+        if (np.has(key)) {
+            reply.body().insert(key, np.body().value(key));
+        }
+    }
+    reply.set<QString>(QStringLiteral("transferId"), transferId);
+    QSharedPointer<QBuffer> buffer(new QBuffer);
+    buffer->setData(signatures);
+    reply.setPayload(buffer, signatures.size());
+    sendPacket(reply);
+}
+
+void SharePlugin::receiveSignatures(const NetworkPacket& np)
+{
+    const QString transferId = np.get<QString>(QStringLiteral("transferId"));
+    if (np.payloadSize() <= 0 || np.payloadSize() > MaxSignaturesSize || !np.payload() || m_signatureReads.contains(transferId)) {
+        resumeUpload(transferId, 0);
+        return;
+    }
+
+    m_signatureReads.insert(transferId, { np, QByteArray() });
+    QIODevice* payload = np.payload().data();
+    connect(payload, &QIODevice::readyRead, this, [this, transferId]() { readSignatures(transferId); });
+    connect(payload, &QIODevice::readChannelFinished, this, [this, transferId]() { readSignatures(transferId); });
+    QTimer::singleShot(SignaturesTimeout, this, [this, transferId]() {
+        if (m_signatureReads.remove(transferId)) {
+            qCDebug(KDECONNECT_PLUGIN_SHARE) << "The signatures for" << transferId << "didn't arrive, sending all of it";
+            resumeUpload(transferId, 0);
+        }
+    });
+    readSignatures(transferId);
+}
+
+void SharePlugin::readSignatures(const QString& transferId)
+{
+    auto it = m_signatureReads.find(transferId);
+    if (it == m_signatureReads.end()) {
+        return;
+    }
+    const QSharedPointer<QIODevice> payload = it->packet.payload();
+    if (payload->isOpen()) {
+        it->data += payload->read(it->packet.payloadSize() - it->data.size());
+    }
+    if (it->data.size() < it->packet.payloadSize()) {
+        return;
+    }
+
+    const SignatureRead read = *it;
+    m_signatureReads.erase(it);
+    payload->disconnect(this);
+
+    DeltaSignatures signatures;
+    if (!signatures.parse(read.data)) {
+        qCWarning(KDECONNECT_PLUGIN_SHARE) << "Invalid signatures for" << transferId << ", sending all of it";
+        resumeUpload(transferId, 0);
+        return;
+    }
+    //Takes a slot like the files of a batch, it's reading a whole file too
+    m_pendingDeltas.enqueue({ read.packet, transferId, signatures });
+    scheduleUploads();
+}
+
+void SharePlugin::sendDelta(const NetworkPacket& request, const QString& transferId, const DeltaSignatures& signatures)
+{
+    const QString path = outgoingPath(transferId);
+    if (path.isEmpty()) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Can't send a delta of unknown transfer" << transferId;
+        QMetaObject::invokeMethod(this, "uploadFinished", Qt::QueuedConnection);
+        return;
+    }
+    const QSharedPointer<HashingFile> file = openForSending(path, transferId, 0);
+    if (!file) {
+        QMetaObject::invokeMethod(this, "uploadFinished", Qt::QueuedConnection);
+        return;
+    }
+
+    //The digest is the one of the file itself, the receiver checks what it rebuilt against it
+    NetworkPacket packet(PACKET_TYPE_SHARE_REQUEST);
+    for (const QString& key : { QStringLiteral("batchId"), QStringLiteral("numberOfFiles"), QStringLiteral("totalPayloadSize"), QStringLiteral("open") }) {
+        if (request.has(key)) {
+            packet.body().insert(key, request.body().value(key));
+        }
+    }
+    packet.set<QString>(QStringLiteral("filename"), QFileInfo(path).fileName());
+    packet.set<QString>(QStringLiteral("transferId"), transferId);
+    packet.set<QString>(QStringLiteral("hash"), QStringLiteral("sha256"));
+    packet.set<bool>(QStringLiteral("deltaEncoded"), true);
+    packet.set<qint64>(QStringLiteral("size"), file->size());
+    packet.set<int>(QStringLiteral("blockSize"), signatures.blockSize());
+    QSharedPointer<DeltaEncoder> encoder(new DeltaEncoder(file, signatures));
+    encoder->open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    connect(encoder.data(), &QObject::destroyed, this, &SharePlugin::uploadFinished, Qt::QueuedConnection);
+    packet.setPayload(encoder, -1);
+    sendPacket(packet);
+}
+
+bool SharePlugin::receiveExisting(const NetworkPacket& np, const QString& dir, const QString& filename)
+{
+    const QByteArray digest = QByteArray::fromHex(np.get<QByteArray>(QStringLiteral("contentHash")));
+    if (digest.size() != 32 || np.payloadSize() < 0 || np.has(QStringLiteral("offset")) || !isValidTransferId(np.get<QString>(QStringLiteral("transferId")))) {
+        return false;
+    }
+
+    //Candidates are hashed off the main thread, the payload waits for the answer
+    QFutureWatcher<QString>* watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, np, dir, filename]() {
+        watcher->deleteLater();
+        const QString existing = watcher->result();
+        if (existing.isEmpty()) {
+            receiveFile(np, QUrl::fromLocalFile(dir), filename);
+        } else {
+            copyExisting(np, existing, dir, filename);
+        }
+    });
+    watcher->setFuture(m_contentIndex->find(digest, np.payloadSize(), dir));
+    return true;
+}
+
+void SharePlugin::copyExisting(const NetworkPacket& np, const QString& existing, const QString& dir, const QString& filename)
+{
+    QString destination = dir + '/' + filename;
+    if (QFileInfo(existing) == QFileInfo(destination)) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Already have" << destination;
+        existingReceived(np, destination);
+        return;
+    }
+    if (QFile::exists(destination)) {
+        destination = dir + '/' + KIO::suggestName(QUrl::fromLocalFile(dir), filename);
+    }
+    if (cloneFile(existing, destination)) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Cloned" << existing << "to" << destination;
+        existingReceived(np, destination);
+        return;
+    }
+
+    KIO::FileCopyJob* job = KIO::file_copy(QUrl::fromLocalFile(existing), QUrl::fromLocalFile(destination), -1, KIO::HideProgressInfo);
+    const QString transferId = np.get<QString>(QStringLiteral("transferId"));
+    connect(job, &KJob::result, this, [this, np, destination, transferId](KJob* job) {
+        if (job->error()) {
+            //The payload may be gone by now, ask for the file again
+            qCWarning(KDECONNECT_PLUGIN_SHARE) << "Couldn't copy to" << destination << job->errorString() << ", asking for the file";
+            requestFile(transferId, 0);
+            return;
+        }
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "File copied." << destination;
+        haveContent(np);
+        Q_EMIT shareReceived(QUrl::fromLocalFile(destination).toString());
+    });
+    trackJob(np, job);
+}
+
+void SharePlugin::existingReceived(const NetworkPacket& np, const QString& destination)
+{
+    haveContent(np);
+    ShareBatchJob* batch = batchFor(np);
+    if (batch) {
+        batch->addExistingFile(np.payloadSize());
+    }
+    Q_EMIT shareReceived(QUrl::fromLocalFile(destination).toString());
+}
+
+void SharePlugin::haveContent(const NetworkPacket& np)
+{
+    //Only once the file is in place: the payload is never fetched, and the sender can let go of it
+    NetworkPacket reply(PACKET_TYPE_SHARE_HAVE);
+    reply.set<QString>(QStringLiteral("transferId"), np.get<QString>(QStringLiteral("transferId")));
+    sendPacket(reply);
+}
+
+QString SharePlugin::outgoingPath(const QString& transferId) const
+{
+    const QVariantList transfers = config()->getList(QStringLiteral("outgoing_transfers"));
+    for (const QVariant& transfer : transfers) {
+        const QString entry = transfer.toString();
+        if (entry.startsWith(transferId + ':')) {
+            //The file must not have changed since it was shared, or the pieces wouldn't match
+            const QString path = entry.mid(transferId.size() + 1);
+            return transferIdFor(QFileInfo(path)) == transferId ? path : QString();
+        }
+    }
+    return QString();
+}
+
+void SharePlugin::resumeUpload(const QString& transferId, qint64 offset)
+{
+    const QString path = outgoingPath(transferId);
+    if (path.isEmpty()) {
+        qCDebug(KDECONNECT_PLUGIN_SHARE) << "Can't resume unknown transfer" << transferId;
+        return;
+    }
+
+    qCDebug(KDECONNECT_PLUGIN_SHARE) << "Resuming" << path << "at" << offset;
+    sendFile(NetworkPacket(PACKET_TYPE_SHARE_REQUEST), path, transferId, offset, false);
+}
+
+void SharePlugin::connected()
+{
+    const QUrl dir = incomingDir();
+    if (!dir.isLocalFile()) {
+        return;
+    }
+
+    //Pick up whatever this device was sending us when the link went away
+    const QString dirPath = dir.adjusted(QUrl::StripTrailingSlash).toLocalFile();
+    const QStringList sidecars = QDir(dirPath).entryList({ QStringLiteral(".kdeconnect-*.resume") }, QDir::Files | QDir::Hidden);
+    for (const QString& name : sidecars) {
+        const QString transferId = name.mid(12, name.size() - 12 - 7);
+        if (!isValidTransferId(transferId)) {
+            continue;
+        }
+        if (QFileInfo(partialPath(dirPath, transferId)).lastModified().secsTo(QDateTime::currentDateTime()) > PartialExpiry) {
+            removePartial(dirPath, transferId);
+        } else if (readSidecar(sidecarPath(dirPath, transferId)).value(QStringLiteral("deviceId")).toString() == device()->id()) {
+            requestResume(dirPath, transferId);
+        }
+    }
+}
+
+ShareBatchJob* SharePlugin::batchFor(const NetworkPacket& np)
+{
+    const QString batchId = np.get<QString>(QStringLiteral("batchId"));
+    const int numberOfFiles = np.get<int>(QStringLiteral("numberOfFiles"));
+    if (batchId.isEmpty() || numberOfFiles <= 1) {
+        return nullptr;
+    }
+
+    //The files of a batch show up as a single job
+    ShareBatchJob* batch = m_batches.value(batchId);
+    if (!batch) {
+        batch = new ShareBatchJob(numberOfFiles, np.get<qint64>(QStringLiteral("totalPayloadSize")), device()->name(), this);
+        m_batches.insert(batchId, batch);
+        connect(batch, &KJob::result, this, [this, batchId]() {
+            m_batches.remove(batchId);
+        });
+        KIO::getJobTracker()->registerJob(batch);
+        batch->start();
+    }
+    return batch;
+}
+
+void SharePlugin::trackJob(const NetworkPacket& np, KJob* job)
+{
+    ShareBatchJob* batch = batchFor(np);
+    if (batch) {
+        batch->addJob(job);
+    } else {
+        KIO::getJobTracker()->registerJob(job);
+    }
+}
+
 void SharePlugin::openDestinationFolder()
 {
     QDesktopServices::openUrl(destinationDir());
@@ -155,17 +737,166 @@ void SharePlugin::openDestinationFolder()
 
 void SharePlugin::shareUrl(const QUrl& url)
 {
-    NetworkPacket packet(PACKET_TYPE_SHARE_REQUEST);
     if(url.isLocalFile()) {
-        QSharedPointer<QIODevice> ioFile(new QFile(url.toLocalFile()));
-        packet.setPayload(ioFile, ioFile->size());
-        packet.set<QString>(QStringLiteral("filename"), QUrl(url).fileName());
-    } else {
-        packet.set<QString>(QStringLiteral("url"), url.toString());
+        shareFile(url, NetworkPacket(PACKET_TYPE_SHARE_REQUEST));
+        return;
+    }
+    NetworkPacket packet(PACKET_TYPE_SHARE_REQUEST);
+    packet.set<QString>(QStringLiteral("url"), url.toString());
+    sendPacket(packet);
+}
+
+void SharePlugin::shareUrls(const QStringList& urls)
+{
+    QList<QUrl> files;
+    qint64 totalSize = 0;
+    for (const QString& url : urls) {
+        const QUrl file(url);
+        if (file.isLocalFile()) {
+            files.append(file);
+            totalSize += QFileInfo(file.toLocalFile()).size();
+        } else {
+            shareUrl(file);
+        }
+    }
+
+    //Every file carries the totals, so the receiver can show them from the start
+    const QString batchId = QUuid::createUuid().toString();
+    for (const QUrl& file : qAsConst(files)) {
+        m_pendingUploads.enqueue({ file, batchId, files.size(), totalSize });
+    }
+    scheduleUploads();
+}
+
+void SharePlugin::scheduleUploads()
+{
+    //The peers waiting for a delta asked for it, they go first
+    while (m_activeUploads < MaxConcurrentUploads && !m_pendingDeltas.isEmpty()) {
+        const PendingDelta delta = m_pendingDeltas.dequeue();
+        ++m_activeUploads;
+        sendDelta(delta.request, delta.transferId, delta.signatures);
+    }
+    while (m_activeUploads < MaxConcurrentUploads && !m_pendingUploads.isEmpty()) {
+        const PendingUpload upload = m_pendingUploads.dequeue();
+        NetworkPacket packet(PACKET_TYPE_SHARE_REQUEST);
+        packet.set<QString>(QStringLiteral("batchId"), upload.batchId);
+        packet.set<int>(QStringLiteral("numberOfFiles"), upload.numberOfFiles);
+        packet.set<qint64>(QStringLiteral("totalPayloadSize"), upload.totalSize);
+        ++m_activeUploads;
+        shareFile(upload.url, packet, true);
+    }
+}
+
+void SharePlugin::uploadFinished()
+{
+    --m_activeUploads;
+    scheduleUploads();
+}
+
+void SharePlugin::shareFile(const QUrl& url, NetworkPacket packet, bool scheduled)
+{
+    //Remember what we shared, so the peer can ask for the rest of it if the transfer breaks
+    const QFileInfo info(url.toLocalFile());
+    const QString transferId = transferIdFor(info);
+    QVariantList transfers = config()->getList(QStringLiteral("outgoing_transfers"));
+    transfers.prepend(transferId + ':' + info.canonicalFilePath());
+    while (transfers.size() > MaxRememberedTransfers) {
+        transfers.removeLast();
+    }
+    config()->setList(QStringLiteral("outgoing_transfers"), transfers);
+
+    //Contents shared before can be recognized by the peer, which then doesn't need the payload
+    const QByteArray digest = knownDigest(transferId);
+    if (!digest.isEmpty()) {
+        packet.set<QString>(QStringLiteral("contentHash"), QString::fromLatin1(digest.toHex()));
+    }
+    //A peer with an older copy may rather get what changed, it asks for that with its signatures
+    if (info.size() >= MinDeltaSize && config()->get<bool>(QStringLiteral("delta_transfers"), true)) {
+        packet.set<bool>(QStringLiteral("delta"), true);
+    }
+
+    sendFile(packet, info.filePath(), transferId, 0, scheduled);
+}
+
+QSharedPointer<HashingFile> SharePlugin::openForSending(const QString& path, const QString& transferId, qint64 offset)
+{
+    //The backend reading the payload computes the digest, which follows the data in its own packet
+    QSharedPointer<HashingFile> file(new HashingFile(path));
+    if (!file->openAt(offset)) {
+        qCWarning(KDECONNECT_PLUGIN_SHARE) << "Can't send" << path << "from" << offset << file->errorString();
+        return QSharedPointer<HashingFile>();
+    }
+    connect(file.data(), &HashingFile::digestReady, this, [this, transferId, offset](const QByteArray& digest) {
+        if (offset == 0) {
+            rememberDigest(transferId, digest);
+        }
+        NetworkPacket packet(PACKET_TYPE_SHARE_DIGEST);
+        packet.set<QString>(QStringLiteral("transferId"), transferId);
+        packet.set<QString>(QStringLiteral("sha256"), QString::fromLatin1(digest.toHex()));
+        sendPacket(packet);
+    }, Qt::QueuedConnection);
+    return file;
+}
+
+void SharePlugin::sendFile(NetworkPacket packet, const QString& path, const QString& transferId, qint64 offset, bool scheduled)
+{
+    const QSharedPointer<HashingFile> file = openForSending(path, transferId, offset);
+    if (!file) {
+        if (scheduled) {
+            QMetaObject::invokeMethod(this, "uploadFinished", Qt::QueuedConnection);
+        }
+        return;
+    }
+    if (scheduled) {
+        //The backend lets go of the payload once it's sent or given up on, which frees the slot
+        connect(file.data(), &QObject::destroyed, this, &SharePlugin::uploadFinished, Qt::QueuedConnection);
+    }
+
+    packet.setPayload(file, file->size() - offset);
+    packet.set<QString>(QStringLiteral("filename"), QFileInfo(path).fileName());
+    packet.set<QString>(QStringLiteral("transferId"), transferId);
+    packet.set<QString>(QStringLiteral("hash"), QStringLiteral("sha256"));
+    if (offset > 0) {
+        packet.set<qint64>(QStringLiteral("offset"), offset);
+    }
+    if (packet.has(QStringLiteral("contentHash"))) {
+        for (auto it = m_offeredFiles.begin(); it != m_offeredFiles.end();) {
+            if (it->isNull()) {
+                it = m_offeredFiles.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        m_offeredFiles.insert(transferId, file);
     }
     sendPacket(packet);
 }
 
+QByteArray SharePlugin::knownDigest(const QString& transferId) const
+{
+    const QVariantList digests = config()->getList(QStringLiteral("content_hashes"));
+    for (const QVariant& digest : digests) {
+        const QString entry = digest.toString();
+        if (entry.startsWith(transferId + ':')) {
+            return QByteArray::fromHex(entry.midRef(transferId.size() + 1).toLatin1());
+        }
+    }
+    return QByteArray();
+}
+
+void SharePlugin::rememberDigest(const QString& transferId, const QByteArray& digest)
+{
+    //Transfer ids change with size and modification time, so an entry never outlives the contents it describes
+    QVariantList digests = config()->getList(QStringLiteral("content_hashes"));
+    const QString entry = transferId + ':' + QString::fromLatin1(digest.toHex());
+    digests.removeAll(entry);
+    digests.prepend(entry);
+    while (digests.size() > MaxRememberedTransfers) {
+        digests.removeLast();
+    }
+    config()->setList(QStringLiteral("content_hashes"), digests);
+}
+
 void SharePlugin::shareText(const QString& text)
 {
     NetworkPacket packet(PACKET_TYPE_SHARE_REQUEST);
@@ -175,13 +906,13 @@ void SharePlugin::shareText(const QString& text)
 
 void SharePlugin::openFile(const QUrl& url)
 {
-    NetworkPacket packet(PACKET_TYPE_SHARE_REQUEST);
     if(url.isLocalFile()) {
-        QSharedPointer<QIODevice> ioFile(new QFile(url.toLocalFile()));
-        packet.setPayload(ioFile, ioFile->size());
-        packet.set<QString>(QStringLiteral("filename"), QUrl(url).fileName());
+        NetworkPacket packet(PACKET_TYPE_SHARE_REQUEST);
         packet.set<bool>(QStringLiteral("open"), true);
+        shareFile(url, packet);
+        return;
     }
+    NetworkPacket packet(PACKET_TYPE_SHARE_REQUEST);
     sendPacket(packet);
 }
 
@@ -23,9 +23,27 @@
 
 #include <KIO/Job>
 
+#include <QPointer>
+#include <QQueue>
+#include <QWeakPointer>
+
 #include <core/kdeconnectplugin.h>
+#include <core/deltatransfer.h>
+
+class ContentIndex;
+class FileTransferJob;
+class HashingFile;
+class ShareBatchJob;
 
 #define PACKET_TYPE_SHARE_REQUEST QStringLiteral("kdeconnect.share.request")
+//Asks for a file we shared again, from an offset
+#define PACKET_TYPE_SHARE_RESUME QStringLiteral("kdeconnect.share.resume")
+//The SHA-256 of a payload, sent once all of it was read
+#define PACKET_TYPE_SHARE_DIGEST QStringLiteral("kdeconnect.share.digest")
+//The receiver had the contents of a shared file already and won't fetch its payload
+#define PACKET_TYPE_SHARE_HAVE QStringLiteral("kdeconnect.share.have")
+//Block signatures of an older copy, the sender answers with a delta against them
+#define PACKET_TYPE_SHARE_SIGNATURES QStringLiteral("kdeconnect.share.signatures")
 
 class SharePlugin
     : public KdeConnectPlugin
@@ -40,14 +58,17 @@ public:
     Q_SCRIPTABLE void shareUrl(const QString& url) { shareUrl(QUrl(url)); }
     Q_SCRIPTABLE void shareText(const QString& text);
     Q_SCRIPTABLE void openFile(const QString& file) { openFile(QUrl(file)); }
+    ///Shares all of them as one batch, a few files at a time
+    Q_SCRIPTABLE void shareUrls(const QStringList& urls);
 
     bool receivePacket(const NetworkPacket& np) override;
-    void connected() override {}
+    void connected() override;
     QString dbusPath() const override;
 
 private Q_SLOTS:
     void finished(KJob*);
     void openDestinationFolder();
+    void uploadFinished();
 
 Q_SIGNALS:
     void shareReceived(const QString& url);
@@ -55,9 +76,62 @@ Q_SIGNALS:
 private:
     void shareUrl(const QUrl& url);
     void openFile(const QUrl& url);
+    void shareFile(const QUrl& url, NetworkPacket packet, bool scheduled = false);
+    void scheduleUploads();
+    ShareBatchJob* batchFor(const NetworkPacket& np);
+    void trackJob(const NetworkPacket& np, KJob* job);
 
+    void receiveFile(const NetworkPacket& np, const QUrl& dir, const QString& filename);
+    void receiveResumable(const NetworkPacket& np, const QUrl& dir, const QString& filename, const QString& transferId);
+    void resumableFinished(KJob* job, const QString& dir, const QString& filename, const QString& transferId);
+    void requestResume(const QString& dir, const QString& transferId);
+    void requestFile(const QString& transferId, qint64 offset);
+    bool requestDelta(const NetworkPacket& np, const QString& dir, const QString& filename, const QString& transferId);
+    void sendSignatures(const NetworkPacket& np, const QString& transferId, const QString& basePath, const QByteArray& signatures);
+    void receiveSignatures(const NetworkPacket& np);
+    void readSignatures(const QString& transferId);
+    void sendDelta(const NetworkPacket& request, const QString& transferId, const DeltaSignatures& signatures);
+    bool receiveExisting(const NetworkPacket& np, const QString& dir, const QString& filename);
+    void copyExisting(const NetworkPacket& np, const QString& existing, const QString& dir, const QString& filename);
+    void existingReceived(const NetworkPacket& np, const QString& destination);
+    void haveContent(const NetworkPacket& np);
+    void resumeUpload(const QString& transferId, qint64 offset);
+    QString outgoingPath(const QString& transferId) const;
+    QSharedPointer<HashingFile> openForSending(const QString& path, const QString& transferId, qint64 offset);
+    void sendFile(NetworkPacket packet, const QString& path, const QString& transferId, qint64 offset, bool scheduled);
+    QByteArray knownDigest(const QString& transferId) const;
+    void rememberDigest(const QString& transferId, const QByteArray& digest);
 
+    QUrl incomingDir() const;
     QUrl destinationDir() const;
 
+    ContentIndex* m_contentIndex; //Of what this device sent us
+    QHash<QString, int> m_resumeAttempts;
+    QHash<QString, QPointer<FileTransferJob>> m_incomingJobs;
+    QHash<QString, QPointer<ShareBatchJob>> m_batches;
+    QHash<QString, QWeakPointer<HashingFile>> m_offeredFiles; //Sent with a contentHash, the peer may not fetch them
+    QHash<QString, QString> m_deltaBases; //Older copies we sent signatures of, by transfer id
+
+    struct SignatureRead {
+        NetworkPacket packet;
+        QByteArray data;
+    };
+    QHash<QString, SignatureRead> m_signatureReads;
+
+    struct PendingUpload {
+        QUrl url;
+        QString batchId;
+        int numberOfFiles;
+        qint64 totalSize;
+    };
+    QQueue<PendingUpload> m_pendingUploads;
+
+    struct PendingDelta {
+        NetworkPacket request;
+        QString transferId;
+        DeltaSignatures signatures;
+    };
+    QQueue<PendingDelta> m_pendingDeltas;
+    int m_activeUploads;
 };
 #endif
@@ -30,6 +30,7 @@
 
 #include <core/device.h>
 #include <core/daemon.h>
+#include <core/packettyperegistry.h>
 
 #include "sendreplydialog.h"
 
@@ -37,6 +38,14 @@ K_PLUGIN_FACTORY_WITH_JSON( KdeConnectPluginFactory, "kdeconnect_sms.json", regi
 
 Q_LOGGING_CATEGORY(KDECONNECT_PLUGIN_SMS, "kdeconnect.plugin.sms")
 
+//Big conversation dumps are handed to receivePacketElements() while they arrive. This is
+//process wide, so it is done once when the plugin is loaded instead of for every device.
+static void registerStreamedMessages()
+{
+    PacketTypeRegistry::setStreamedArray(PacketTypeRegistry::intern(PACKET_TYPE_SMS_MESSAGES), QStringLiteral("messages"));
+}
+Q_CONSTRUCTOR_FUNCTION(registerStreamedMessages)
+
 SmsPlugin::SmsPlugin(QObject* parent, const QVariantList& args)
     : KdeConnectPlugin(parent, args)
     , m_telepathyInterface(QStringLiteral("org.freedesktop.Telepathy.ConnectionManager.kdeconnect"), QStringLiteral("/kdeconnect"))
@@ -57,6 +66,13 @@ bool SmsPlugin::receivePacket(const NetworkPacket& np)
     return true;
 }
 
+void SmsPlugin::receivePacketElements(const NetworkPacket& header, const QVariantList& elements)
+{
+    if (header.type() == PACKET_TYPE_SMS_MESSAGES) {
+        handleMessages(elements);
+    }
+}
+
 void SmsPlugin::sendSms(const QString& phoneNumber, const QString& messageBody)
 {
     NetworkPacket np(PACKET_TYPE_SMS_REQUEST, {
@@ -98,8 +114,14 @@ void SmsPlugin::forwardToTelepathy(const ConversationMessage& message)
 
 bool SmsPlugin::handleBatchMessages(const NetworkPacket& np)
 {
-    const auto messages = np.get<QVariantList>("messages");
+    //Empty if the messages were already streamed to receivePacketElements()
+    handleMessages(np.get<QVariantList>("messages"));
 
+    return true;
+}
+
+void SmsPlugin::handleMessages(const QVariantList& messages)
+{
     for (const QVariant& body : messages) {
         ConversationMessage message(body.toMap());
         if (message.containsTextBody()) {
@@ -107,8 +129,6 @@ bool SmsPlugin::handleBatchMessages(const NetworkPacket& np)
             m_conversationInterface->addMessage(message);
         }
     }
-
-    return true;
 }
 
 
@@ -98,6 +98,7 @@ public:
     ~SmsPlugin() override;
 
     bool receivePacket(const NetworkPacket& np) override;
+    void receivePacketElements(const NetworkPacket& header, const QVariantList& elements) override;
     void connected() override {}
 
     QString dbusPath() const override;
@@ -127,6 +128,11 @@ private:
      */
     bool handleBatchMessages(const NetworkPacket& np);
 
+    /**
+     * Forward and store the messages of a PACKET_TYPE_SMS_MESSAGES body
+     */
+    void handleMessages(const QVariantList& messages);
+
     QDBusInterface m_telepathyInterface;
     ConversationsDbusInterface* m_conversationInterface;
 
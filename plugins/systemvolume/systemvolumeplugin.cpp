@@ -49,18 +49,22 @@ bool SystemvolumePlugin::receivePacket(const NetworkPacket& np)
     if (!PulseAudioQt::Context::instance()->isValid())
         return false;
 
-    if (np.has(QStringLiteral("requestSinks"))) {
+    SystemvolumeRequest request;
+    if (!request.decode(np)) {
+        return false;
+    }
+
+    if (request.has(SystemvolumeRequest::requestSinksField)) {
         sendSinkList();
     } else {
 
-        QString name = np.get<QString>(QStringLiteral("name"));
-
-        if (sinksMap.contains(name)) {
-            if (np.has(QStringLiteral("volume"))) {
-                sinksMap[name]->setVolume(np.get<int>(QStringLiteral("volume")));
+        PulseAudioQt::Sink* sink = sinksMap.value(request.name);
+        if (sink) {
+            if (request.has(SystemvolumeRequest::volumeField)) {
+                sink->setVolume(request.volume);
             }
-            if (np.has(QStringLiteral("muted"))) {
-                sinksMap[name]->setMuted(np.get<bool>(QStringLiteral("muted")));
+            if (request.has(SystemvolumeRequest::mutedField)) {
+                sink->setMuted(request.muted);
             }
         }
     }
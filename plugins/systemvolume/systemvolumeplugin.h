@@ -25,12 +25,22 @@
 #include <QMap>
 
 #include <core/kdeconnectplugin.h>
+#include <core/packetview.h>
 
 #include <PulseAudioQt/Sink>
 
 #define PACKET_TYPE_SYSTEMVOLUME QStringLiteral("kdeconnect.systemvolume")
 #define PACKET_TYPE_SYSTEMVOLUME_REQUEST QStringLiteral("kdeconnect.systemvolume.request")
 
+#define SYSTEMVOLUME_REQUEST_FIELDS(FIELD) \
+    FIELD(bool, requestSinks, "requestSinks", false) \
+    FIELD(QString, name, "name", QString()) \
+    FIELD(int, volume, "volume", 0) \
+    FIELD(bool, muted, "muted", false)
+
+//A kdeconnect.systemvolume.request packet, see PacketView
+KDECONNECT_PACKET_VIEW(SystemvolumeRequest, SYSTEMVOLUME_REQUEST_FIELDS)
+
 
 class Q_DECL_EXPORT SystemvolumePlugin
     : public KdeConnectPlugin
@@ -0,0 +1,126 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../plugins/share/contentindex.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+/*
+ * This class tests that the share plugin recognizes contents it already has,
+ * and stops trusting what it remembered once a file changes
+ */
+class ContentIndexTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testFindInFolder();
+    void testRemembered();
+    void testChangedFile();
+    void testBatchedSave();
+
+private:
+    static void writeFile(const QString& path, const QByteArray& data);
+    static QByteArray sha256(const QByteArray& data);
+};
+
+void ContentIndexTest::writeFile(const QString& path, const QByteArray& data)
+{
+    QFile file(path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(data);
+}
+
+QByteArray ContentIndexTest::sha256(const QByteArray& data)
+{
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+}
+
+void ContentIndexTest::testFindInFolder()
+{
+    QTemporaryDir dir;
+    const QByteArray data("Same contents, any name");
+    writeFile(dir.path() + "/other.txt", QByteArray(data.size(), 'x'));
+    writeFile(dir.path() + "/photo.txt", data);
+
+    ContentIndex index(dir.path() + "/.index.json");
+    QCOMPARE(index.find(sha256(data), data.size(), dir.path()).result(), QString(dir.path() + "/photo.txt"));
+    QVERIFY(index.find(sha256("Not there"), 9, dir.path()).result().isEmpty());
+}
+
+void ContentIndexTest::testRemembered()
+{
+    QTemporaryDir dir;
+    QTemporaryDir elsewhere;
+    const QByteArray data("Received earlier");
+    const QString path = elsewhere.path() + "/received.txt";
+    writeFile(path, data);
+
+    {
+        ContentIndex index(dir.path() + "/.index.json");
+        index.add(path, sha256(data));
+    }
+
+    //Found from the saved index, even though it's not in the folder that is looked at.
+    //Destroying the index above wrote it out, without waiting for the save timer
+    ContentIndex index(dir.path() + "/.index.json");
+    QCOMPARE(index.find(sha256(data), data.size(), dir.path()).result(), path);
+}
+
+void ContentIndexTest::testChangedFile()
+{
+    QTemporaryDir dir;
+    QTemporaryDir elsewhere;
+    const QByteArray data("Before the edit");
+    const QString path = elsewhere.path() + "/edited.txt";
+    writeFile(path, data);
+
+    ContentIndex index(dir.path() + "/.index.json");
+    index.add(path, sha256(data));
+
+    //The entry no longer describes the file
+    writeFile(path, "After the edit, a bit longer");
+    QVERIFY(index.find(sha256(data), data.size(), dir.path()).result().isEmpty());
+}
+
+void ContentIndexTest::testBatchedSave()
+{
+    QTemporaryDir dir;
+    const QString indexFile = dir.path() + "/.index.json";
+    writeFile(dir.path() + "/first.txt", "First");
+    writeFile(dir.path() + "/second.txt", "Second");
+
+    //Files added one after the other are written out together, a bit later
+    ContentIndex index(indexFile);
+    index.add(dir.path() + "/first.txt", sha256("First"));
+    index.add(dir.path() + "/second.txt", sha256("Second"));
+    QVERIFY(!QFile::exists(indexFile));
+    QTRY_VERIFY_WITH_TIMEOUT(QFile::exists(indexFile), ContentIndex::SaveDelay * 2);
+
+    ContentIndex saved(indexFile);
+    QCOMPARE(saved.find(sha256("Second"), 6, QString()).result(), QString(dir.path() + "/second.txt"));
+}
+
+QTEST_GUILESS_MAIN(ContentIndexTest)
+
+#include "contentindextest.moc"
@@ -20,6 +20,9 @@
 
 #include "../core/device.h"
 #include "../core/backends/lan/lanlinkprovider.h"
+#include "../core/backends/lan/server.h"
+#include "../core/backends/bandwidthlimiter.h"
+#include "../core/backends/packetframer.h"
 #include "../core/kdeconnectconfig.h"
 
 #include <QtTest>
@@ -36,9 +39,15 @@ private Q_SLOTS:
     void initTestCase();
     void testUnpairedDevice();
     void testPairedDevice();
+    void testBatchedPackets();
+    void testCompressionError();
+    void testBatchFanOut();
+    void testInteractiveReceived();
     void cleanupTestCase();
 
 private:
+    QSslSocket* connectSockets(Server* server, QSslSocket* client);
+
     QString deviceId;
     QString deviceName;
     QString deviceType;
@@ -54,6 +63,21 @@ void DeviceTest::initTestCase()
     QString stringPacket = QStringLiteral("{\"id\":1439365924847,\"type\":\"kdeconnect.identity\",\"body\":{\"deviceId\":\"testdevice\",\"deviceName\":\"Test Device\",\"protocolVersion\":6,\"deviceType\":\"phone\"}}");
     identityPacket = new NetworkPacket(QStringLiteral("kdeconnect.identity"));
     NetworkPacket::unserialize(stringPacket.toLatin1(), identityPacket);
+
+    //Where the recording plugins built with the tests are, before PluginLoader looks for plugins
+    QCoreApplication::addLibraryPath(QStringLiteral(TEST_PLUGIN_DIR));
+}
+
+QSslSocket* DeviceTest::connectSockets(Server* server, QSslSocket* client)
+{
+    if (!server->listen(QHostAddress::LocalHost)) {
+        return nullptr;
+    }
+    client->connectToHost(QHostAddress::LocalHost, server->serverPort());
+    if (!client->waitForConnected() || !(server->waitForNewConnection(5000) || server->hasPendingConnections())) {
+        return nullptr;
+    }
+    return server->nextPendingConnection();
 }
 
 void DeviceTest::testPairedDevice()
@@ -119,6 +143,194 @@ void DeviceTest::testUnpairedDevice()
     QCOMPARE(device.availableLinks().contains(linkProvider.name()), false);
 }
 
+void DeviceTest::testBatchedPackets()
+{
+    Server server;
+    QSslSocket client;
+    QSslSocket* socket = connectSockets(&server, &client);
+    QVERIFY(socket);
+
+    LanLinkProvider linkProvider;
+    LanDeviceLink* link = new LanDeviceLink(deviceId, &linkProvider, socket, LanDeviceLink::Remotely);
+
+    QList<QString> received;
+    connect(link, &DeviceLink::receivedPacket, this, [&received](const NetworkPacket& np) {
+        received.append(np.get<QString>(QStringLiteral("n")));
+    });
+    connect(link, &DeviceLink::receivedPackets, this, [&received](const QVector<NetworkPacket>& packets) {
+        for (const NetworkPacket& np : packets) {
+            received.append(np.get<QString>(QStringLiteral("n")));
+        }
+    });
+
+    // A burst written at once is delivered in a few batches, in order
+    const int count = 500;
+    QByteArray data;
+    for (int i = 0; i < count; ++i) {
+        NetworkPacket np(QStringLiteral("kdeconnect.mousepad.request"));
+        np.set(QStringLiteral("n"), QString::number(i));
+        data += np.serialize();
+    }
+    client.write(data);
+    client.flush();
+
+    QTRY_COMPARE_WITH_TIMEOUT(received.size(), count, 5000);
+    for (int i = 0; i < count; ++i) {
+        QCOMPARE(received.at(i), QString::number(i));
+    }
+    QCOMPARE(link->receiveStatistics().packets, quint64(count));
+    QVERIFY(link->receiveStatistics().largestBatch > 1);
+
+    delete link;
+}
+
+void DeviceTest::testCompressionError()
+{
+    if (!NetworkPacket::supportedEncodings().contains(QStringLiteral("cbor"))) {
+        QSKIP("Built without CBOR support");
+    }
+
+    Server server;
+    QSslSocket client;
+    QSslSocket* socket = connectSockets(&server, &client);
+    QVERIFY(socket);
+
+    LanLinkProvider linkProvider;
+    LanDeviceLink* link = new LanDeviceLink(deviceId, &linkProvider, socket, LanDeviceLink::Remotely);
+    link->setPacketEncoding(NetworkPacket::CborEncoding, true);
+    QVERIFY(link->statistics().contains(QStringLiteral("compressionRatioReceived")));
+
+    int received = 0;
+    connect(link, &DeviceLink::receivedPackets, this, [&received](const QVector<NetworkPacket>& packets) {
+        received += packets.size();
+    });
+
+    //A compressed frame that doesn't inflate, then a valid one that must not be delivered
+    const QByteArray garbage(64, '\xff');
+    char header[PacketFramer::HeaderSize];
+    PacketFramer::writeHeader(header, PacketFramer::CompressedPacketFrame, garbage.size());
+    client.write(header, sizeof(header));
+    client.write(garbage);
+    QByteArray cbor;
+    NetworkPacket(QStringLiteral("kdeconnect.ping")).serializeCbor(&cbor);
+    PacketFramer::writeHeader(header, PacketFramer::PacketFrame, cbor.size());
+    client.write(header, sizeof(header));
+    client.write(cbor);
+    client.flush();
+
+    QTRY_COMPARE_WITH_TIMEOUT(client.state(), QAbstractSocket::UnconnectedState, 5000);
+    QCOMPARE(received, 0);
+
+    delete link;
+}
+
+void DeviceTest::testBatchFanOut()
+{
+    KdeConnectConfig* kcc = KdeConnectConfig::instance();
+    kcc->addTrustedDevice(deviceId, deviceName, deviceType);
+    kcc->setDeviceProperty(deviceId, QStringLiteral("certificate"), QString::fromLatin1(kcc->certificate().toPem()));
+
+    Server server;
+    QSslSocket client;
+    QSslSocket* socket = connectSockets(&server, &client);
+    QVERIFY(socket);
+
+    //The recording plugins share their log through the application, see recordingplugin.cpp
+    const QByteArray logProperty("receivedPackets");
+    qApp->setProperty(logProperty, QStringList());
+
+    const QString both = QStringLiteral("kdeconnect.test.both");
+    const QString second = QStringLiteral("kdeconnect.test.second");
+    const QString first = QStringLiteral("kdeconnect_testrecorderfirst:");
+    const QString secondPlugin = QStringLiteral("kdeconnect_testrecordersecond:");
+
+    LanLinkProvider linkProvider;
+    Device device(this, deviceId);
+    LanDeviceLink* link = new LanDeviceLink(deviceId, &linkProvider, socket, LanDeviceLink::Remotely);
+    NetworkPacket identity = *identityPacket;
+    identity.set(QStringLiteral("incomingCapabilities"), QStringList());
+    identity.set(QStringLiteral("outgoingCapabilities"), QStringList({ both, second }));
+    device.addLink(identity, link);
+    QVERIFY(device.loadedPlugins().contains(QStringLiteral("kdeconnect_testrecorderfirst")));
+    QVERIFY(device.loadedPlugins().contains(QStringLiteral("kdeconnect_testrecordersecond")));
+
+    //Types handled by both plugins, by one of them, and by none, written at once
+    const QStringList types = { both, second, both, QStringLiteral("kdeconnect.test.unhandled"), second };
+    QByteArray data;
+    for (int i = 0; i < types.size(); ++i) {
+        NetworkPacket np(types.at(i));
+        np.set(QStringLiteral("n"), QString::number(i));
+        data += np.serialize();
+    }
+    client.write(data);
+    client.flush();
+
+    //Every packet reached all of its plugins before the next one was delivered
+    QTRY_COMPARE_WITH_TIMEOUT(qApp->property(logProperty).toStringList().size(), 6, 5000);
+    const QStringList log = qApp->property(logProperty).toStringList();
+    QStringList order;
+    for (const QString& entry : log) {
+        order.append(entry.section(QLatin1Char(':'), 1));
+    }
+    QCOMPARE(order, QStringList({ QStringLiteral("0"), QStringLiteral("0"), QStringLiteral("1"),
+                                  QStringLiteral("2"), QStringLiteral("2"), QStringLiteral("4") }));
+    QCOMPARE(log.filter(first), QStringList({ first + '0', first + '2' }));
+    QCOMPARE(log.filter(secondPlugin), QStringList({ secondPlugin + '0', secondPlugin + '1', secondPlugin + '2', secondPlugin + '4' }));
+
+    //Plugins that take their time don't hold the event loop for the whole batch
+    qApp->setProperty(logProperty, QStringList());
+    QVector<NetworkPacket> slow;
+    for (int i = 0; i < 10; ++i) {
+        NetworkPacket np(second);
+        np.set(QStringLiteral("n"), QString::number(i));
+        np.set(QStringLiteral("busy"), 3);
+        slow.append(np);
+    }
+    QVERIFY(QMetaObject::invokeMethod(&device, "privateReceivedPackets", Qt::DirectConnection, Q_ARG(QVector<NetworkPacket>, slow)));
+    QVERIFY(qApp->property(logProperty).toStringList().size() < slow.size());
+    QTRY_COMPARE_WITH_TIMEOUT(qApp->property(logProperty).toStringList().size(), slow.size(), 5000);
+    QCOMPARE(qApp->property(logProperty).toStringList().first(), secondPlugin + '0');
+    QCOMPARE(qApp->property(logProperty).toStringList().last(), secondPlugin + '9');
+
+    delete link;
+    kcc->removeTrustedDevice(deviceId);
+}
+
+void DeviceTest::testInteractiveReceived()
+{
+    Server server;
+    QSslSocket client;
+    QSslSocket* socket = connectSockets(&server, &client);
+    QVERIFY(socket);
+
+    LanLinkProvider linkProvider;
+    LanDeviceLink* link = new LanDeviceLink(deviceId, &linkProvider, socket, LanDeviceLink::Remotely);
+
+    BandwidthLimiter* limiter = BandwidthLimiter::instance();
+    QVERIFY(limiter);
+    QTRY_VERIFY(limiter->allowance(deviceId, 1024) > 0);
+
+    // Payloads to the device are held back as soon as an interactive packet arrives from it
+    QList<qint64> allowances;
+    connect(link, &DeviceLink::receivedPacket, this, [&allowances, limiter, this](const NetworkPacket&) {
+        allowances.append(limiter->allowance(deviceId, 1024));
+    });
+    connect(link, &DeviceLink::receivedPackets, this, [&allowances, limiter, this](const QVector<NetworkPacket>& packets) {
+        for (int i = 0; i < packets.size(); ++i) {
+            allowances.append(limiter->allowance(deviceId, 1024));
+        }
+    });
+
+    client.write(NetworkPacket(QStringLiteral("kdeconnect.mousepad.request")).serialize());
+    client.flush();
+
+    QTRY_COMPARE(allowances.size(), 1);
+    QCOMPARE(allowances.first(), qint64(0));
+    QTRY_VERIFY(limiter->allowance(deviceId, 1024) > 0);
+
+    delete link;
+}
+
 void DeviceTest::cleanupTestCase()
 {
     delete identityPacket;
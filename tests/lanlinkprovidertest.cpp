@@ -27,6 +27,8 @@
 #include "../core/kdeconnectconfig.h"
 
 #include <QAbstractSocket>
+#include <QElapsedTimer>
+#include <QSslCipher>
 #include <QSslSocket>
 #include <QtTest>
 #include <QSslKey>
@@ -56,6 +58,8 @@ private Q_SLOTS:
     void unpairedDeviceTcpPacketReceived();
     void unpairedDeviceUdpPacketReceived();
 
+    void sslConfigurationCached();
+
 
 private:
     const int TEST_PORT = 8520;
@@ -337,17 +341,80 @@ void LanLinkProviderTest::setSocketAttributes(QSslSocket* socket)
     socket->setLocalCertificate(m_certificate);
 }
 
+void LanLinkProviderTest::sslConfigurationCached()
+{
+    KdeConnectConfig* kcc = KdeConnectConfig::instance();
+    addTrustedDevice();
+    const int rounds = 100;
+
+    //What configureSslSocket did for every socket before configurations were cached
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < rounds; ++i) {
+        QSslSocket socket;
+        QSslConfiguration sslConfig;
+        sslConfig.setCiphers({ QSslCipher(QStringLiteral("ECDHE-ECDSA-AES256-GCM-SHA384")),
+                               QSslCipher(QStringLiteral("ECDHE-ECDSA-AES128-GCM-SHA256")),
+                               QSslCipher(QStringLiteral("ECDHE-RSA-AES128-SHA")) });
+        sslConfig.setProtocol(QSsl::TlsV1_0);
+        socket.setSslConfiguration(sslConfig);
+        socket.setLocalCertificate(kcc->certificate());
+        socket.setPrivateKey(kcc->privateKeyPath());
+        socket.setPeerVerifyName(m_deviceId);
+        socket.addCaCertificate(QSslCertificate(kcc->getDeviceProperty(m_deviceId, QStringLiteral("certificate")).toLatin1()));
+        socket.setPeerVerifyMode(QSslSocket::VerifyPeer);
+    }
+    const qint64 uncached = timer.nsecsElapsed();
+
+    timer.restart();
+    for (int i = 0; i < rounds; ++i) {
+        QSslSocket socket;
+        LanLinkProvider::configureSslSocket(&socket, m_deviceId, true);
+    }
+    const qint64 cached = timer.nsecsElapsed();
+    qDebug() << "Setting up a socket took" << uncached / rounds / 1000 << "us without the cache," << cached / rounds / 1000 << "us with it";
+
+    QSslSocket socket;
+    LanLinkProvider::configureSslSocket(&socket, m_deviceId, true);
+    QCOMPARE(socket.peerVerifyMode(), QSslSocket::VerifyPeer);
+    QCOMPARE(socket.peerVerifyName(), m_deviceId);
+    QCOMPARE(socket.localCertificate(), kcc->certificate());
+    QVERIFY(!socket.privateKey().isNull());
+    QVERIFY(socket.sslConfiguration().caCertificates().contains(m_certificate));
+
+    //Dropping everything, like after our own certificate changed, rebuilds it all
+    LanLinkProvider::invalidateSslConfiguration();
+    QSslSocket rebuilt;
+    LanLinkProvider::configureSslSocket(&rebuilt, m_deviceId, true);
+    QCOMPARE(rebuilt.localCertificate(), kcc->certificate());
+    QVERIFY(!rebuilt.privateKey().isNull());
+    QVERIFY(rebuilt.sslConfiguration().caCertificates().contains(m_certificate));
+
+    QSslSocket untrusted;
+    LanLinkProvider::configureSslSocket(&untrusted, m_deviceId, false);
+    QCOMPARE(untrusted.peerVerifyMode(), QSslSocket::QueryPeer);
+    QVERIFY(!untrusted.sslConfiguration().caCertificates().contains(m_certificate));
+
+    //Once unpaired, the stored certificate isn't trusted anymore
+    removeTrustedDevice();
+    QSslSocket unpaired;
+    LanLinkProvider::configureSslSocket(&unpaired, m_deviceId, true);
+    QVERIFY(!unpaired.sslConfiguration().caCertificates().contains(m_certificate));
+}
+
 void LanLinkProviderTest::addTrustedDevice()
 {
     KdeConnectConfig* kcc = KdeConnectConfig::instance();
     kcc->addTrustedDevice(m_deviceId, m_name, QStringLiteral("phone"));
     kcc->setDeviceProperty(m_deviceId, QStringLiteral("certificate"), QString::fromLatin1(m_certificate.toPem()));
+    LanLinkProvider::invalidateSslConfiguration(m_deviceId);
 }
 
 void LanLinkProviderTest::removeTrustedDevice()
 {
     KdeConnectConfig* kcc = KdeConnectConfig::instance();
     kcc->removeTrustedDevice(m_deviceId);
+    LanLinkProvider::invalidateSslConfiguration(m_deviceId);
 }
 
 
@@ -21,12 +21,102 @@
 #include "networkpackettests.h"
 
 #include "core/networkpacket.h"
+#include "core/dbushelper.h"
+#include "core/packettyperegistry.h"
+#include "core/packetview.h"
 
 #include <QtTest>
 #include <QtCrypto>
+#include <QBuffer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMetaProperty>
 
 QTEST_GUILESS_MAIN(NetworkPacketTests);
 
+#define TEST_REQUEST_FIELDS(FIELD) \
+    FIELD(float, dx, "dx", 0) \
+    FIELD(float, dy, "dy", 0) \
+    FIELD(bool, singleClick, "singleclick", false) \
+    FIELD(bool, scroll, "scroll", false) \
+    FIELD(QString, key, "key", QString()) \
+    FIELD(int, specialKey, "specialKey", 0) \
+    FIELD(QStringList, players, "playerList", QStringList()) \
+    FIELD(qlonglong, position, "SetPosition", 0)
+
+KDECONNECT_PACKET_VIEW(TestRequest, TEST_REQUEST_FIELDS)
+
+// The QJsonDocument -> QVariant -> QMetaProperty path NetworkPacket::unserialize used to take
+static void legacyUnserialize(const QByteArray& json, NetworkPacket* np)
+{
+    const QVariantMap variant = QJsonDocument::fromJson(json).toVariant().toMap();
+    const QMetaObject& metaObject = NetworkPacket::staticMetaObject;
+    for (auto it = variant.constBegin(); it != variant.constEnd(); ++it) {
+        const int propertyIndex = metaObject.indexOfProperty(it.key().toLatin1().constData());
+        if (propertyIndex >= 0) {
+            metaObject.property(propertyIndex).writeOnGadget(np, it.value());
+        }
+    }
+}
+
+static QByteArray smsBatchJson(int messages)
+{
+    QVariantList list;
+    for (int i = 0; i < messages; ++i) {
+        list.append(QVariantMap {
+            { QStringLiteral("event"), 1 },
+            { QStringLiteral("body"), QStringLiteral("Message number %1, with \"quotes\" and some \u00fcnicode \u2603").arg(i) },
+            { QStringLiteral("address"), QStringLiteral("+1 555 0100") },
+            { QStringLiteral("date"), 1539272612000.0 + i },
+            { QStringLiteral("type"), 2 },
+            { QStringLiteral("read"), 1 },
+            { QStringLiteral("thread_id"), i % 20 },
+            { QStringLiteral("_id"), i },
+        });
+    }
+    NetworkPacket np(QStringLiteral("kdeconnect.sms.messages"), {{ QStringLiteral("messages"), list }});
+    return np.serialize();
+}
+
+static NetworkPacket vcardsPacket(int contacts)
+{
+    QVariantMap body;
+    QStringList uids;
+    for (int i = 0; i < contacts; ++i) {
+        const QString uid = QString::number(1000 + i);
+        uids.append(uid);
+        body.insert(uid, QStringLiteral("BEGIN:VCARD\nVERSION:2.1\nFN:Contact %1\nTEL;CELL:+1 555 %2\nEMAIL;HOME:contact%1@example.org\n"
+                                        "X-KDECONNECT-ID-DEV-test:%1\nX-KDECONNECT-TIMESTAMP:1539272612000\nEND:VCARD").arg(i).arg(i, 4, 10, QLatin1Char('0')));
+    }
+    body.insert(QStringLiteral("uids"), uids);
+    return NetworkPacket(QStringLiteral("kdeconnect.contacts.response_vcards"), body);
+}
+
+static NetworkPacket smsPacket(int messages)
+{
+    NetworkPacket np(QStringLiteral("empty"));
+    NetworkPacket::unserialize(smsBatchJson(messages), &np);
+    return np;
+}
+
+static NetworkPacket sinkListPacket(int sinks)
+{
+    QJsonArray array;
+    for (int i = 0; i < sinks; ++i) {
+        array.append(QJsonObject {
+            { QStringLiteral("name"), QStringLiteral("alsa_output.pci-0000_00_1f.%1.analog-stereo").arg(i) },
+            { QStringLiteral("description"), QStringLiteral("Built-in Audio Analog Stereo %1").arg(i) },
+            { QStringLiteral("muted"), i % 2 == 0 },
+            { QStringLiteral("volume"), 42 + i },
+            { QStringLiteral("maxVolume"), 65536 },
+        });
+    }
+    NetworkPacket np(QStringLiteral("kdeconnect.systemvolume"));
+    np.set(QStringLiteral("sinkList"), QJsonDocument(array));
+    return np;
+}
+
 void NetworkPacketTests::initTestCase()
 {
     // Called before the first testfunction is executed
@@ -79,6 +169,411 @@ void NetworkPacketTests::networkPacketIdentityTest()
 
 }
 
+void NetworkPacketTests::networkPacketUnserializeTest()
+{
+    const QList<QByteArray> documents = {
+        "{\"id\":1439365924847,\"type\":\"kdeconnect.ping\",\"body\":{}}\n",
+        "{\"id\":\"12\",\"type\":\"test\",\"body\":{\"a\":[1,2.5,-3e2,true,false,null,\"x\"],\"b\":{\"c\":{\"d\":[]}}}}",
+        "{\"id\":\"12\",\"type\":\"test\",\"body\":{\"s\":\"tab\\tquote\\\"slash\\/\\u00e9\\ud83d\\ude00\"}}",
+        "  {\"id\":\"7\", \"type\" : \"test\" , \"body\" : {\"utf8\":\"\xc3\xa9\xe2\x98\x83\", \"n\": 9007199254740993}}  \n",
+        smsBatchJson(3),
+    };
+
+    for (const QByteArray& json : documents) {
+        NetworkPacket direct(QStringLiteral("empty")), legacy(QStringLiteral("empty"));
+        QVERIFY(NetworkPacket::unserialize(json, &direct));
+        legacyUnserialize(json, &legacy);
+        QCOMPARE(direct.id(), legacy.id());
+        QCOMPARE(direct.type(), legacy.type());
+        QCOMPARE(direct.body(), legacy.body());
+    }
+
+    NetworkPacket np(QStringLiteral("empty"));
+    QVERIFY(NetworkPacket::unserialize("{\"id\":1,\"type\":\"t\",\"body\":{\"size\":42},\"payloadSize\":-1,\"payloadTransferInfo\":{\"port\":1739}}", &np));
+    QCOMPARE(np.payloadSize(), 42);
+    QCOMPARE(np.payloadTransferInfo().value(QStringLiteral("port")).toInt(), 1739);
+
+    QVERIFY(NetworkPacket::unserialize("{\"id\":1,\"type\":\"kdeconnect.identity\",\"body\":{\"deviceId\":\"a-b.c\"}}", &np));
+    QString sanitizedId = QStringLiteral("a-b.c");
+    DbusHelper::filterNonExportableCharacters(sanitizedId);
+    QCOMPARE(np.get<QString>(QStringLiteral("deviceId")), sanitizedId);
+    QCOMPARE(np.payloadSize(), 0);
+    QVERIFY(!np.hasPayloadTransferInfo());
+
+    QVERIFY(!NetworkPacket::unserialize("this is not json", &np));
+    QVERIFY(!NetworkPacket::unserialize("{\"id\":1,\"type\":\"t\",\"body\":{\"a\":}}", &np));
+    QVERIFY(!NetworkPacket::unserialize("{\"id\":1,\"type\":\"t\"", &np));
+    QVERIFY(!NetworkPacket::unserialize("{\"type\":\"t\"} trailing", &np));
+    QVERIFY(!NetworkPacket::unserialize(QByteArray(2000, '['), &np));
+    QCOMPARE(np.type(), QStringLiteral("kdeconnect.identity"));
+}
+
+void NetworkPacketTests::networkPacketSerializeTest()
+{
+    const QVariantMap body = {
+        { QStringLiteral("string"), QStringLiteral("quote\" backslash\\ newline\n control\x01 \u00e9 \U0001F600") },
+        { QStringLiteral("int"), -42 },
+        { QStringLiteral("longlong"), Q_INT64_C(1539272612000) },
+        { QStringLiteral("double"), 0.1 },
+        { QStringLiteral("bool"), true },
+        { QStringLiteral("null"), QVariant() },
+        { QStringLiteral("stringList"), QStringList { QStringLiteral("a"), QStringLiteral("b") } },
+        { QStringLiteral("list"), QVariantList { 1, QStringLiteral("two"), QVariantMap { { QStringLiteral("three"), 3 } } } },
+        { QStringLiteral("url"), QUrl(QStringLiteral("https://kde.org")) },
+    };
+
+    NetworkPacket np(QStringLiteral("com.test"), body);
+    np.setPayload(QSharedPointer<QIODevice>(new QBuffer), 1234);
+    np.setPayloadTransferInfo({ { QStringLiteral("port"), 1739 } });
+
+    QByteArray buffer;
+    np.serialize(&buffer);
+    QVERIFY(buffer.endsWith('\n'));
+
+    QJsonParseError error;
+    const QVariantMap parsed = QJsonDocument::fromJson(buffer, &error).toVariant().toMap();
+    QCOMPARE(error.error, QJsonParseError::NoError);
+    QCOMPARE(parsed.value(QStringLiteral("id")).toString(), np.id());
+    QCOMPARE(parsed.value(QStringLiteral("type")).toString(), np.type());
+    QCOMPARE(parsed.value(QStringLiteral("payloadSize")).toLongLong(), Q_INT64_C(1234));
+    QCOMPARE(parsed.value(QStringLiteral("payloadTransferInfo")).toMap(), np.payloadTransferInfo());
+    QCOMPARE(parsed.value(QStringLiteral("body")).toMap(), QJsonDocument::fromVariant(body).toVariant().toMap());
+
+    // Doubles beyond the integer range and non-finite ones, written as null like QJsonDocument does
+    NetworkPacket doubles(QStringLiteral("com.test"), {
+        { QStringLiteral("huge"), 1e300 },
+        { QStringLiteral("negative"), -3.0e19 },
+        { QStringLiteral("integral"), 9007199254740991.0 },
+        { QStringLiteral("nan"), qQNaN() },
+        { QStringLiteral("infinity"), qInf() },
+    });
+    const QVariantMap doublesBody = QJsonDocument::fromJson(doubles.serialize(), &error).toVariant().toMap().value(QStringLiteral("body")).toMap();
+    QCOMPARE(error.error, QJsonParseError::NoError);
+    QCOMPARE(doublesBody.value(QStringLiteral("huge")).toDouble(), 1e300);
+    QCOMPARE(doublesBody.value(QStringLiteral("negative")).toDouble(), -3.0e19);
+    QCOMPARE(doublesBody.value(QStringLiteral("integral")).toDouble(), 9007199254740991.0);
+    QVERIFY(doublesBody.contains(QStringLiteral("nan")) && doublesBody.value(QStringLiteral("nan")).isNull());
+    QVERIFY(doublesBody.contains(QStringLiteral("infinity")) && doublesBody.value(QStringLiteral("infinity")).isNull());
+
+    // Serializing again into the same buffer reuses its allocation
+    const char* data = buffer.constData();
+    NetworkPacket small(QStringLiteral("com.test"));
+    small.serialize(&buffer);
+    QVERIFY(buffer.constData() == data);
+    QCOMPARE(buffer, small.serialize());
+
+    // The payload fields are there even without a payload, as they always were
+    const QVariantMap smallParsed = QJsonDocument::fromJson(buffer).toVariant().toMap();
+    QCOMPARE(smallParsed.value(QStringLiteral("payloadSize"), -1).toLongLong(), Q_INT64_C(0));
+    QVERIFY(smallParsed.contains(QStringLiteral("payloadTransferInfo")));
+}
+
+void NetworkPacketTests::networkPacketUnserializeBenchmark_data()
+{
+    QTest::addColumn<bool>("legacy");
+
+    QTest::newRow("qjsondocument") << true;
+    QTest::newRow("direct") << false;
+}
+
+void NetworkPacketTests::networkPacketUnserializeBenchmark()
+{
+    QFETCH(bool, legacy);
+
+    const QByteArray json = smsBatchJson(500);
+    QBENCHMARK {
+        NetworkPacket np(QStringLiteral("empty"));
+        if (legacy) {
+            legacyUnserialize(json, &np);
+        } else {
+            NetworkPacket::unserialize(json, &np);
+        }
+    }
+}
+
+void NetworkPacketTests::networkPacketTypeIdTest()
+{
+    QCOMPARE(NetworkPacket(PACKET_TYPE_IDENTITY).typeId(), int(PacketTypeRegistry::IdentityType));
+
+    const int pingId = PacketTypeRegistry::intern(QStringLiteral("kdeconnect.ping"));
+    QVERIFY(pingId > PacketTypeRegistry::PairType);
+    QCOMPARE(PacketTypeRegistry::intern(QStringLiteral("kdeconnect.ping")), pingId);
+    QCOMPARE(PacketTypeRegistry::name(pingId), QStringLiteral("kdeconnect.ping"));
+
+    NetworkPacket np(QStringLiteral("empty"));
+    QVERIFY(NetworkPacket::unserialize(QByteArrayLiteral("{\"id\":\"1\",\"type\":\"kdeconnect.ping\",\"body\":{}}"), &np));
+    QCOMPARE(np.typeId(), pingId);
+
+    // Types nobody registered are not added to the table by parsing
+    const int count = PacketTypeRegistry::count();
+    QVERIFY(NetworkPacket::unserialize(QByteArrayLiteral("{\"id\":\"1\",\"type\":\"kdeconnect.bogus\",\"body\":{}}"), &np));
+    QCOMPARE(np.typeId(), int(PacketTypeRegistry::UnknownType));
+    QCOMPARE(np.type(), QStringLiteral("kdeconnect.bogus"));
+    QCOMPARE(PacketTypeRegistry::count(), count);
+}
+
+// Address of the first value in the body, equal for packets sharing the same body data
+static const QVariant* bodyData(const NetworkPacket& np)
+{
+    return &np.body().constBegin().value();
+}
+
+void NetworkPacketTests::networkPacketSharingTest()
+{
+    NetworkPacket np(QStringLiteral("empty"));
+    QVERIFY(NetworkPacket::unserialize(smsBatchJson(50), &np));
+    const QVariant* original = bodyData(np);
+
+    NetworkPacket copy(np);
+    QCOMPARE(bodyData(copy), original);
+
+    NetworkPacket moved(std::move(copy));
+    QCOMPARE(bodyData(moved), original);
+
+    // Writing detaches only the packet being written to
+    moved.set(QStringLiteral("extra"), 1);
+    QVERIFY(bodyData(moved) != original);
+    QCOMPARE(bodyData(np), original);
+    QVERIFY(!np.has(QStringLiteral("extra")));
+
+    // Fan-out like DeviceLink::receivedPacket -> Device -> plugins, plus a queued receiver
+    qRegisterMetaType<NetworkPacket>();
+    QList<const QVariant*> seen;
+    for (int i = 0; i < 4; ++i) {
+        connect(this, &NetworkPacketTests::packetReceived, this, [&seen](const NetworkPacket& received) {
+            seen.append(bodyData(received));
+        });
+    }
+    connect(this, &NetworkPacketTests::packetReceived, this, [&seen](const NetworkPacket& received) {
+        seen.append(bodyData(received));
+    }, Qt::QueuedConnection);
+
+    Q_EMIT packetReceived(np);
+    QCoreApplication::processEvents();
+    disconnect(this, &NetworkPacketTests::packetReceived, nullptr, nullptr);
+
+    QCOMPARE(seen.size(), 5);
+    for (const QVariant* data : qAsConst(seen)) {
+        QCOMPARE(data, original);
+    }
+}
+
+void NetworkPacketTests::networkPacketCborTest()
+{
+    if (!NetworkPacket::supportedEncodings().contains(QStringLiteral("cbor"))) {
+        QSKIP("Built without CBOR support");
+    }
+
+    NetworkPacket identity(QStringLiteral("empty"));
+    NetworkPacket::createIdentityPacket(&identity);
+    QCOMPARE(NetworkPacket::negotiateEncoding(identity), NetworkPacket::CborEncoding);
+    QCOMPARE(NetworkPacket::negotiateEncoding(NetworkPacket(PACKET_TYPE_IDENTITY)), NetworkPacket::JsonEncoding);
+
+    const QList<NetworkPacket> packets = { vcardsPacket(3), smsPacket(3), sinkListPacket(2), identity };
+    for (NetworkPacket np : packets) {
+        np.set(QStringLiteral("fraction"), 0.1);
+        np.set(QStringLiteral("negative"), -42);
+        np.set(QStringLiteral("big"), Q_INT64_C(1539272612000));
+        np.setPayload(QSharedPointer<QIODevice>(new QBuffer), 1234);
+        np.setPayloadTransferInfo({ { QStringLiteral("port"), 1739 } });
+
+        // Both encodings must hand the same variants to plugins
+        NetworkPacket fromJson(QStringLiteral("empty"));
+        QVERIFY(NetworkPacket::unserialize(np.serialize(), &fromJson));
+
+        QByteArray cbor;
+        np.serializeCbor(&cbor);
+        NetworkPacket fromCbor(QStringLiteral("empty"));
+        QVERIFY(NetworkPacket::unserializeCbor(cbor, &fromCbor));
+
+        QCOMPARE(fromCbor.id(), fromJson.id());
+        QCOMPARE(fromCbor.type(), fromJson.type());
+        QCOMPARE(fromCbor.body(), fromJson.body());
+        QCOMPARE(fromCbor.payloadSize(), fromJson.payloadSize());
+        QCOMPARE(fromCbor.payloadTransferInfo(), fromJson.payloadTransferInfo());
+    }
+
+    // Truncated frames are rejected without touching the packet
+    QByteArray cbor;
+    smsPacket(3).serializeCbor(&cbor);
+    NetworkPacket np(QStringLiteral("untouched"));
+    QVERIFY(!NetworkPacket::unserializeCbor(cbor.left(cbor.size() / 2), &np));
+    QCOMPARE(np.type(), QStringLiteral("untouched"));
+}
+
+void NetworkPacketTests::networkPacketStreamDecoderTest()
+{
+    //Like the sms plugin does when it is loaded
+    PacketTypeRegistry::setStreamedArray(PacketTypeRegistry::intern(QStringLiteral("kdeconnect.sms.messages")), QStringLiteral("messages"));
+
+    NetworkPacket np = smsPacket(200);
+    const QVariantList expected = np.get<QVariantList>(QStringLiteral("messages"));
+    // Sorts after "messages", so it is decoded after the array
+    np.set(QStringLiteral("more"), true);
+    const QByteArray json = np.serialize();
+
+    // Fed in small chunks like a socket would, dropping whatever was consumed
+    NetworkPacketStreamDecoder decoder;
+    QVariantList elements;
+    QByteArray pending;
+    int maxPending = 0;
+    const int chunkSize = 500;
+    for (int offset = 0; offset < json.size() && !decoder.isFinished(); offset += chunkSize) {
+        pending += json.mid(offset, chunkSize);
+        pending.remove(0, decoder.decode(pending, &elements));
+        QVERIFY(!decoder.hasError());
+        QVERIFY(!decoder.isDeclined());
+        maxPending = qMax(maxPending, pending.size());
+    }
+    QVERIFY(decoder.isStreaming());
+    QCOMPARE(decoder.header().type(), QStringLiteral("kdeconnect.sms.messages"));
+    QVERIFY(decoder.takePacket(&np));
+    QCOMPARE(elements, expected);
+    QCOMPARE(np.type(), QStringLiteral("kdeconnect.sms.messages"));
+    QCOMPARE(np.typeId(), PacketTypeRegistry::lookup(np.type()));
+    QVERIFY(!np.has(QStringLiteral("messages")));
+    QVERIFY(np.get<bool>(QStringLiteral("more")));
+    QVERIFY(maxPending < 2 * chunkSize);
+    QVERIFY(pending.trimmed().isEmpty());
+
+    // Types without a streamed array, and bodies before the type, are left to NetworkPacket::unserialize
+    decoder.reset();
+    QCOMPARE(decoder.decode(vcardsPacket(3).serialize(), &elements), 0);
+    QVERIFY(decoder.isDeclined());
+    decoder.reset();
+    QCOMPARE(decoder.decode("{\"id\":1,\"body\":{\"messages\":[{}]},\"type\":\"kdeconnect.sms.messages\"}\n", &elements), 0);
+    QVERIFY(decoder.isDeclined());
+
+    // Nothing is consumed before the array starts
+    decoder.reset();
+    QCOMPARE(decoder.decode("{\"id\":1,\"type\":\"kdeconnect.sms.messages\",\"bo", &elements), 0);
+    QVERIFY(!decoder.isStreaming());
+    QVERIFY(!decoder.hasError());
+}
+
+void NetworkPacketTests::networkPacketViewTest()
+{
+    NetworkPacket np(QStringLiteral("empty"));
+    QVERIFY(NetworkPacket::unserialize("{\"id\":1,\"type\":\"kdeconnect.mousepad.request\",\"body\":{\"dx\":1.5,\"dy\":-2,"
+                                       "\"key\":\"a\",\"unknown\":{},\"scroll\":null,\"playerList\":[\"vlc\",\"spotify\"],"
+                                       "\"SetPosition\":1539272612000}}\n", &np));
+
+    TestRequest request;
+    QVERIFY(request.decode(np));
+    QCOMPARE(request.dx, 1.5f);
+    QCOMPARE(request.dy, -2.0f);
+    QCOMPARE(request.key, QStringLiteral("a"));
+    QCOMPARE(request.players, QStringList({ QStringLiteral("vlc"), QStringLiteral("spotify") }));
+    QCOMPARE(request.position, Q_INT64_C(1539272612000));
+    QVERIFY(request.has(TestRequest::dxField));
+    QVERIFY(request.has(TestRequest::keyField));
+
+    // Missing and null fields keep their default
+    QVERIFY(!request.singleClick);
+    QVERIFY(!request.has(TestRequest::singleClickField));
+    QVERIFY(!request.scroll);
+    QVERIFY(!request.has(TestRequest::scrollField));
+    QCOMPARE(request.specialKey, 0);
+
+    // A field of the wrong type rejects the whole packet
+    np.set(QStringLiteral("specialKey"), QStringLiteral("escape"));
+    QVERIFY(!TestRequest().decode(np));
+    np.set(QStringLiteral("specialKey"), 12);
+    np.set(QStringLiteral("playerList"), QVariantMap());
+    QVERIFY(!TestRequest().decode(np));
+}
+
+void NetworkPacketTests::networkPacketViewBenchmark_data()
+{
+    QTest::addColumn<bool>("view");
+
+    QTest::newRow("get") << false;
+    QTest::newRow("view") << true;
+}
+
+void NetworkPacketTests::networkPacketViewBenchmark()
+{
+    QFETCH(bool, view);
+
+    // A mouse move, the most frequent packet there is
+    NetworkPacket np(QStringLiteral("kdeconnect.mousepad.request"), { { QStringLiteral("dx"), 3.5 }, { QStringLiteral("dy"), -1.25 } });
+
+    float total = 0;
+    QBENCHMARK {
+        if (view) {
+            TestRequest request;
+            request.decode(np);
+            if (!request.singleClick && !request.scroll && request.key.isEmpty() && !request.specialKey) {
+                total += request.dx + request.dy;
+            }
+        } else {
+            const bool isSingleClick = np.get<bool>(QStringLiteral("singleclick"), false);
+            const bool isScroll = np.get<bool>(QStringLiteral("scroll"), false);
+            const QString key = np.get<QString>(QStringLiteral("key"), QLatin1String(""));
+            const int specialKey = np.get<int>(QStringLiteral("specialKey"), 0);
+            if (!isSingleClick && !isScroll && key.isEmpty() && !specialKey) {
+                total += np.get<float>(QStringLiteral("dx"), 0) + np.get<float>(QStringLiteral("dy"), 0);
+            }
+        }
+    }
+    QVERIFY(total != 0);
+}
+
+void NetworkPacketTests::networkPacketEncodingBenchmark_data()
+{
+    QTest::addColumn<NetworkPacket>("packet");
+    QTest::addColumn<bool>("cbor");
+    QTest::addColumn<bool>("decode");
+
+    const QList<QPair<const char*, NetworkPacket>> packets = {
+        { "vcards", vcardsPacket(200) },
+        { "sms", smsPacket(500) },
+        { "sinklist", sinkListPacket(8) },
+    };
+    for (const auto& packet : packets) {
+        QTest::newRow(QByteArray(packet.first).append("-json-encode").constData()) << packet.second << false << false;
+        QTest::newRow(QByteArray(packet.first).append("-json-decode").constData()) << packet.second << false << true;
+        QTest::newRow(QByteArray(packet.first).append("-cbor-encode").constData()) << packet.second << true << false;
+        QTest::newRow(QByteArray(packet.first).append("-cbor-decode").constData()) << packet.second << true << true;
+    }
+}
+
+void NetworkPacketTests::networkPacketEncodingBenchmark()
+{
+    QFETCH(NetworkPacket, packet);
+    QFETCH(bool, cbor);
+    QFETCH(bool, decode);
+
+    if (cbor && !NetworkPacket::supportedEncodings().contains(QStringLiteral("cbor"))) {
+        QSKIP("Built without CBOR support");
+    }
+
+    QByteArray buffer;
+    if (cbor) {
+        packet.serializeCbor(&buffer);
+    } else {
+        packet.serialize(&buffer);
+    }
+    if (!decode) {
+        qDebug() << "Bytes on the wire:" << buffer.size();
+    }
+
+    QBENCHMARK {
+        if (decode) {
+            NetworkPacket np(QStringLiteral("empty"));
+            if (cbor) {
+                NetworkPacket::unserializeCbor(buffer, &np);
+            } else {
+                NetworkPacket::unserialize(buffer, &np);
+            }
+        } else if (cbor) {
+            packet.serializeCbor(&buffer);
+        } else {
+            packet.serialize(&buffer);
+        }
+    }
+}
+
 void NetworkPacketTests::cleanupTestCase()
 {
     // Called after the last testfunction was executed
@@ -23,6 +23,8 @@
 
 #include <QObject>
 
+class NetworkPacket;
+
 class NetworkPacketTests : public QObject
 {
     Q_OBJECT
@@ -32,6 +34,19 @@ private Q_SLOTS:
 
     void networkPacketTest();
     void networkPacketIdentityTest();
+    void networkPacketUnserializeTest();
+    void networkPacketSerializeTest();
+    void networkPacketUnserializeBenchmark_data();
+    void networkPacketUnserializeBenchmark();
+    void networkPacketTypeIdTest();
+    void networkPacketSharingTest();
+    void networkPacketCborTest();
+    void networkPacketStreamDecoderTest();
+    void networkPacketViewTest();
+    void networkPacketViewBenchmark_data();
+    void networkPacketViewBenchmark();
+    void networkPacketEncodingBenchmark_data();
+    void networkPacketEncodingBenchmark();
     //void networkPacketEncryptionTest();
 
     void cleanupTestCase();
@@ -39,6 +54,9 @@ private Q_SLOTS:
     void init();
     void cleanup();
 
+Q_SIGNALS:
+    void packetReceived(const NetworkPacket& np);
+
 };
 
 #endif 
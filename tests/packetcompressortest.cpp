@@ -0,0 +1,96 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../core/backends/packetcompressor.h"
+
+#include <QTest>
+
+class PacketCompressorTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void roundTrip();
+    void sharedHistory();
+    void corruptInput();
+    void sizeLimit();
+};
+
+static QByteArray vcard(int i)
+{
+    return QStringLiteral("BEGIN:VCARD\nVERSION:2.1\nFN:Contact %1\nTEL;CELL:+1 555 %1\nX-KDECONNECT-TIMESTAMP:1539272612000\nEND:VCARD").arg(i).toUtf8();
+}
+
+void PacketCompressorTest::roundTrip()
+{
+    PacketCompressor sender;
+    PacketCompressor receiver;
+
+    QByteArray compressed;
+    QByteArray decompressed;
+    for (int i = 0; i < 50; ++i) {
+        const QByteArray input = vcard(i).repeated(i + 1);
+        QVERIFY(sender.compress(input, &compressed));
+        QVERIFY(receiver.decompress(compressed, &decompressed, 1024 * 1024));
+        QCOMPARE(decompressed, input);
+    }
+
+    QCOMPARE(sender.sentStatistics().packets, quint64(50));
+    QCOMPARE(receiver.receivedStatistics().packets, quint64(50));
+    QCOMPARE(receiver.receivedStatistics().compressedBytes, sender.sentStatistics().compressedBytes);
+    QVERIFY(sender.sentStatistics().ratio() > 1.0);
+}
+
+void PacketCompressorTest::sharedHistory()
+{
+    // A packet repeating an earlier one costs a few bytes, because the history is kept
+    PacketCompressor compressor;
+    QByteArray first;
+    QByteArray second;
+    const QByteArray input = vcard(1).repeated(3);
+    QVERIFY(compressor.compress(input, &first));
+    QVERIFY(compressor.compress(input, &second));
+    QVERIFY2(second.size() * 4 < first.size(), QByteArray::number(second.size()).constData());
+}
+
+void PacketCompressorTest::corruptInput()
+{
+    PacketCompressor compressor;
+    QByteArray output;
+    QVERIFY(!compressor.decompress(QByteArray("\xff\xff\xff\xff garbage", 12), &output, 1024));
+
+    // Once broken the streams can't be trusted anymore
+    QVERIFY(!compressor.compress(vcard(1), &output));
+}
+
+void PacketCompressorTest::sizeLimit()
+{
+    PacketCompressor sender;
+    PacketCompressor receiver;
+    QByteArray compressed;
+    QByteArray decompressed;
+    QVERIFY(sender.compress(QByteArray(100000, 'a'), &compressed));
+    QVERIFY(compressed.size() < 1000);
+    QVERIFY(!receiver.decompress(compressed, &decompressed, 4096));
+}
+
+QTEST_GUILESS_MAIN(PacketCompressorTest)
+
+#include "packetcompressortest.moc"
@@ -0,0 +1,196 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../core/backends/payloadmultiplexer.h"
+#include "../core/backends/packetframer.h"
+
+#include <QBuffer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTest>
+
+//One end of a link, routing the frames it receives to its multiplexer
+class Endpoint
+    : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Endpoint(QTcpSocket* socket)
+        : m_socket(socket)
+        , m_multiplexer(socket)
+        , m_ok(true)
+    {
+        m_framer.setFraming(PacketFramer::LengthPrefixedFraming);
+        connect(m_socket, &QIODevice::readyRead, this, [this]() {
+            m_ok = m_ok && m_framer.readFrom(m_socket);
+            PacketFramer::Frame frame;
+            while (m_framer.nextFrame(&frame)) {
+                m_ok = m_ok && m_multiplexer.handleFrame(frame.type, frame.data);
+            }
+        });
+    }
+
+    QTcpSocket* m_socket;
+    PayloadMultiplexer m_multiplexer;
+    PacketFramer m_framer;
+    bool m_ok;
+};
+
+class PayloadMultiplexerTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void concurrentStreams();
+    void cancel();
+    void abortedSource();
+
+private:
+    QTcpServer m_server;
+    Endpoint* m_sender = nullptr;
+    Endpoint* m_receiver = nullptr;
+};
+
+static QByteArray testData(int size, int seed)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    quint32 state = quint32(seed) * 2654435761u + 1;
+    for (int i = 0; i < size; ++i) {
+        state = state * 1103515245u + 12345u;
+        data[i] = char(state >> 24);
+    }
+    return data;
+}
+
+static QSharedPointer<QIODevice> bufferWith(const QByteArray& data)
+{
+    QBuffer* buffer = new QBuffer;
+    buffer->setData(data);
+    return QSharedPointer<QIODevice>(buffer);
+}
+
+void PayloadMultiplexerTest::init()
+{
+    QVERIFY(m_server.listen(QHostAddress::LocalHost));
+    QTcpSocket* client = new QTcpSocket(this);
+    client->connectToHost(QHostAddress::LocalHost, m_server.serverPort());
+    QVERIFY(client->waitForConnected(4000));
+    QVERIFY(m_server.waitForNewConnection(4000) || m_server.hasPendingConnections());
+    QTcpSocket* server = m_server.nextPendingConnection();
+    QVERIFY(server);
+
+    m_sender = new Endpoint(client);
+    m_receiver = new Endpoint(server);
+}
+
+void PayloadMultiplexerTest::cleanup()
+{
+    delete m_sender;
+    delete m_receiver;
+    m_sender = m_receiver = nullptr;
+    m_server.close();
+}
+
+void PayloadMultiplexerTest::concurrentStreams()
+{
+    const QByteArray big = testData(3 * 1024 * 1024, 1);
+    const QByteArray small = testData(200 * 1024, 2);
+
+    const quint32 bigId = m_sender->m_multiplexer.send(bufferWith(big), big.size());
+    const quint32 smallId = m_sender->m_multiplexer.send(bufferWith(small), -1);
+    QVERIFY(bigId != smallId);
+
+    QSharedPointer<QIODevice> bigStream = m_receiver->m_multiplexer.receive(bigId);
+    QSharedPointer<QIODevice> smallStream = m_receiver->m_multiplexer.receive(smallId);
+
+    QByteArray bigReceived;
+    QByteArray smallReceived;
+    qint64 maxBuffered = 0;
+    connect(bigStream.data(), &QIODevice::readyRead, this, [&]() {
+        maxBuffered = qMax(maxBuffered, bigStream->bytesAvailable());
+        bigReceived += bigStream->readAll();
+    });
+    connect(smallStream.data(), &QIODevice::readyRead, this, [&]() {
+        smallReceived += smallStream->readAll();
+    });
+    int bigReceivedBeforeSmall = -1;
+    connect(smallStream.data(), &QIODevice::readChannelFinished, this, [&]() {
+        bigReceivedBeforeSmall = bigReceived.size();
+    });
+
+    //Whatever the multiplexer queues in the socket, a packet written now waits behind at most this much
+    qint64 maxQueued = 0;
+    connect(m_sender->m_socket, &QIODevice::bytesWritten, this, [&]() {
+        maxQueued = qMax(maxQueued, m_sender->m_socket->bytesToWrite());
+    });
+
+    QTRY_VERIFY_WITH_TIMEOUT(bigStream->atEnd() && smallStream->atEnd(), 10000);
+    QCOMPARE(bigReceived.size(), big.size());
+    QVERIFY(bigReceived == big);
+    QVERIFY(smallReceived == small);
+
+    //The small stream took turns with the big one instead of waiting for it
+    QVERIFY(bigReceivedBeforeSmall >= 0 && bigReceivedBeforeSmall < big.size());
+    QVERIFY(maxBuffered <= PayloadMultiplexer::Window);
+    QVERIFY(maxQueued < PayloadMultiplexer::MaxPendingWrite + 2 * PayloadMultiplexer::ChunkSize);
+    QCOMPARE(m_sender->m_multiplexer.outgoingCount(), 0);
+    QCOMPARE(m_receiver->m_multiplexer.incomingCount(), 0);
+    QVERIFY(m_sender->m_ok);
+    QVERIFY(m_receiver->m_ok);
+}
+
+void PayloadMultiplexerTest::cancel()
+{
+    const QByteArray big = testData(8 * 1024 * 1024, 3);
+    const quint32 id = m_sender->m_multiplexer.send(bufferWith(big), big.size());
+
+    //Nobody reads it, so the sender stalls once the window is full
+    QSharedPointer<QIODevice> stream = m_receiver->m_multiplexer.receive(id);
+    QTRY_COMPARE(stream->bytesAvailable(), qint64(PayloadMultiplexer::Window));
+    QCOMPARE(m_sender->m_multiplexer.outgoingCount(), 1);
+
+    //Dropping the payload cancels the upload
+    stream.clear();
+    QCOMPARE(m_receiver->m_multiplexer.incomingCount(), 0);
+    QTRY_COMPARE(m_sender->m_multiplexer.outgoingCount(), 0);
+    QVERIFY(m_sender->m_ok);
+    QVERIFY(m_receiver->m_ok);
+}
+
+void PayloadMultiplexerTest::abortedSource()
+{
+    //The source has less than announced
+    const QByteArray data = testData(1000, 4);
+    const quint32 id = m_sender->m_multiplexer.send(bufferWith(data), 5000);
+    QSharedPointer<QIODevice> stream = m_receiver->m_multiplexer.receive(id);
+
+    QTRY_COMPARE(m_receiver->m_multiplexer.incomingCount(), 0);
+    QCOMPARE(stream->readAll(), data);
+    QVERIFY(!stream->errorString().isEmpty());
+    QVERIFY(stream->atEnd());
+}
+
+QTEST_GUILESS_MAIN(PayloadMultiplexerTest)
+
+#include "payloadmultiplexertest.moc"
@@ -0,0 +1,69 @@
+/**
+ * Copyright 2018 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License or (at your option) version 3 or any later version
+ * accepted by the membership of KDE e.V. (or its successor approved
+ * by the membership of KDE e.V.), which shall act as a proxy
+ * defined in Section 14 of version 3 of the license.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+
+#include <KPluginFactory>
+
+#include "core/kdeconnectplugin.h"
+
+/**
+ * Appends "<plugin id>:<n>" to the "receivedPackets" property of the application for every
+ * packet, so tests can see in which order the packets reached every plugin.
+ * Packets with a "busy" field keep the plugin busy for that many milliseconds.
+ */
+class RecordingPlugin : public KdeConnectPlugin
+{
+    Q_OBJECT
+
+public:
+    RecordingPlugin(QObject* parent, const QVariantList& args)
+        : KdeConnectPlugin(parent, args)
+        , m_name(args.at(1).toString())
+    {
+    }
+
+    bool receivePacket(const NetworkPacket& np) override
+    {
+        QStringList log = qApp->property("receivedPackets").toStringList();
+        log.append(m_name + QLatin1Char(':') + np.get<QString>(QStringLiteral("n")));
+        qApp->setProperty("receivedPackets", log);
+
+        QElapsedTimer timer;
+        timer.start();
+        while (timer.elapsed() < np.get<int>(QStringLiteral("busy"))) {
+        }
+        return true;
+    }
+
+    void connected() override {}
+
+private:
+    const QString m_name;
+};
+
+#ifdef RECORDING_PLUGIN_SECOND
+K_PLUGIN_FACTORY_WITH_JSON(KdeConnectPluginFactory, "kdeconnect_testrecordersecond.json", registerPlugin<RecordingPlugin>();)
+#else
+K_PLUGIN_FACTORY_WITH_JSON(KdeConnectPluginFactory, "kdeconnect_testrecorderfirst.json", registerPlugin<RecordingPlugin>();)
+#endif
+
+#include "recordingplugin.moc"
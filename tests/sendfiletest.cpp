@@ -21,11 +21,30 @@
 #include <QSocketNotifier>
 #include <kdeconnectconfig.h>
 #include <backends/lan/uploadjob.h>
+#include <backends/lan/lanlinkprovider.h>
+#include <backends/lan/landevicelink.h>
+#include <backends/lan/lazypayloadsocket.h>
+#include <backends/lan/payloadportpool.h>
+#include <backends/bandwidthlimiter.h>
+#include <backends/stripedpayload.h>
+#include <core/filesink.h>
 #include <core/filetransferjob.h>
+#include <core/hashingfile.h>
+#include <core/deltatransfer.h>
 #include <QApplication>
+#include <QBuffer>
+#include <QCryptographicHash>
 #include <QNetworkAccessManager>
 #include <QTest>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QSslSocket>
+#include <QTcpServer>
 #include <QTemporaryFile>
+#include <QTimer>
+
+#include <ctime>
+#include <QSet>
 #include <QSignalSpy>
 #include <QStandardPaths>
 
@@ -87,6 +106,47 @@ class TestSendFile : public QObject
             QCOMPARE(file.readAll(), content);
         }
 
+        void testSendBatch()
+        {
+            Device* d = nullptr;
+            const QList<Device*> devicesList = m_daemon->devicesList();
+            for (Device* id : devicesList) {
+                if (id->isReachable() && id->isTrusted()) {
+                    d = id;
+                }
+            }
+            QVERIFY(d);
+
+            //More files than are uploaded at once, so some of them wait for a slot
+            QList<QSharedPointer<QTemporaryFile>> files;
+            QStringList urls;
+            for (int i = 0; i < 10; ++i) {
+                QSharedPointer<QTemporaryFile> temp(new QTemporaryFile);
+                QVERIFY(temp->open());
+                temp->write(QByteArray::number(i).repeated(1000 * (i + 1)));
+                temp->close();
+                files.append(temp);
+                urls.append(QUrl::fromLocalFile(temp->fileName()).toString());
+            }
+
+            KdeConnectPlugin* plugin = d->plugin(QStringLiteral("kdeconnect_share"));
+            QVERIFY(plugin);
+            QSignalSpy spy(plugin, SIGNAL(shareReceived(QString)));
+            plugin->metaObject()->invokeMethod(plugin, "shareUrls", Q_ARG(QStringList, urls));
+
+            QTRY_COMPARE_WITH_TIMEOUT(spy.count(), files.size(), 10000);
+            QSet<QByteArray> received;
+            for (const QVariantList& args : qAsConst(spy)) {
+                QFile file(args.first().toUrl().toLocalFile());
+                QVERIFY(file.open(QIODevice::ReadOnly));
+                received.insert(file.readAll());
+                file.remove();
+            }
+            for (int i = 0; i < files.size(); ++i) {
+                QVERIFY(received.contains(QByteArray::number(i).repeated(1000 * (i + 1))));
+            }
+        }
+
         void testSslJobs()
         {
             const QString aFile = QFINDTESTDATA("sendfiletest.cpp");
@@ -135,6 +195,499 @@ class TestSendFile : public QObject
             QCOMPARE(resultFile.readAll(), originFile.readAll());
         }
 
+        void testLazyPayload()
+        {
+            const QString deviceId = KdeConnectConfig::instance()->deviceId();
+            KdeConnectConfig* kcc = KdeConnectConfig::instance();
+            kcc->addTrustedDevice(deviceId, QStringLiteral("testdevice"), kcc->deviceType());
+            kcc->setDeviceProperty(deviceId, QStringLiteral("certificate"), QString::fromLatin1(kcc->certificate().toPem()));
+
+            QSharedPointer<QBuffer> buffer(new QBuffer);
+            buffer->setData("Nobody reads this");
+            UploadJob* uj = new UploadJob(buffer, deviceId);
+            int uploadResult = -1;
+            connect(uj, &KJob::result, this, [&uploadResult](KJob* job) { uploadResult = job->error(); });
+            uj->start();
+            const quint16 port = uj->transferInfo()[QStringLiteral("port")].toUInt();
+
+            //Nothing connects while nobody reads
+            LazyPayloadSocket* payload = new LazyPayloadSocket(QHostAddress::LocalHost, port, deviceId);
+            QTest::qWait(100);
+            QVERIFY(!payload->isConnecting());
+            QCOMPARE(uploadResult, -1);
+
+            //Dropping it unread lets the sender stop listening
+            delete payload;
+            QTRY_VERIFY_WITH_TIMEOUT(uploadResult >= 0, 5000);
+        }
+
+        void testPayloadPorts()
+        {
+            //Ports are handed out until the range is used up, and a released one is the next to go
+            PayloadPortPool pool;
+            QList<QTcpServer*> servers;
+            forever {
+                QTcpServer* server = new QTcpServer(this);
+                const quint16 port = pool.listen(server);
+                if (!port) {
+                    delete server;
+                    break;
+                }
+                QCOMPARE(server->serverPort(), port);
+                servers.append(server);
+                QCOMPARE(pool.inUse(), servers.size());
+            }
+            QVERIFY(!servers.isEmpty());
+
+            QTcpServer* server = servers.takeFirst();
+            const quint16 released = server->serverPort();
+            server->close();
+            pool.release(released);
+            QCOMPARE(pool.listen(server), released);
+            servers.append(server);
+            qDeleteAll(servers);
+
+            //A listener nobody connects to gives its port back
+            const QString deviceId = KdeConnectConfig::instance()->deviceId();
+            const int inUse = PayloadPortPool::instance()->inUse();
+            QSharedPointer<QBuffer> buffer(new QBuffer);
+            buffer->setData("Nobody comes for this");
+            UploadJob* uj = new UploadJob(buffer, deviceId);
+            uj->setAcceptTimeout(100);
+            int uploadResult = -1;
+            connect(uj, &KJob::result, this, [&uploadResult](KJob* job) { uploadResult = job->error(); });
+            uj->start();
+            QVERIFY(uj->isWaiting());
+            QCOMPARE(PayloadPortPool::instance()->inUse(), inUse + 1);
+            QTRY_VERIFY_WITH_TIMEOUT(uploadResult > 0, 5000);
+            QCOMPARE(PayloadPortPool::instance()->inUse(), inUse);
+        }
+
+        void testBandwidthLimiter()
+        {
+            //A quarter of a second worth of burst, then the rate
+            TokenBucket bucket(100000);
+            QCOMPARE(bucket.available(0), qint64(25000));
+            bucket.consume(25000, 0);
+            QCOMPARE(bucket.available(0), qint64(0));
+            QCOMPARE(bucket.msecsUntil(10000, 0), 100);
+            QCOMPARE(bucket.available(100), qint64(10000));
+            QCOMPARE(bucket.available(10000), qint64(25000));
+
+            BandwidthLimiter limiter;
+            const QString limited = QStringLiteral("limited");
+            const QString unlimited = QStringLiteral("unlimited");
+            limiter.setDeviceRate(limited, 64 * 1024);
+            QCOMPARE(limiter.deviceRate(limited), qint64(64 * 1024));
+            const qint64 burst = limiter.allowance(limited, 1024 * 1024);
+            QCOMPARE(burst, TokenBucket::MinBurst);
+            limiter.consume(limited, burst);
+            QCOMPARE(limiter.allowance(limited, 1024 * 1024), qint64(0));
+            QVERIFY(limiter.msecsToWait(limited) > 0);
+            QCOMPARE(limiter.allowance(unlimited, 1024 * 1024), qint64(1024 * 1024));
+
+            //Input and media controls are interactive, bulk packets like SMS dumps are not
+            QVERIFY(BandwidthLimiter::isInteractive(QStringLiteral("kdeconnect.mousepad.request")));
+            QVERIFY(BandwidthLimiter::isInteractive(QStringLiteral("kdeconnect.mpris.request")));
+            QVERIFY(!BandwidthLimiter::isInteractive(QStringLiteral("kdeconnect.sms.messages")));
+            QVERIFY(!BandwidthLimiter::isInteractive(QStringLiteral("kdeconnect.contacts.response_vcards")));
+
+            //An interactive packet holds back payloads to that device only
+            limiter.interactiveTraffic(unlimited);
+            QCOMPARE(limiter.allowance(unlimited, 1024 * 1024), qint64(0));
+            QVERIFY(limiter.msecsToWait(unlimited) <= BandwidthLimiter::InteractiveHold);
+            QTRY_COMPARE(limiter.allowance(unlimited, 1024 * 1024), qint64(1024 * 1024));
+
+            //The global rate applies to every device
+            limiter.setRate(32 * 1024);
+            limiter.consume(unlimited, limiter.allowance(unlimited, 1024 * 1024));
+            QCOMPARE(limiter.allowance(unlimited, 1024 * 1024), qint64(0));
+        }
+
+        void testResumeTransfer()
+        {
+            const QByteArray content = QByteArray("0123456789abcdef").repeated(10000);
+            const int offset = content.size() / 3;
+            const QString partFile = QDir::tempPath() + "/kdeconnect-test-partfile";
+
+            //Resuming appends the rest after what is already there
+            QFile part(partFile);
+            QVERIFY(part.open(QIODevice::WriteOnly | QIODevice::Truncate));
+            part.write(content.left(offset));
+            part.close();
+
+            QSharedPointer<QBuffer> rest(new QBuffer);
+            rest->setData(content.mid(offset));
+            rest->open(QIODevice::ReadOnly);
+            FileTransferJob* ft = new FileTransferJob(rest, content.size() - offset, QUrl::fromLocalFile(partFile));
+            ft->setResumeOffset(offset);
+            int error = -1;
+            connect(ft, &KJob::result, this, [&error](KJob* job) { error = job->error(); });
+            ft->start();
+            QTRY_COMPARE_WITH_TIMEOUT(error, 0, 5000);
+
+            QVERIFY(part.open(QIODevice::ReadOnly));
+            QCOMPARE(part.readAll(), content);
+            part.close();
+
+            //An interrupted transfer keeps everything received so far
+            QSharedPointer<QBuffer> truncated(new QBuffer);
+            truncated->setData(content.mid(offset, 1000));
+            truncated->open(QIODevice::ReadOnly);
+            ft = new FileTransferJob(truncated, content.size() - offset, QUrl::fromLocalFile(partFile));
+            ft->setResumeOffset(offset);
+            error = -1;
+            connect(ft, &KJob::result, this, [&error](KJob* job) { error = job->error(); });
+            ft->start();
+            QTRY_VERIFY_WITH_TIMEOUT(error > 0, 5000);
+
+            QVERIFY(part.open(QIODevice::ReadOnly));
+            QCOMPARE(part.readAll(), content.left(offset + 1000));
+            part.remove();
+        }
+
+        void testVerifyDigest()
+        {
+            const QByteArray content = QByteArray("0123456789abcdef").repeated(10000);
+            const int offset = 1000;
+
+            //The sender hashes what gets read from it, starting at the offset
+            QTemporaryFile source;
+            QVERIFY(source.open());
+            source.write(content);
+            source.close();
+            HashingFile file(source.fileName());
+            QSignalSpy spyDigest(&file, &HashingFile::digestReady);
+            QVERIFY(file.openAt(offset));
+            QCOMPARE(file.readAll(), content.mid(offset));
+            QCOMPARE(spyDigest.count(), 1);
+            const QByteArray digest = spyDigest.first().first().toByteArray();
+            QCOMPARE(digest, QCryptographicHash::hash(content.mid(offset), QCryptographicHash::Sha256));
+
+            //The receiver only finishes once that digest matches what it wrote
+            const QString partFile = QDir::tempPath() + "/kdeconnect-test-digestfile";
+            QByteArray corrupted = digest;
+            corrupted[0] = ~corrupted[0];
+            for (const QByteArray& expected : { digest, corrupted }) {
+                QFile(partFile).remove();
+                QSharedPointer<QBuffer> data(new QBuffer);
+                data->setData(content.mid(offset));
+                data->open(QIODevice::ReadOnly);
+                FileTransferJob* ft = new FileTransferJob(data, content.size() - offset, QUrl::fromLocalFile(partFile));
+                ft->setResumeOffset(0);
+                ft->setVerifyDigest(true);
+                int error = -1;
+                connect(ft, &KJob::result, this, [&error](KJob* job) { error = job->error(); });
+                ft->start();
+                QTest::qWait(100);
+                QCOMPARE(error, -1);
+                ft->setDigest(expected);
+                QCOMPARE(error, expected == digest ? 0 : int(FileTransferJob::DigestMismatchError));
+            }
+            QFile(partFile).remove();
+        }
+
+        void testFileSink()
+        {
+            const QByteArray content = QByteArray("0123456789abcdef").repeated(200000);
+            const QString path = QDir::tempPath() + "/kdeconnect-test-sinkfile";
+            QFile(path).remove();
+
+            //The name is taken right away, but nothing shows up under it until the sink is finished
+            FileSink* sink = new FileSink(path, FileSink::Replace, 0, content.size());
+            QSignalSpy spyDone(sink, &FileSink::done);
+            QVERIFY(QFile::exists(path));
+            for (int i = 0; i < content.size(); i += 100000) {
+                sink->write(content.mid(i, 100000));
+            }
+            QTest::qWait(100);
+            QCOMPARE(QFileInfo(path).size(), qint64(0));
+
+            //A second sink for the same name doesn't overwrite the first one
+            FileSink* other = new FileSink(path, FileSink::Replace, 0, 5);
+            QSignalSpy spyOther(other, &FileSink::done);
+            other->write(QByteArray("other"));
+            other->finish();
+            QVERIFY(spyOther.count() || spyOther.wait(5000));
+            QVERIFY(!spyOther.first().first().toString().isEmpty());
+            delete other;
+            QVERIFY(QFile::exists(path));
+
+            sink->finish();
+            QVERIFY(spyDone.count() || spyDone.wait(5000));
+            QCOMPARE(spyDone.first().first().toString(), QString());
+            QCOMPARE(sink->pendingBytes(), 0);
+            delete sink;
+
+            QFile file(path);
+            QVERIFY(file.open(QIODevice::ReadOnly));
+            QCOMPARE(file.readAll(), content);
+            file.close();
+
+            //An aborted Replace sink gives the name back
+            const QString abortedPath = path + ".aborted";
+            QFile(abortedPath).remove();
+            sink = new FileSink(abortedPath, FileSink::Replace, 0, -1);
+            QSignalSpy spyDropped(sink, &FileSink::done);
+            sink->write(QByteArray("dropped"));
+            sink->abort();
+            QVERIFY(spyDropped.count() || spyDropped.wait(5000));
+            delete sink;
+            QVERIFY(!QFile::exists(abortedPath));
+
+            //Appending from an odd offset drops what was after it, and an abort keeps the data
+            sink = new FileSink(path, FileSink::Append, 12345, -1);
+            QSignalSpy spyAborted(sink, &FileSink::done);
+            sink->write(QByteArray("tail"));
+            sink->abort();
+            QVERIFY(spyAborted.count() || spyAborted.wait(5000));
+            delete sink;
+            QVERIFY(file.open(QIODevice::ReadOnly));
+            QCOMPARE(file.readAll(), content.left(12345) + "tail");
+            file.remove();
+        }
+
+        void testDeltaTransfer()
+        {
+            //Blocks must differ from each other, so the old copy is random data
+            QByteArray base(1000000, Qt::Uninitialized);
+            quint32 seed = 42;
+            for (int i = 0; i < base.size(); ++i) {
+                seed = seed * 1103515245 + 12345;
+                base[i] = char(seed >> 24);
+            }
+            //Edited in place, with bytes inserted and removed in between
+            QByteArray content = base;
+            content.replace(1000, 10, "changed");
+            content.insert(300000, QByteArray("inserted").repeated(100));
+            content.remove(700000, 5000);
+            content.append("appended");
+
+            const QString basePath = QDir::tempPath() + "/kdeconnect-test-deltabase";
+            const QString partFile = QDir::tempPath() + "/kdeconnect-test-deltafile";
+            QFile baseFile(basePath);
+            QVERIFY(baseFile.open(QIODevice::WriteOnly | QIODevice::Truncate));
+            baseFile.write(base);
+            baseFile.close();
+
+            const int blockSize = DeltaSignatures::blockSizeFor(base.size());
+            DeltaSignatures signatures;
+            QVERIFY(signatures.parse(DeltaSignatures::compute(basePath, blockSize)));
+            QCOMPARE(signatures.blockCount(), base.size() / blockSize);
+
+            QSharedPointer<QBuffer> source(new QBuffer);
+            source->setData(content);
+            source->open(QIODevice::ReadOnly);
+            DeltaEncoder encoder(source, signatures);
+            QVERIFY(encoder.open(QIODevice::ReadOnly));
+            const QByteArray delta = encoder.readAll();
+            QVERIFY(encoder.atEnd());
+            //Only the edits and the blocks around them are sent
+            QVERIFY2(delta.size() < 50000, QByteArray::number(delta.size()).constData());
+
+            QFile(partFile).remove();
+            QSharedPointer<QBuffer> received(new QBuffer);
+            received->setData(delta);
+            received->open(QIODevice::ReadOnly);
+            FileTransferJob* ft = new FileTransferJob(received, content.size(), QUrl::fromLocalFile(partFile));
+            ft->setResumeOffset(0);
+            QVERIFY(ft->setDeltaBase(basePath, blockSize));
+            int error = -1;
+            connect(ft, &KJob::result, this, [&error](KJob* job) { error = job->error(); });
+            ft->start();
+            QTRY_COMPARE_WITH_TIMEOUT(error, 0, 5000);
+
+            QFile part(partFile);
+            QVERIFY(part.open(QIODevice::ReadOnly));
+            QCOMPARE(part.readAll(), content);
+            part.remove();
+            baseFile.remove();
+        }
+
+        void testUploadThroughput_data()
+        {
+            QTest::addColumn<int>("chunkSize");
+
+            QTest::newRow("64KB") << 64 * 1024;
+            QTest::newRow("256KB") << int(UploadJob::DefaultChunkSize);
+            QTest::newRow("1MB") << 1024 * 1024;
+        }
+
+        void testUploadThroughput()
+        {
+            QFETCH(int, chunkSize);
+
+            const QString deviceId = KdeConnectConfig::instance()->deviceId();
+            KdeConnectConfig* kcc = KdeConnectConfig::instance();
+            kcc->addTrustedDevice(deviceId, QStringLiteral("testdevice"), kcc->deviceType());
+            kcc->setDeviceProperty(deviceId, QStringLiteral("certificate"), QString::fromLatin1(kcc->certificate().toPem()));
+
+            const qint64 size = 256 * 1024 * 1024;
+            QTemporaryFile temp;
+            QVERIFY(temp.open());
+            const QByteArray block(1024 * 1024, 'x');
+            for (qint64 written = 0; written < size; written += block.size()) {
+                temp.write(block);
+            }
+            temp.close();
+
+            QSharedPointer<QFile> f(new QFile(temp.fileName()));
+            UploadJob* uj = new UploadJob(f, deviceId);
+            uj->setChunkSize(chunkSize);
+            QSignalSpy spyUpload(uj, &KJob::result);
+            int uploadError = -1;
+            connect(uj, &KJob::result, this, [&](KJob* job) { uploadError = job->error(); });
+            uj->start();
+
+            QSslSocket socket;
+            LanLinkProvider::configureSslSocket(&socket, deviceId, true);
+            qint64 received = 0;
+            connect(&socket, &QIODevice::readyRead, this, [&]() {
+                received += socket.readAll().size();
+            });
+
+            //The event loop must keep running while the upload goes on, nothing may block it
+            int ticks = 0;
+            QTimer ticker;
+            connect(&ticker, &QTimer::timeout, this, [&]() { ++ticks; });
+            ticker.start(10);
+
+            QElapsedTimer timer;
+            timer.start();
+            const std::clock_t cpuStart = std::clock();
+            socket.connectToHostEncrypted(QStringLiteral("127.0.0.1"), uj->transferInfo()[QStringLiteral("port")].toUInt());
+            QTRY_COMPARE_WITH_TIMEOUT(received, size, 120000);
+            const qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+            //Both ends run in this process, so this is the cpu time to encrypt and decrypt
+            const double cpuSeconds = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+            qDebug() << "Uploaded" << size / (1024 * 1024) << "MB in" << elapsed << "ms:"
+                     << (size / (1024.0 * 1024.0)) / (elapsed / 1000.0) << "MB/s,"
+                     << cpuSeconds * (1024.0 * 1024.0 * 1024.0) / size << "cpu seconds per GB," << ticks << "timer ticks";
+            QVERIFY(ticks > elapsed / 10 / 4);
+            QVERIFY(spyUpload.count() || spyUpload.wait(5000));
+            QCOMPARE(uploadError, 0);
+        }
+
+        void testStripedTransfer_data()
+        {
+            QTest::addColumn<int>("stripes");
+
+            QTest::newRow("1") << 1;
+            QTest::newRow("2") << 2;
+            QTest::newRow("4") << 4;
+            QTest::newRow("8") << int(StripedPayload::MaxStripes);
+        }
+
+        void testStripedTransfer()
+        {
+            QFETCH(int, stripes);
+
+            const QString deviceId = KdeConnectConfig::instance()->deviceId();
+            KdeConnectConfig* kcc = KdeConnectConfig::instance();
+            kcc->addTrustedDevice(deviceId, QStringLiteral("testdevice"), kcc->deviceType());
+            kcc->setDeviceProperty(deviceId, QStringLiteral("certificate"), QString::fromLatin1(kcc->certificate().toPem()));
+
+            //Every block is different, so a range written at the wrong place shows
+            const qint64 size = 128 * 1024 * 1024 + 12345;
+            QTemporaryFile temp;
+            QVERIFY(temp.open());
+            QByteArray block(1024 * 1024, Qt::Uninitialized);
+            for (qint64 written = 0; written < size; written += block.size()) {
+                block.fill(char('a' + (written / block.size()) % 26));
+                temp.write(block.constData(), qMin<qint64>(block.size(), size - written));
+            }
+            temp.close();
+
+            QSharedPointer<HashingFile> f(new HashingFile(temp.fileName()));
+            QVERIFY(f->openAt(0));
+            UploadJob* uj = new UploadJob(f, deviceId);
+            uj->setStripes(stripes);
+            uj->start();
+            const QVariantMap transferInfo = uj->transferInfo();
+            QCOMPARE(transferInfo.value(QStringLiteral("stripes"), 1).toInt(), stripes);
+
+            //What LanDeviceLink does with the transfer info of a packet
+            QSharedPointer<QIODevice> payload;
+            const quint16 port = transferInfo[QStringLiteral("port")].toUInt();
+            if (stripes > 1) {
+                StripedPayload* striped = new StripedPayload(size);
+                for (int i = 0; i < stripes; ++i) {
+                    QSslSocket* socket = LazyPayloadSocket::connectSocket(QHostAddress::LocalHost, port, deviceId);
+                    QCOMPARE(socket->readBufferSize(), LazyPayloadSocket::ReadBufferSize);
+                    striped->addStripe(socket);
+                }
+                payload.reset(striped);
+            } else {
+                payload.reset(new LazyPayloadSocket(QHostAddress::LocalHost, port, deviceId));
+            }
+
+            const QString destFile = QDir::tempPath() + "/kdeconnect-test-stripedfile";
+            QFile(destFile).remove();
+            FileTransferJob* ft = new FileTransferJob(payload, size, QUrl::fromLocalFile(destFile));
+            int error = -1;
+            connect(ft, &KJob::result, this, [&error](KJob* job) { error = job->error(); });
+            //Stripes bypass the HashingFile, the digest is still computed and checked
+            ft->setVerifyDigest(true);
+            connect(f.data(), &HashingFile::digestReady, ft, &FileTransferJob::setDigest);
+
+            QElapsedTimer timer;
+            timer.start();
+            const std::clock_t cpuStart = std::clock();
+            ft->start();
+            QTRY_VERIFY_WITH_TIMEOUT(error >= 0, 120000);
+            const qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+            const double cpuSeconds = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+            QCOMPARE(error, 0);
+            QCOMPARE(ft->digest().size(), 32);
+
+            //Both ends share one thread here, so this shows the overhead of striping;
+            //the gains come from the peers' cores and congestion windows on a real network
+            qDebug() << "Received" << size / (1024 * 1024) << "MB over" << stripes << "connections in" << elapsed << "ms:"
+                     << (size / (1024.0 * 1024.0)) / (elapsed / 1000.0) << "MB/s,"
+                     << cpuSeconds * (1024.0 * 1024.0 * 1024.0) / size << "cpu seconds per GB";
+
+            QFile result(destFile), origin(temp.fileName());
+            QVERIFY(result.open(QIODevice::ReadOnly));
+            QVERIFY(origin.open(QIODevice::ReadOnly));
+            QCOMPARE(result.size(), size);
+            while (!origin.atEnd()) {
+                QVERIFY(result.read(block.size()) == origin.read(block.size()));
+            }
+            result.remove();
+        }
+
+        void testStripeValidation()
+        {
+            //Stripes past the end of the payload, or over one that arrived already, are refused
+            StripedPayload payload(100);
+            const struct { qint64 offset; qint64 length; bool valid; } stripes[] = {
+                { 0, 60, true },
+                { 50, 50, false },
+                { 90, 20, false },
+                { 60, 40, true }
+            };
+            for (const auto& stripe : stripes) {
+                char header[StripedPayload::HeaderSize];
+                StripedPayload::writeHeader(header, stripe.offset, stripe.length);
+                QBuffer* buffer = new QBuffer;
+                buffer->setData(QByteArray(header, sizeof(header)) + QByteArray(stripe.length, 'x'));
+                buffer->open(QIODevice::ReadOnly);
+                payload.addStripe(buffer);
+            }
+
+            char data[100];
+            qint64 position;
+            for (int i = 0; i < payload.stripeCount(); ++i) {
+                const qint64 size = payload.readStripe(i, data, sizeof(data), &position);
+                QCOMPARE(size, stripes[i].valid ? stripes[i].length : 0);
+                if (stripes[i].valid) {
+                    QCOMPARE(position, stripes[i].offset);
+                }
+            }
+            QCOMPARE(payload.contiguousBytes(), qint64(100));
+        }
+
     private:
         TestDaemon* m_daemon;
 };
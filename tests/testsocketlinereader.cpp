@@ -20,10 +20,12 @@
 #include "../core/backends/lan/server.h"
 
 #include <QTest>
+#include <QBuffer>
 #include <QSslSocket>
 #include <QProcess>
 #include <QEventLoop>
 #include <QTimer>
+#include <QElapsedTimer>
 
 class TestSocketLineReader : public QObject
 {
@@ -34,6 +36,11 @@ public Q_SLOTS:
 
 private Q_SLOTS:
     void socketLineReader();
+    void socketLineReaderThroughput();
+    void framerSplitInput();
+    void framerMaxFrameSize();
+    void framerBenchmark_data();
+    void framerBenchmark();
 
 private:
     QTimer m_timer;
@@ -96,6 +103,149 @@ void TestSocketLineReader::socketLineReader()
     }
 }
 
+void TestSocketLineReader::socketLineReaderThroughput()
+{
+    // Many packets written in one go must all be delivered, in order, without
+    // the reader rescheduling itself for every line
+    const int count = 20000;
+    const QByteArray payload = QByteArray(200, 'x');
+    QByteArray data;
+    for (int i = 0; i < count; ++i) {
+        data += QByteArray::number(i) + ':' + payload + '\n';
+    }
+
+    QSslSocket* client = new QSslSocket(this);
+    client->connectToHost(QHostAddress::LocalHost, 8694);
+    QVERIFY(client->waitForConnected(4000));
+    QVERIFY(m_server->waitForNewConnection(4000) || m_server->hasPendingConnections());
+    QSslSocket* sock = m_server->nextPendingConnection();
+    QVERIFY2(sock != nullptr, "Could not open a connection to the client");
+
+    SocketLineReader reader(sock);
+    int received = 0;
+    bool inOrder = true;
+    connect(&reader, &SocketLineReader::readyRead, this, [&]() {
+        quint8 type;
+        while (reader.bytesAvailable() > 0) {
+            const QByteArray line = reader.readFrame(&type);
+            inOrder = inOrder && line.startsWith(QByteArray::number(received) + ':');
+            if (++received == count) {
+                m_loop.exit();
+            }
+        }
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    client->write(data);
+    m_timer.start();
+    m_loop.exec();
+
+    QCOMPARE(received, count);
+    QVERIFY(inOrder);
+    qDebug() << "Received" << data.size() << "bytes in" << timer.elapsed() << "ms";
+
+    delete client;
+}
+
+void TestSocketLineReader::framerSplitInput()
+{
+    PacketFramer framer;
+    PacketFramer::Frame frame;
+
+    // Lines split at every possible point, with empty lines in between
+    const QByteArray data("foobar\n\nbarfoo\npanda\n");
+    for (int i = 0; i < data.size(); ++i) {
+        QVERIFY(framer.append(data.constData() + i, 1));
+    }
+    QVERIFY(framer.nextFrame(&frame));
+    QCOMPARE(frame.data, QByteArray("foobar\n"));
+    QVERIFY(framer.nextFrame(&frame));
+    QCOMPARE(frame.data, QByteArray("barfoo\n"));
+    QVERIFY(framer.nextFrame(&frame));
+    QCOMPARE(frame.data, QByteArray("panda\n"));
+    QVERIFY(!framer.nextFrame(&frame));
+    QCOMPARE(framer.bufferedBytes(), 0);
+
+    // Length prefixed frames, header split across appends
+    framer.setFraming(PacketFramer::LengthPrefixedFraming);
+    char header[PacketFramer::HeaderSize];
+    PacketFramer::writeHeader(header, PacketFramer::CompressedPacketFrame, 5);
+    QVERIFY(framer.append(header, 3));
+    QVERIFY(!framer.hasFrame());
+    QVERIFY(framer.append(header + 3, PacketFramer::HeaderSize - 3));
+    QVERIFY(framer.append("hel", 3));
+    QVERIFY(!framer.hasFrame());
+    QVERIFY(framer.append("lo", 2));
+    QVERIFY(framer.nextFrame(&frame));
+    QCOMPARE(int(frame.type), int(PacketFramer::CompressedPacketFrame));
+    QCOMPARE(frame.data, QByteArray("hello"));
+}
+
+void TestSocketLineReader::framerMaxFrameSize()
+{
+    PacketFramer::Frame frame;
+
+    PacketFramer lines(16);
+    QVERIFY(lines.append("short\n", 6));
+    QVERIFY(lines.nextFrame(&frame));
+    QVERIFY(!lines.append("this line never ends", 20));
+    QVERIFY(lines.hasError());
+
+    PacketFramer frames(16);
+    frames.setFraming(PacketFramer::LengthPrefixedFraming);
+    char header[PacketFramer::HeaderSize];
+    PacketFramer::writeHeader(header, PacketFramer::PacketFrame, 17);
+    QVERIFY(!frames.append(header, PacketFramer::HeaderSize));
+    QVERIFY(!frames.nextFrame(&frame));
+
+    // A header too big is refused as soon as it is read, even behind a complete frame
+    QByteArray data;
+    PacketFramer::writeHeader(header, PacketFramer::PacketFrame, 4);
+    data.append(header, PacketFramer::HeaderSize).append("ping");
+    PacketFramer::writeHeader(header, PacketFramer::PacketFrame, 17);
+    data.append(header, PacketFramer::HeaderSize).append("not the rest");
+    QBuffer device(&data);
+    QVERIFY(device.open(QIODevice::ReadOnly));
+    PacketFramer burst(16);
+    burst.setFraming(PacketFramer::LengthPrefixedFraming);
+    QVERIFY(!burst.readFrom(&device));
+    QVERIFY(burst.hasError());
+}
+
+void TestSocketLineReader::framerBenchmark_data()
+{
+    QTest::addColumn<int>("lineSize");
+
+    QTest::newRow("mousepad") << 80;
+    QTest::newRow("sms") << 4096;
+    QTest::newRow("contacts") << 256 * 1024;
+}
+
+void TestSocketLineReader::framerBenchmark()
+{
+    QFETCH(int, lineSize);
+
+    // About 4MB of lines, fed in 16KB chunks like a socket would
+    QByteArray line(lineSize - 1, 'x');
+    line += '\n';
+    const QByteArray data = line.repeated(qMax(1, 4 * 1024 * 1024 / lineSize));
+    const int chunkSize = 16 * 1024;
+
+    PacketFramer framer;
+    PacketFramer::Frame frame;
+    QBENCHMARK {
+        int frames = 0;
+        for (int offset = 0; offset < data.size(); offset += chunkSize) {
+            framer.append(data.constData() + offset, qMin(chunkSize, data.size() - offset));
+            while (framer.nextFrame(&frame)) {
+                ++frames;
+            }
+        }
+        QCOMPARE(frames, data.size() / lineSize);
+    }
+}
+
 void TestSocketLineReader::newPacket()
 {
     if (!m_reader->bytesAvailable()) {
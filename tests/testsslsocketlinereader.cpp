@@ -25,6 +25,7 @@
 #include <QtCrypto>
 #include <QTest>
 #include <QTimer>
+#include <QElapsedTimer>
 
 /*
  * This class tests the behaviour of socket line reader when the connection if over ssl. Since SSL takes part below application layer,
@@ -46,6 +47,7 @@ private Q_SLOTS:
     void testTrustedDevice();
     void testUntrustedDevice();
     void testTrustedDeviceWithWrongCertificate();
+    void testThroughput();
 
 
 private:
@@ -261,6 +263,62 @@ void TestSslSocketLineReader::testTrustedDeviceWithWrongCertificate()
 
 }
 
+void TestSslSocketLineReader::testThroughput()
+{
+    int maxAttemps = 5;
+    while(!m_server->hasPendingConnections() && maxAttemps > 0) {
+        --maxAttemps;
+        QTest::qSleep(1000);
+    }
+
+    QSslSocket* serverSocket = m_server->nextPendingConnection();
+    QVERIFY2(serverSocket != 0, "Could not open a connection to the client");
+
+    setSocketAttributes(serverSocket, QStringLiteral("Test Server"));
+    setSocketAttributes(m_clientSocket, QStringLiteral("Test Client"));
+    serverSocket->setPeerVerifyMode(QSslSocket::QueryPeer);
+    m_clientSocket->setPeerVerifyMode(QSslSocket::QueryPeer);
+
+    connect(m_clientSocket, &QSslSocket::encrypted, &m_loop, &QEventLoop::quit);
+    serverSocket->startServerEncryption();
+    m_clientSocket->startClientEncryption();
+    m_timer.start();
+    m_loop.exec();
+    QVERIFY2(m_clientSocket->isEncrypted(), "Client is not encrypted");
+
+    // A burst of sms sized packets, all of them must arrive and in order
+    const int count = 5000;
+    const QByteArray payload = QByteArray(1000, 'x');
+    QByteArray data;
+    for (int i = 0; i < count; ++i) {
+        data += QByteArray::number(i) + ':' + payload + '\n';
+    }
+
+    SocketLineReader reader(serverSocket);
+    int received = 0;
+    bool inOrder = true;
+    connect(&reader, &SocketLineReader::readyRead, this, [&]() {
+        quint8 type;
+        while (reader.bytesAvailable() > 0) {
+            const QByteArray line = reader.readFrame(&type);
+            inOrder = inOrder && line.startsWith(QByteArray::number(received) + ':');
+            if (++received == count) {
+                m_loop.exit();
+            }
+        }
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    m_clientSocket->write(data);
+    m_timer.start();
+    m_loop.exec();
+
+    QCOMPARE(received, count);
+    QVERIFY(inOrder);
+    qDebug() << "Received" << data.size() << "bytes over ssl in" << timer.elapsed() << "ms";
+}
+
 void TestSslSocketLineReader::newPacket()
 {
     if (!m_reader->bytesAvailable()) {